@@ -30,6 +30,11 @@ filter {"action:vs*"}
    defines{ "TARGET_WINDOWS" }
 filter {}
 
+filter {"system:linux"}
+   defines{ "TARGET_LINUX" }
+   links{ "pthread" }
+filter {}
+
 filter {"Release", "action:vs*"}
    buildoptions { "/Ob2", "/GL" }
    linkoptions  { "/LTCG:incremental" }
@@ -40,3 +45,10 @@ kind      "ConsoleApp"
 language  "C++"
 
 files { "source/*.cpp", "source/*.h" }
+
+-- The AVX2 hash loop is only used after checking the CPU at runtime.
+filter { "files:source/hash_avx2.cpp", "action:vs*" }
+   buildoptions { "/arch:AVX2" }
+filter { "files:source/hash_avx2.cpp", "action:not vs*" }
+   buildoptions { "-mavx2" }
+filter {}
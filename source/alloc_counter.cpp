@@ -0,0 +1,40 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#include "alloc_counter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+// Relaxed, since it's only read after the workers are done.
+static std::atomic<uint64_t> g_allocations{ 0 };
+
+//-----------------------------------------------------------------------------
+uint64_t AllocationCount() noexcept {
+   return g_allocations.load( std::memory_order_relaxed );
+}
+
+} /////////////////////////////////////////////////////////////////////////////
+
+//-----------------------------------------------------------------------------
+// The replacements for the global allocation functions. The array and
+//  nothrow forms call these by default, so they're counted too.
+void *operator new( std::size_t size ) {
+   Treehash::g_allocations.fetch_add( 1, std::memory_order_relaxed );
+   if( size == 0 ) size = 1;
+   if( void *memory = std::malloc( size )) return memory;
+   throw std::bad_alloc();
+}
+
+//-----------------------------------------------------------------------------
+void operator delete( void *memory ) noexcept {
+   std::free( memory );
+}
+
+//-----------------------------------------------------------------------------
+void operator delete( void *memory, std::size_t ) noexcept {
+   std::free( memory );
+}
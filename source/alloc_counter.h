@@ -0,0 +1,16 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+// How many times the global operator new has been called so far. --time
+//  prints how many allocations the scan itself made, which shows whether a
+//  scanner allocates anything for each file.
+uint64_t AllocationCount() noexcept;
+
+} /////////////////////////////////////////////////////////////////////////////
@@ -5,10 +5,19 @@
 #include "hash.h"
 #include "scanner.h"
 #include "options.h"
+#include "ext_matcher.h"
+#include "ignore_matcher.h"
+#include "markers.h"
 
+#include <chrono>
+#include <cstdlib>
 #include <filesystem>
-#include <unordered_set>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <unordered_set>
+#include <vector>
 
 ///////////////////////////////////////////////////////////////////////////////
 namespace Treehash {
@@ -18,15 +27,148 @@ namespace Treehash {
 //
 class DefaultScanner : public Scanner {
 //-----------------------------------------------------------------------------
-   std::unordered_set<std::string_view> m_exts;
-   std::unordered_set<std::string_view> m_ignores;
+   ExtMatcher m_exts;
+   IgnoreMatcher m_ignores;
+   //--------------------------------------------------------------------------
+   // Length of the base path in front of the paths we iterate over. That part
+   //  isn't hashed.
+   size_t m_base_length = 0;
+   //--------------------------------------------------------------------------
+   // Optional manifest that every directory is added to.
+   Manifest *m_manifest = nullptr;
+   // Set if .gitignore files are honoured.
+   GitIgnore *m_gitignore = nullptr;
+   // Optional filter on the files' metadata.
+   const FilterExpression *m_expr = nullptr;
+   //--------------------------------------------------------------------------
+   // Set while ReadDirectory is working. Subdirectories aren't scanned, and
+   //  what we find goes here instead of into the manifest.
+   DirCacheEntry *m_listing = nullptr;
 
    //--------------------------------------------------------------------------
-   inline bool IsExcluded( const std::filesystem::path &path,
-                                                    bool directory ) noexcept {
-      // Ignore files that start with "."
-      std::string filename = path.filename().string();
+   // The hashed path of the entry being looked at. Like the linux scanner,
+   //  it's built in place as we go, so names are views into this or into the
+   //  directory entry, and nothing is allocated for each file.
+   std::string m_path;
+#ifdef TARGET_WINDOWS
+   // Names are converted from UTF-16 into here.
+   std::string m_name;
+#endif
+   // Counters for diagnostics.
+   ScanStats m_stats;
+
+   //--------------------------------------------------------------------------
+   // A directory on the way down to the one being scanned. As in the linux
+   //  scanner, a stack of these takes the place of recursion. Only
+   //  --max-open of them hold an iterator. The rest let go of theirs, and
+   //  when we get back to them, they start over and skip the `taken`
+   //  entries they'd already seen, which works as long as the directory
+   //  doesn't change in the meantime.
+   struct Frame {
+      std::filesystem::path path;
+      std::filesystem::directory_iterator iter;
+      bool open = false;
+      // Set while `iter` is still on the last entry taken.
+      bool advance = false;
+      size_t taken = 0;
+      // Length of `m_path` for this directory, with its trailing slash.
+      size_t path_start = 0;
+      // How far below the root it is.
+      int level = 0;
+      // Whether its subdirectories are scanned.
+      bool descend = false;
+      // True if it or a directory above it is reached through a symlink.
+      bool linked = false;
+      // With --symlinks once, its RealPath if it's a symlink.
+      std::string real;
+      Hash seed = 0;
+      const IgnoreNode *ignore = nullptr;
+      const GlobState *glob = nullptr;
+      GitFramePtr git;
+      // The hash so far, with the subdirectories that are done.
+      Hash hash = 0;
+      DirCacheEntry record;
+   };
+   std::vector<Frame> m_frames;
+   // How many frames hold an iterator, and the first one that might. The
+   //  ones below it don't.
+   int m_open = 0;
+   size_t m_first_open = 0;
+   // True if this is a recursive scan.
+   bool m_recursive = false;
+   //--------------------------------------------------------------------------
+   // With --symlinks once, the directories read under this root, by their
+   //  canonical paths with a trailing slash. std::filesystem has no inode
+   //  numbers. `m_root_real` is the root's.
+   std::unordered_set<std::string> m_visited;
+   std::string m_root_real;
+   //--------------------------------------------------------------------------
+   // With --symlinks once, links to directories wait here, by their hashed
+   //  path, until the rest of the root is done, and are then gone into one
+   //  at a time from the smallest path, as in the linux scanner. That way
+   //  which of two links reads a directory doesn't depend on which is found
+   //  first. The fields are the link's own, except for `git`, which is the
+   //  directory's that it's in, and `tops` has the RealPaths of the links on
+   //  the way down to it.
+   struct DeferredLink {
+      std::filesystem::path path;
+      int level;
+      Hash seed;
+      const IgnoreNode *ignore;
+      const GlobState *glob;
+      GitFramePtr git;
+      std::vector<std::string> tops;
+   };
+   std::map<std::string, DeferredLink> m_deferred;
+   // The `tops` of the one being gone into.
+   std::vector<std::string> m_replay_tops;
+
+   //--------------------------------------------------------------------------
+   // The path as it's hashed, relative to the base path.
+   inline std::string HashPath( const std::filesystem::path &path ) noexcept {
+      return path.generic_string().substr( m_base_length );
+   }
+
+   //--------------------------------------------------------------------------
+   // The name of `file`. Where paths are narrow, that's a view into its path,
+   //  which stays put until the iterator moves on.
+   std::string_view EntryName(
+                  const std::filesystem::directory_entry &file ) noexcept {
+#ifdef TARGET_WINDOWS
+      m_name = file.path().filename().string();
+      return m_name;
+#else
+      std::string_view path = file.path().native();
+      // npos + 1 is 0.
+      return path.substr( path.rfind( '/' ) + 1 );
+#endif
+   }
 
+   //--------------------------------------------------------------------------
+   // The GitIgnore frame of the subdirectory `path` of a directory with
+   //  `parent`. `m_path` is its hashed path, with a trailing slash.
+   GitFramePtr EnterGitIgnore( const std::filesystem::path &path,
+                               const GitFramePtr &parent ) noexcept {
+      return GitIgnore::Enter( parent, m_path.size(),
+                               [&]( const char *name, std::string &text ) {
+         std::ifstream file( path / name, std::ios::binary );
+         if( !file ) return false;
+         text.assign( std::istreambuf_iterator<char>( file ), {} );
+         return true;
+      });
+   }
+
+   //--------------------------------------------------------------------------
+   // Checks the entry at the end of `m_path`, whose name starts at
+   //  `name_start`. `dir`, `glob` and `git` are the IgnoreNode, GlobState
+   //  and GitIgnore frame of the directory that it's in.
+   inline bool IsExcluded( size_t name_start, bool directory,
+                           const IgnoreNode *dir, const GlobState *glob,
+                           const GitIgnoreFrame *git ) noexcept {
+      std::string_view filename = std::string_view( m_path )
+                                     .substr( name_start );
+
+      // Ignore files that start with "."
       if( filename[0] == '.' ) {
          return true;
       }
@@ -34,89 +176,559 @@ class DefaultScanner : public Scanner {
       if( !directory ) {
          // Ignore files that have an excluded extension.
          
-         if( !m_exts.empty() 
-              && m_exts.find( path.extension().string() ) == m_exts.end() ) {
+         if( !m_exts.Empty() && !m_exts.MatchName( filename )) {
             return true;
          }
+
+         if( !GlobMatcher::MatchFile( glob, filename )) return true;
       }
 
       // Ignore files that match the files specified.
-      for( auto &i : m_ignores ) {
-         if( filename == i ) return true;
-         if( path.generic_string() == i ) return true;
+      if( m_ignores.IsIgnored( dir, filename )) return true;
+
+      if( !git ) return false;
+      return GitIgnore::IsIgnored( git, m_path, name_start, directory );
+   }
+
+   //--------------------------------------------------------------------------
+   // Checks a file against the filter expression, only looking up its
+   //  metadata if its name and type don't settle it.
+   bool MatchExpression( const std::filesystem::directory_entry &file,
+                         std::string_view name ) {
+      namespace fs = std::filesystem;
+      using namespace std::chrono;
+      bool link = file.is_symlink();
+      int match = m_expr->MatchName( name, link );
+      if( match >= 0 ) return match > 0;
+
+      m_stats.stats++;
+      FileMeta meta;
+      std::error_code error_code;
+      unsigned needs = m_expr->Needs();
+      if( needs & FilterExpression::NEED_SIZE ) {
+         meta.size = file.file_size( error_code );
+         if( error_code ) return false;
+      }
+      if( needs & FilterExpression::NEED_MTIME ) {
+         auto mtime = file.last_write_time( error_code );
+         if( error_code ) return false;
+         // The file clock's epoch isn't specified, so go through now.
+         auto age = fs::file_time_type::clock::now() - mtime;
+         meta.mtime_ns = duration_cast<nanoseconds>(
+                  system_clock::now().time_since_epoch() - age ).count();
       }
+      if( needs & FilterExpression::NEED_MODE ) {
+         meta.mode = (uint32_t)file.status( error_code ).permissions()
+                     & 07777;
+         if( error_code ) return false;
+      }
+      return m_expr->Match( name, link, meta );
+   }
 
-      return false;
+   //--------------------------------------------------------------------------
+   // True if the directory `path` has one of the Markers in it.
+   static bool IsMarked( const std::filesystem::path &path ) noexcept {
+      std::error_code error_code;
+      if( std::filesystem::exists( path / Markers::STOP_FILE, error_code ))
+         return true;
+      std::ifstream tag( path / Markers::CACHEDIR_TAG, std::ios::binary );
+      if( !tag ) return false;
+      std::string head( Markers::CACHEDIR_SIGNATURE.size(), 0 );
+      tag.read( head.data(), head.size() );
+      return tag && head == Markers::CACHEDIR_SIGNATURE;
    }
 
    //--------------------------------------------------------------------------
-   Hash ScanRecursion( const std::filesystem::path &path, bool recursive ) noexcept {
-      Hash hash = 0;
+   // Called when the directory `path` can't be read. One that's gone or that
+   //  we aren't allowed into is left out. Anything else, like a path longer
+   //  than the system takes, would leave a hole in the hash that nobody
+   //  sees, so the scan stops with an error instead.
+   static void CheckReadError( const std::filesystem::path &path,
+                               std::error_code error_code ) noexcept {
+      if( error_code == std::errc::no_such_file_or_directory
+            || error_code == std::errc::not_a_directory
+            || error_code == std::errc::permission_denied
+            || error_code == std::errc::operation_not_permitted
+            || error_code == std::errc::too_many_symbolic_link_levels )
+         return;
+      std::cout << "Couldn't read " << path.generic_string() << ": "
+                << error_code.message() << "\n";
+      std::cout.flush();
+      std::_Exit( opt_diff_file.empty() && opt_verify_file.empty() ? 1 : 2 );
+   }
+
+   //--------------------------------------------------------------------------
+   // Starts reading the directory of `frame`, or starts it over and skips
+   //  the entries that it already took. Returns false if it can't be read.
+   bool OpenFrame( Frame &frame ) noexcept {
       namespace fs = std::filesystem;
+      std::error_code error_code;
+      // A folder we aren't allowed into is left out by CheckReadError, as
+      //  the other scanners do, rather than read as an empty one.
+      frame.iter = fs::directory_iterator( frame.path
+                        , fs::directory_options::follow_directory_symlink
+                        , error_code );
+      for( size_t i = 0; i < frame.taken && !error_code
+                         && frame.iter != fs::directory_iterator(); i++ ) {
+         frame.iter.increment( error_code );
+      }
+      if( error_code ) {
+         CheckReadError( frame.path, error_code );
+         frame.iter = fs::directory_iterator();
+         return false;
+      }
+      frame.open = true;
+      frame.advance = false;
+      m_open++;
+      MakeRoom();
+      return true;
+   }
 
+   //--------------------------------------------------------------------------
+   // True if the directory `path` can be read. A scan leaves one that can't
+   //  out of the manifest, so listings that are checked against it do too.
+   static bool CanRead( const std::filesystem::path &path ) noexcept {
+      namespace fs = std::filesystem;
       std::error_code error_code;
       fs::directory_iterator iter( path
                         , fs::directory_options::follow_directory_symlink
-                        | fs::directory_options::skip_permission_denied
                         , error_code );
+      if( !error_code ) return true;
+      CheckReadError( path, error_code );
+      return false;
+   }
+
+   //--------------------------------------------------------------------------
+   void CloseFrame( Frame &frame ) noexcept {
+      frame.iter = std::filesystem::directory_iterator();
+      frame.open = false;
+      m_open--;
+   }
+
+   //--------------------------------------------------------------------------
+   // Lets go of the iterators furthest from the top until no more than
+   //  --max-open are left. The one on top is in use.
+   void MakeRoom() noexcept {
+      for( ; m_open > opt_max_open && m_first_open + 1 < m_frames.size();
+             m_first_open++ ) {
+         Frame &frame = m_frames[m_first_open];
+         if( frame.open ) CloseFrame( frame );
+      }
+   }
+
+   //--------------------------------------------------------------------------
+   // The canonical path of the directory `path`, with a trailing slash, or
+   //  an empty string if it can't be found.
+   static std::string RealPath( const std::filesystem::path &path ) noexcept {
+      std::error_code error_code;
+      std::string real = std::filesystem::canonical( path, error_code )
+                                                        .generic_string();
+      if( error_code ) return {};
+      if( real.back() != '/' ) real.push_back( '/' );
+      return real;
+   }
+
+   //--------------------------------------------------------------------------
+   // True if `path` is the directory of the frame at `index`, or one on the
+   //  way down to it. A symlink to it would go around forever.
+   bool IsAncestor( size_t index, const std::filesystem::path &path ) noexcept {
+      namespace fs = std::filesystem;
+      std::error_code error_code;
+      for( size_t i = 1; i <= index; i++ ) {
+         if( fs::equivalent( path, m_frames[i].path, error_code ))
+            return true;
+      }
+      for( fs::path up = m_frames[0].path;; up = up.parent_path() ) {
+         if( fs::equivalent( path, up, error_code )) return true;
+         if( !up.has_relative_path() ) return false;
+      }
+   }
+
+   //--------------------------------------------------------------------------
+   // True if the RealPath `real` is inside the root, or inside a directory
+   //  that one of the links on the way down to the frame at `parent` goes
+   //  to.
+   bool IsInsideTop( const std::string &real, size_t parent ) noexcept {
+      auto inside = [&real]( const std::string &top ) {
+         return !top.empty() && real.compare( 0, top.size(), top ) == 0;
+      };
+      if( inside( m_root_real )) return true;
+      for( auto &top : m_replay_tops ) {
+         if( inside( top )) return true;
+      }
+      // While a link is gone into by RunDeferred, it's on the bottom.
+      for( size_t i = 0; i <= parent && i < m_frames.size(); i++ ) {
+         if( inside( m_frames[i].real )) return true;
+      }
+      return false;
+   }
 
-      if( error_code ) return 0;
-      
-      for( auto &file : iter ) {
-         if( file.is_directory() && recursive ) {
-            if( IsExcluded( file.path(), true )) continue;
-            hash ^= ScanRecursion( file, recursive );
+   //--------------------------------------------------------------------------
+   // Checks the subdirectory `path` of the frame at `parent` when symlinks
+   //  are followed. It's left out if it's read somewhere else. `link` is set
+   //  if it's a symlink. Returns why it's left out, or null if it isn't.
+   //  `real` is set to its RealPath if that's looked up.
+   const char *Revisits( size_t parent, bool link,
+                         const std::filesystem::path &path,
+                         std::string &real ) noexcept {
+      if( link && IsAncestor( parent, path )) return "symlink loop";
+      // A listing can't tell what else is read.
+      if( opt_symlinks != Symlinks::ONCE || m_listing
+                                || !(link || m_frames[parent].linked) )
+         return nullptr;
+      real = RealPath( path );
+      if( real.empty() ) return "can't be found";
+      // A link into the root, or into a directory that a link on the way
+      //  down goes to, is left for the directory's own path, which is the
+      //  same whichever order things are found in.
+      if( link && IsInsideTop( real, parent )) return "read where it is";
+      if( !m_visited.insert( real ).second ) return "read already";
+      return nullptr;
+   }
+
+   //--------------------------------------------------------------------------
+   // Pushes a frame for the directory `path`, whose hashed path is in
+   //  `m_path` with a trailing slash. `seed` is its DirectorySeed, `ignore`
+   //  is its IgnoreNode, `glob` is its GlobState, and `git` is its GitIgnore
+   //  frame. `level` is how far below the root it is. Returns false if it
+   //  can't be read, in which case nothing is pushed.
+   bool PushFrame( std::filesystem::path path, int level, Hash seed,
+                   const IgnoreNode *ignore, const GlobState *glob,
+                   GitFramePtr git ) noexcept {
+      Frame &frame = m_frames.emplace_back();
+      frame.path = std::move( path );
+      frame.path_start = m_path.size();
+      frame.level = level;
+      // ReadDirectory goes by what it's asked for, which comes from a
+      //  manifest that already took the depth into account.
+      frame.descend = m_recursive && (m_listing || WithinMaxDepth( level ));
+      frame.seed = seed;
+      frame.ignore = ignore;
+      frame.glob = glob;
+      frame.git = std::move( git );
+      if( OpenFrame( frame )) return true;
+      m_frames.pop_back();
+      return false;
+   }
+
+   //--------------------------------------------------------------------------
+   // Reads on through the directory of the frame at `index`, which is on
+   //  top. Returns true when it pushes a frame for a subdirectory, which is
+   //  done before this goes on, or false when the directory is done.
+   bool ReadFrame( size_t index ) noexcept {
+      namespace fs = std::filesystem;
+      // The stack may move when a frame is pushed.
+      Frame *frame = &m_frames[index];
+      if( !frame->open && !OpenFrame( *frame )) return false;
+      size_t path_start = frame->path_start;
+      const IgnoreNode *ignore = frame->ignore;
+      const GlobState *glob = frame->glob;
+      std::error_code error_code;
+
+      for(;;) {
+         // It stays on an entry until we're back from it.
+         if( frame->advance ) {
+            frame->advance = false;
+            frame->iter.increment( error_code );
+            if( error_code ) {
+               CheckReadError( frame->path, error_code );
+               return false;
+            }
+         }
+         if( frame->iter == fs::directory_iterator() ) return false;
+         const fs::directory_entry &file = *frame->iter;
+         frame->advance = true;
+         frame->taken++;
+
+         std::string_view name = EntryName( file );
+         m_path.resize( path_start );
+         m_path.append( name );
+         if( name[0] != '.' ) m_stats.entries++;
+
+         bool link = file.is_symlink();
+         if( link && opt_symlinks == Symlinks::SKIP ) continue;
+         // Following a symlink to see what it is takes a stat.
+         if( link ) m_stats.stats++;
+         if( file.is_directory() && frame->descend ) {
+            const GitFramePtr &git = frame->git;
+            if( IsExcluded( path_start, true, ignore, glob, git.get() ))
+               continue;
+            const GlobState *child_glob = GlobMatcher::Child( glob, name );
+            if( GlobMatcher::Skip( child_glob )) continue;
+            m_path.push_back( '/' );
+            if( opt_skip_marked && IsMarked( file.path() )) {
+               if( opt_verbose ) {
+                  std::cout << " - " << m_path << " (marked)\n";
+               }
+               continue;
+            }
+            if( link && opt_symlinks == Symlinks::ONCE && !m_listing ) {
+               if( m_manifest ) {
+                  frame->record.subdirs.push_back({ std::string( name ),
+                                                    true });
+               }
+               Defer( index, file, name, child_glob );
+               continue;
+            }
+            std::string real;
+            if( opt_symlinks != Symlinks::SKIP ) {
+               const char *skip = Revisits( index, link, file.path(), real );
+               if( skip ) {
+                  if( opt_verbose ) {
+                     std::cout << " - " << m_path << " (" << skip << ")\n";
+                  }
+                  continue;
+               }
+            }
+            if( m_listing && !CanRead( file.path() )) continue;
+            if( m_manifest || m_listing ) {
+               frame->record.subdirs.push_back({ std::string( name ),
+                                                 link });
+            }
+            if( m_listing ) continue;
+            bool linked = link || frame->linked;
+            if( PushFrame( file.path(), frame->level + 1,
+                           SubdirectorySeed( frame->seed, name ),
+                           m_ignores.Child( ignore, name ), child_glob,
+                           m_gitignore ? EnterGitIgnore( file, git )
+                                       : nullptr )) {
+               m_frames.back().linked = linked;
+               if( link ) m_frames.back().real = std::move( real );
+               return true;
+            }
+            frame = &m_frames[index];
          } else if( file.is_regular_file() ) {
-            auto path = file.path();
-            if( IsExcluded( file.path(), false )) {
+            if( IsExcluded( path_start, false, ignore, glob,
+                            frame->git.get() )
+                        || (m_expr && !MatchExpression( file, name ))) {
                if( opt_verbose ) {
-                  std::string file = path.generic_string();
-                  std::cout << "   " << file << "\n";
+                  std::cout << "   " << m_path << "\n";
                }
                continue;
             }
             
-            auto &file = path.generic_string();
-            hash ^= XXH64( file.data(), file.size(), HASH_SEED );
+            Hash file_hash = FileHash( m_path, path_start, frame->seed );
+            frame->hash ^= file_hash;
+            frame->record.files ^= file_hash;
+            if( m_manifest ) {
+               // The names are packed end to end, so this only allocates
+               //  when it outgrows what it has.
+               frame->record.names.append( name );
+               frame->record.names.push_back( 0 );
+            }
             
             if( opt_verbose ) {
-               std::cout << " * " << file << "\n";
+               std::cout << " * " << m_path << "\n";
             }
          }
       }
+   }
+
+   //--------------------------------------------------------------------------
+   // Puts off the link `file` named `name`, in the directory of the frame at
+   //  `parent`, until RunDeferred. `glob` is its GlobState. Its hashed path
+   //  is in `m_path` with a trailing slash.
+   void Defer( size_t parent, const std::filesystem::directory_entry &file,
+               std::string_view name, const GlobState *glob ) noexcept {
+      Frame &frame = m_frames[parent];
+      std::vector<std::string> tops = m_replay_tops;
+      for( size_t i = 0; i <= parent; i++ ) {
+         if( !m_frames[i].real.empty() ) tops.push_back( m_frames[i].real );
+      }
+      m_deferred.emplace( m_path,
+                          DeferredLink{ file.path(), frame.level + 1,
+                                        SubdirectorySeed( frame.seed, name ),
+                                        m_ignores.Child( frame.ignore, name ),
+                                        glob, frame.git, std::move( tops )});
+   }
+
+   //--------------------------------------------------------------------------
+   // Goes into the links that Defer put off, smallest path first, until
+   //  there are none left. The ones found under them are put off too.
+   //  Returns the hash of what they lead to.
+   Hash RunDeferred() noexcept {
+      namespace fs = std::filesystem;
+      Hash hash = 0;
+      while( !m_deferred.empty() ) {
+         auto next = m_deferred.extract( m_deferred.begin() );
+         DeferredLink &link = next.mapped();
+         m_path = std::move( next.key() );
+         m_replay_tops = std::move( link.tops );
+
+         // The same checks as Revisits, with the directories on the way
+         //  down to it taken from its path, since they aren't on the stack.
+         const char *skip = nullptr;
+         std::error_code error_code;
+         for( fs::path up = link.path.parent_path();;
+              up = up.parent_path() ) {
+            if( fs::equivalent( link.path, up, error_code )) {
+               skip = "symlink loop";
+               break;
+            }
+            if( !up.has_relative_path() ) break;
+         }
+         std::string real;
+         if( !skip ) {
+            real = RealPath( link.path );
+            if( real.empty() ) {
+               skip = "can't be found";
+            } else if( IsInsideTop( real, 0 )) {
+               skip = "read where it is";
+            } else if( !m_visited.insert( real ).second ) {
+               skip = "read already";
+            }
+         }
+         if( skip ) {
+            if( opt_verbose )
+               std::cout << " - " << m_path << " (" << skip << ")\n";
+            continue;
+         }
+
+         m_first_open = 0;
+         GitFramePtr git;
+         if( m_gitignore ) git = EnterGitIgnore( link.path, link.git );
+         if( !PushFrame( link.path, link.level, link.seed, link.ignore,
+                         link.glob, std::move( git )))
+            continue;
+         m_frames.back().linked = true;
+         m_frames.back().real = std::move( real );
+         hash ^= Run();
+      }
+      m_replay_tops.clear();
       return hash;
    }
+
+   //--------------------------------------------------------------------------
+   // Keeps what was found in the directory of `frame`, which is done.
+   //  `m_path` is its hashed path.
+   void Record( Frame &frame ) noexcept {
+      DirCacheEntry &record = frame.record;
+      if( m_listing ) {
+         record.recursive = frame.descend;
+         *m_listing = std::move( record );
+      } else if( m_manifest ) {
+         record.recursive = frame.descend;
+         record.named = true;
+         auto entry = std::make_shared<const DirCacheEntry>(
+                                                      std::move( record ));
+         m_manifest->Add( m_path, std::move( entry ));
+      }
+   }
+
+   //--------------------------------------------------------------------------
+   // Works through the stack, which has the root on the bottom, until it's
+   //  empty. Returns the root's hash.
+   Hash Run() noexcept {
+      for(;;) {
+         if( ReadFrame( m_frames.size() - 1 )) continue;
+
+         // It's done.
+         Frame &done = m_frames.back();
+         if( done.open ) CloseFrame( done );
+         m_path.resize( done.path_start );
+         Record( done );
+         Hash hash = done.hash;
+         m_frames.pop_back();
+         if( m_frames.empty() ) return hash;
+         m_frames.back().hash ^= hash;
+         // Only the new top can be open past the ones that are closed.
+         m_first_open = std::min( m_first_open, m_frames.size() - 1 );
+      }
+   }
    
+   //--------------------------------------------------------------------------
+   Hash ScanRoot( const std::filesystem::path &path, bool recursive,
+                  const GlobState *glob ) noexcept {
+      m_path = HashPath( path );
+      // Same joining rule as std::filesystem::path::operator/.
+      if( !m_path.empty() && m_path.back() != '/' ) m_path.push_back( '/' );
+      GitFramePtr git;
+      if( m_gitignore ) git = m_gitignore->Root( path.generic_string(),
+                                                 m_path.size() );
+      m_recursive = recursive;
+      m_first_open = 0;
+      if( opt_symlinks == Symlinks::ONCE && !m_listing ) {
+         m_root_real = RealPath( path );
+         m_visited.clear();
+         m_visited.insert( m_root_real );
+      }
+      if( !PushFrame( path, 0, DirectorySeed( m_path ),
+                      m_ignores.Find( m_path ), glob, std::move( git )))
+         return 0;
+      Hash hash = Run();
+      if( !m_deferred.empty() ) hash ^= RunDeferred();
+      return hash;
+   }
+
 public:
    //--------------------------------------------------------------------------
-   Hash Scan( std::string_view path, bool recursive ) noexcept override {
-      return ScanRecursion( path, recursive );
+   ScanStats GetStats() const noexcept override {
+      return m_stats;
    }
 
    //--------------------------------------------------------------------------
-   void ResetExts() noexcept override {
-      m_exts.clear();
+   bool SetManifest( Manifest *manifest ) noexcept override {
+      m_manifest = manifest;
+      return true;
+   }
 
-      for( auto &e : opt_exts )
-         m_exts.insert( e );
+   //--------------------------------------------------------------------------
+   bool SetGitIgnore( GitIgnore *gitignore ) noexcept override {
+      m_gitignore = gitignore;
+      return true;
    }
 
    //--------------------------------------------------------------------------
-   void ResetIgnores() noexcept override {
-      m_ignores.clear();
+   bool SetFilter( const FilterExpression *filter ) noexcept override {
+      m_expr = filter;
+      return true;
+   }
 
-      for( auto &i : opt_ignores )
-         m_ignores.insert( i );
+   //--------------------------------------------------------------------------
+   Hash Scan( std::string_view path, bool recursive,
+              const GlobState *glob ) noexcept override {
+      if( GlobMatcher::Skip( glob )) return 0;
+      std::string full = BasePrefix( path );
+      m_base_length = full.size();
+      full.append( path );
+      return ScanRoot( full, recursive, glob );
    }
 
    //--------------------------------------------------------------------------
-   void AddExt( std::string_view ext ) noexcept override {
-      m_exts.insert( ext );
+   bool ReadDirectory( std::string_view path, bool recursive,
+                       const GlobState *glob,
+                       DirCacheEntry &entry ) noexcept override {
+      std::string full = BasePrefix( path );
+      m_base_length = full.size();
+      full.append( path );
+      std::error_code error_code;
+      if( !std::filesystem::is_directory( full, error_code )) return false;
+
+      m_listing = &entry;
+      ScanRoot( full, recursive, glob );
+      m_listing = nullptr;
+      return true;
    }
 
    //--------------------------------------------------------------------------
-   void AddIgnore( std::string_view ignore ) noexcept override {
-      m_ignores.insert( ignore );
+   bool CanReadDirectory() const noexcept override {
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   void ResetExts() noexcept {
+      m_exts.Clear( opt_exts_nocase );
+
+      for( auto &e : opt_exts )
+         m_exts.Add( e );
+   }
+
+   //--------------------------------------------------------------------------
+   void ResetIgnores() noexcept {
+      m_ignores.Clear();
+
+      for( auto &i : opt_ignores )
+         m_ignores.Add( i );
    }
 
    //--------------------------------------------------------------------------
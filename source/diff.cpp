@@ -0,0 +1,102 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#include "diff.h"
+
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+// Walks the two sorted name lists side by side.
+static bool DiffNames( const std::string &dir, std::string_view old_names,
+                       const std::vector<std::string_view> &names ) noexcept {
+   bool changed = false;
+   std::string name;
+   bool has_old = ManifestReader::NextName( old_names, name );
+   size_t i = 0;
+   while( has_old || i < names.size() ) {
+      int order = !has_old ? 1
+                : i == names.size() ? -1
+                : std::string_view( name ).compare( names[i] );
+      if( order < 0 ) {
+         std::cout << "- " << dir << name << "\n";
+         has_old = ManifestReader::NextName( old_names, name );
+         changed = true;
+      } else if( order > 0 ) {
+         std::cout << "+ " << dir << names[i] << "\n";
+         i++;
+         changed = true;
+      } else {
+         has_old = ManifestReader::NextName( old_names, name );
+         i++;
+      }
+   }
+   return changed;
+}
+
+//-----------------------------------------------------------------------------
+int DiffManifest( const std::string &filename, Manifest &current ) noexcept {
+   ManifestReader old;
+   if( !old.Open( filename ) || !old.CheckVersion() ) return 2;
+   current.Finish();
+   const auto &dirs = current.Directories();
+
+   // Both sides are sorted by path, so this is a merge. A subtree only needs
+   //  to be looked at if its hash changed.
+   bool changed = false;
+   ManifestReader::Directory old_dir;
+   std::string old_path;
+   std::vector<std::string_view> names;
+   const std::vector<std::string_view> no_names;
+
+   auto next_old = [&]() {
+      if( !old.Next( old_dir )) return false;
+      ManifestReader::Unescape( old_dir.path, old_path );
+      return true;
+   };
+   bool has_old = next_old();
+   size_t i = 0;
+
+   while( has_old || i < dirs.size() ) {
+      int order = !has_old ? 1
+                : i == dirs.size() ? -1
+                : old_path.compare( dirs[i].path );
+      if( order < 0 ) {
+         // Removed.
+         changed |= DiffNames( old_path, old_dir.names, no_names );
+         has_old = next_old();
+         continue;
+      }
+
+      const Manifest::Directory &dir = dirs[i];
+      if( order > 0 ) {
+         // Added.
+         Manifest::SortedNames( *dir.entry, names );
+         changed |= DiffNames( dir.path, {}, names );
+         i++;
+         continue;
+      }
+
+      if( old_dir.recursive && dir.entry->recursive
+                            && old_dir.subtree == dir.subtree ) {
+         // Nothing under here changed.
+         old.SkipSubtree( old_dir.path );
+         for( i++; i < dirs.size() && dirs[i].path.compare(
+                     0, dir.path.size(), dir.path ) == 0; i++ ) {}
+      } else {
+         if( old_dir.files != dir.entry->files ) {
+            Manifest::SortedNames( *dir.entry, names );
+            changed |= DiffNames( dir.path, old_dir.names, names );
+         }
+         i++;
+      }
+      has_old = next_old();
+   }
+
+   return changed ? 1 : 0;
+}
+
+} /////////////////////////////////////////////////////////////////////////////
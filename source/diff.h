@@ -0,0 +1,19 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "manifest.h"
+
+#include <string>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+// Prints the files that were added to or removed from `current` since the
+//  manifest in `filename` was saved, as "+ path" and "- path". Returns the
+//  exit code: 0 if nothing changed, 1 if something did, or 2 if the manifest
+//  couldn't be read.
+int DiffManifest( const std::string &filename, Manifest &current ) noexcept;
+
+} /////////////////////////////////////////////////////////////////////////////
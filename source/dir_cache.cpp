@@ -0,0 +1,221 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#include "dir_cache.h"
+#include "options.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+// Bump this when the file layout changes.
+static const char CACHE_MAGIC[8] = { 'T','H','D','C','A','C','H','3' };
+
+//-----------------------------------------------------------------------------
+// Native-endian binary writer. The cache never leaves the machine.
+class CacheWriter {
+   std::string &m_out;
+public:
+   CacheWriter( std::string &out ) : m_out( out ) {}
+
+   template< typename T >
+   void Put( T value ) {
+      m_out.append( reinterpret_cast<const char*>( &value ), sizeof value );
+   }
+
+   void PutString( std::string_view str ) {
+      Put<uint32_t>( static_cast<uint32_t>( str.size() ));
+      m_out.append( str );
+   }
+};
+
+//-----------------------------------------------------------------------------
+class CacheReader {
+   const char *m_read;
+   const char *m_end;
+   bool m_ok = true;
+public:
+   CacheReader( std::string_view data )
+      : m_read( data.data() ), m_end( data.data() + data.size() ) {}
+
+   bool Ok() const noexcept { return m_ok; }
+   bool End() const noexcept { return m_read == m_end; }
+
+   template< typename T >
+   T Get() noexcept {
+      T value{};
+      if( !m_ok || m_end - m_read < (ptrdiff_t)sizeof value ) {
+         m_ok = false;
+         return value;
+      }
+      memcpy( &value, m_read, sizeof value );
+      m_read += sizeof value;
+      return value;
+   }
+
+   std::string_view GetString() noexcept {
+      uint32_t size = Get<uint32_t>();
+      if( !m_ok || m_end - m_read < (ptrdiff_t)size ) {
+         m_ok = false;
+         return {};
+      }
+      std::string_view str( m_read, size );
+      m_read += size;
+      return str;
+   }
+};
+
+//-----------------------------------------------------------------------------
+void DirCache::Load( const std::string &filename, Hash fingerprint ) noexcept {
+   m_entries.clear();
+
+   std::ifstream file( filename, std::ios::binary );
+   if( !file ) {
+      if( opt_verbose )
+         std::cout << "No cache file yet at " << filename << ".\n";
+      return;
+   }
+   std::string data( std::istreambuf_iterator<char>( file ), {} );
+
+   CacheReader in( data );
+   char magic[sizeof CACHE_MAGIC];
+   for( auto &c : magic ) c = in.Get<char>();
+   if( !in.Ok() || memcmp( magic, CACHE_MAGIC, sizeof magic ) != 0
+                || in.Get<Hash>() != fingerprint ) {
+      if( opt_verbose )
+         std::cout << "Cache file is from a different version or different"
+                      " options. Starting over.\n";
+      return;
+   }
+
+   uint64_t count = in.Get<uint64_t>();
+   for( uint64_t i = 0; i < count && in.Ok(); i++ ) {
+      std::string path( in.GetString() );
+      auto entry = std::make_shared<DirCacheEntry>();
+      entry->stamp.dev      = in.Get<uint64_t>();
+      entry->stamp.ino      = in.Get<uint64_t>();
+      entry->stamp.mtime_ns = in.Get<int64_t>();
+      entry->stamp.ctime_ns = in.Get<int64_t>();
+      entry->files          = in.Get<Hash>();
+      entry->recursive      = in.Get<uint8_t>() != 0;
+      entry->filter         = in.Get<Hash>();
+      uint32_t subdirs      = in.Get<uint32_t>();
+      for( uint32_t j = 0; j < subdirs && in.Ok(); j++ ) {
+         bool follow = in.Get<uint8_t>() != 0;
+         entry->subdirs.push_back({ std::string( in.GetString() ), follow });
+      }
+      entry->named          = in.Get<uint8_t>() != 0;
+      entry->names          = in.GetString();
+      m_entries.emplace( std::move( path ), std::move( entry ));
+   }
+
+   if( !in.Ok() || !in.End() ) {
+      std::cout << "Cache file is corrupt. Starting over.\n";
+      m_entries.clear();
+      return;
+   }
+
+   if( opt_verbose )
+      std::cout << "Loaded " << m_entries.size() << " cached directories.\n";
+}
+
+//-----------------------------------------------------------------------------
+bool DirCache::Save( const std::string &filename, Hash fingerprint ) noexcept {
+   std::string data;
+   CacheWriter out( data );
+   data.append( CACHE_MAGIC, sizeof CACHE_MAGIC );
+   out.Put<Hash>( fingerprint );
+   out.Put<uint64_t>( m_next.size() );
+   for( auto &[path, entry] : m_next ) {
+      out.PutString( path );
+      out.Put<uint64_t>( entry->stamp.dev );
+      out.Put<uint64_t>( entry->stamp.ino );
+      out.Put<int64_t>( entry->stamp.mtime_ns );
+      out.Put<int64_t>( entry->stamp.ctime_ns );
+      out.Put<Hash>( entry->files );
+      out.Put<uint8_t>( entry->recursive );
+      out.Put<Hash>( entry->filter );
+      out.Put<uint32_t>( static_cast<uint32_t>( entry->subdirs.size() ));
+      for( auto &sub : entry->subdirs ) {
+         out.Put<uint8_t>( sub.follow );
+         out.PutString( sub.name );
+      }
+      out.Put<uint8_t>( entry->named );
+      out.PutString( entry->names );
+   }
+
+   // Write to the side and move it into place, so that a run that's cut
+   //  short can't leave a half-written cache behind.
+   std::string temp = filename + ".tmp";
+   {
+      std::ofstream file( temp, std::ios::binary | std::ios::trunc );
+      file.write( data.data(), data.size() );
+      if( !file ) {
+         std::cout << "Couldn't write cache file " << temp << ".\n";
+         return false;
+      }
+   }
+   std::error_code error_code;
+   std::filesystem::rename( temp, filename, error_code );
+   if( error_code ) {
+      std::cout << "Couldn't write cache file " << filename << ".\n";
+      return false;
+   }
+   return true;
+}
+
+//-----------------------------------------------------------------------------
+DirEntryPtr DirCache::Find( const std::string &path, const DirStamp &stamp,
+                            bool recursive, Hash filter ) noexcept {
+   auto it = m_entries.find( path );
+   if( it == m_entries.end() ) return nullptr;
+   const DirEntryPtr &entry = it->second;
+   if( !(entry->stamp == stamp) ) return nullptr;
+   if( recursive && !entry->recursive ) return nullptr;
+   if( entry->filter != filter ) return nullptr;
+   if( m_need_names && !entry->named ) return nullptr;
+
+   std::lock_guard<std::mutex> lock( m_next_mutex );
+   m_next.emplace( path, entry );
+   return entry;
+}
+
+//-----------------------------------------------------------------------------
+void DirCache::Store( std::string path, DirEntryPtr entry ) noexcept {
+   if( entry->stamp.mtime_ns >= m_racy_limit
+                               || entry->stamp.ctime_ns >= m_racy_limit ) {
+      return;
+   }
+
+   std::lock_guard<std::mutex> lock( m_next_mutex );
+   auto &slot = m_next[std::move( path )];
+   // The same directory can be reached from two roots. Keep the one that
+   //  knows about subdirectories.
+   if( !slot || entry->recursive ) slot = std::move( entry );
+}
+
+//-----------------------------------------------------------------------------
+Hash CacheFingerprint() noexcept {
+   std::string key = "version " + std::to_string( opt_hash_version );
+   key += opt_exts_nocase ? "\nexts nocase" : "\nexts";
+   auto exts = opt_exts;
+   std::sort( exts.begin(), exts.end() );
+   for( auto &e : exts ) key += "\n" + e;
+   key += opt_gitignore ? "\nignores gitignore" : "\nignores";
+   if( opt_skip_marked ) key += " marked";
+   key += "\nsymlinks " + std::to_string( (int)opt_symlinks );
+   auto ignores = opt_ignores;
+   std::sort( ignores.begin(), ignores.end() );
+   for( auto &i : ignores ) key += "\n" + i;
+   key += "\nfilters";
+   for( auto &f : opt_filters ) key += "\n" + f;
+   return XXH64( key.data(), key.size(), HASH_SEED );
+}
+
+} /////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,127 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "hash.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+// Identifies one version of a directory. A directory's entry list can't
+//  change without its mtime and ctime changing too.
+struct DirStamp {
+   uint64_t dev      = 0;
+   uint64_t ino      = 0;
+   int64_t  mtime_ns = 0;
+   int64_t  ctime_ns = 0;
+
+   bool operator==( const DirStamp &other ) const noexcept {
+      return dev == other.dev && ino == other.ino
+          && mtime_ns == other.mtime_ns && ctime_ns == other.ctime_ns;
+   }
+};
+
+//-----------------------------------------------------------------------------
+// What we remember about a directory from the last time we read it.
+struct DirCacheEntry {
+   struct Subdir {
+      std::string name;
+      // True if the entry was a symlink to a directory.
+      bool follow;
+   };
+
+   DirStamp stamp;
+   // XOR of the hashes of the files directly inside.
+   Hash files = 0;
+   // False if this was read by a non-recursive scan, in which case
+   //  `subdirs` isn't filled in.
+   bool recursive = false;
+   // Subdirectories that passed the filters.
+   std::vector<Subdir> subdirs;
+   // FilterKey of the directory's glob state and ignore files. The files
+   //  and subdirectories that pass depend on those.
+   Hash filter = 0;
+   // True if `names` is filled in. Names are only kept when something needs
+   //  them, like a manifest.
+   bool named = false;
+   // Names of the files directly inside, each followed by a NUL.
+   std::string names;
+};
+
+using DirEntryPtr = std::shared_ptr<const DirCacheEntry>;
+
+//-----------------------------------------------------------------------------
+// A persistent cache of directory contents, so that directories that haven't
+//  changed since the last run don't need to be read again. Entries are keyed
+//  by the directory's path as it's hashed, with a trailing slash.
+// Lookups go to the cache that was loaded, and everything that's seen during
+//  the run goes into a new one, which replaces the file when saved. This is
+//  safe to use from several threads.
+class DirCache {
+//-----------------------------------------------------------------------------
+   std::unordered_map<std::string, DirEntryPtr> m_entries;
+   std::unordered_map<std::string, DirEntryPtr> m_next;
+   std::mutex m_next_mutex;
+   // Entries without file names are treated as misses.
+   bool m_need_names = false;
+   //--------------------------------------------------------------------------
+   // Directories modified at or after this time are "racy": they could still
+   //  change within the same timestamp tick after we've read them, so they
+   //  aren't saved, and get read again next time.
+   int64_t m_racy_limit = 0;
+
+public:
+   //--------------------------------------------------------------------------
+   // Filesystem timestamps can be this coarse, in nanoseconds.
+   static constexpr int64_t TIMESTAMP_GRANULARITY = 2'000'000'000;
+
+   //--------------------------------------------------------------------------
+   // Loads the cache file, if there is one. Entries are thrown out if they
+   //  were written with a different `fingerprint`, which covers anything
+   //  that changes what the hashes are.
+   void Load( const std::string &filename, Hash fingerprint ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // Writes out what was seen this run.
+   bool Save( const std::string &filename, Hash fingerprint ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // Should be called right before scanning starts. `now_ns` is the current
+   //  time on the same clock as file timestamps.
+   void StartRun( int64_t now_ns ) noexcept {
+      m_racy_limit = now_ns - TIMESTAMP_GRANULARITY;
+   }
+
+   //--------------------------------------------------------------------------
+   // Makes lookups fail for entries that were saved without file names, so
+   //  that those directories are read again and come back with them.
+   void NeedNames() noexcept {
+      m_need_names = true;
+   }
+
+   //--------------------------------------------------------------------------
+   // Returns the entry for `path` if it's still good for `stamp` and was
+   //  made with the filters `filter`, and carries it over to the new cache.
+   //  Returns null if the directory needs to be read.
+   DirEntryPtr Find( const std::string &path, const DirStamp &stamp,
+                     bool recursive, Hash filter ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // Records a directory that was just read.
+   void Store( std::string path, DirEntryPtr entry ) noexcept;
+};
+
+//-----------------------------------------------------------------------------
+// Covers the options that affect the hashes or the directory lists.
+Hash CacheFingerprint() noexcept;
+
+} /////////////////////////////////////////////////////////////////////////////
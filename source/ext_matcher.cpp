@@ -0,0 +1,195 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#include "ext_matcher.h"
+
+#include <cstring>
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#  define EXT_MATCHER_AVX2
+#elif defined(__SSE2__) || defined(_M_AMD64) || defined(_M_X64) \
+                        || (defined(_M_IX86_FP) && _M_IX86_FP == 2)
+#  include <emmintrin.h>
+#  define EXT_MATCHER_SSE2
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+static inline bool SlotsEqual( const ExtMatcher::Slot &a,
+                               const ExtMatcher::Slot &b ) noexcept {
+   return ((a.half[0] ^ b.half[0]) | (a.half[1] ^ b.half[1])) == 0;
+}
+
+//-----------------------------------------------------------------------------
+static inline uint64_t HashSlot( const ExtMatcher::Slot &slot ) noexcept {
+   uint64_t h = (slot.half[0] ^ (slot.half[1] * 0x9E3779B97F4A7C15ull))
+                * 0xFF51AFD7ED558CCDull;
+   return h ^ (h >> 32);
+}
+
+//-----------------------------------------------------------------------------
+static inline uint64_t Load64( const char *data ) noexcept {
+   uint64_t value;
+   memcpy( &value, data, sizeof value );
+   return value;
+}
+
+//-----------------------------------------------------------------------------
+static inline uint64_t Load32( const char *data ) noexcept {
+   uint32_t value;
+   memcpy( &value, data, sizeof value );
+   return value;
+}
+
+//-----------------------------------------------------------------------------
+// Lowercases the ASCII letters in eight bytes at once. Bytes over 0x7F are
+//  left alone, so UTF-8 sequences pass through.
+static inline uint64_t LowerAscii( uint64_t bytes ) noexcept {
+   const uint64_t ones = 0x0101010101010101ull;
+   uint64_t low7  = bytes & (ones * 0x7F);
+   uint64_t ge_a  = low7 + ones * (0x80 - 'A');
+   uint64_t gt_z  = low7 + ones * (0x80 - 'Z' - 1);
+   uint64_t upper = ge_a & ~gt_z & ~bytes & (ones * 0x80);
+   return bytes | (upper >> 2);
+}
+
+//-----------------------------------------------------------------------------
+bool ExtMatcher::MakeSlot( std::string_view ext,
+                           Slot &slot ) const noexcept {
+   // One byte is left over, so an extension can't run into the padding and
+   //  match a longer one.
+   size_t size = ext.size();
+   if( size >= SLOT_SIZE ) return false;
+
+   // Built in registers from loads that overlap, rather than by copying
+   //  into memory and loading that back, which stalls on the store.
+   const char *data = ext.data();
+   uint64_t lo = 0, hi = 0;
+   if( size >= 8 ) {
+      lo = Load64( data );
+      if( size > 8 ) hi = Load64( data + size - 8 ) >> (8 * (16 - size));
+   } else if( size >= 4 ) {
+      lo = Load32( data ) | (Load32( data + size - 4 ) << (8 * (size - 4)));
+   } else {
+      for( size_t i = 0; i < size; i++ ) {
+         lo |= uint64_t( uint8_t( data[i] )) << (8 * i);
+      }
+   }
+   if( m_nocase ) {
+      lo = LowerAscii( lo );
+      hi = LowerAscii( hi );
+   }
+   slot.half[0] = lo;
+   slot.half[1] = hi;
+   return true;
+}
+
+//-----------------------------------------------------------------------------
+bool ExtMatcher::FindSlot( const Slot &slot ) const noexcept {
+   if( !m_table.empty() ) {
+      size_t mask = m_table.size() - 1;
+      for( size_t i = HashSlot( slot ) & mask; m_table[i];
+                                               i = (i + 1) & mask ) {
+         if( SlotsEqual( m_slots[m_table[i] - 1], slot )) return true;
+      }
+      return false;
+   }
+
+#if defined(EXT_MATCHER_AVX2)
+   // Two slots per compare, and no early out, the same as below.
+   __m256i key = _mm256_broadcastsi128_si256(
+                    _mm_load_si128( reinterpret_cast<const __m128i*>( &slot )));
+   bool found = false;
+   size_t i = 0;
+   for( ; i + 2 <= m_slots.size(); i += 2 ) {
+      __m256i pair = _mm256_loadu_si256(
+                   reinterpret_cast<const __m256i*>( &m_slots[i] ));
+      uint32_t equal = static_cast<uint32_t>(
+                        _mm256_movemask_epi8( _mm256_cmpeq_epi8( key, pair )));
+      found |= (equal & 0xFFFF) == 0xFFFF || (equal >> 16) == 0xFFFF;
+   }
+   if( i < m_slots.size() ) found |= SlotsEqual( m_slots[i], slot );
+   return found;
+#elif defined(EXT_MATCHER_SSE2)
+   // No early out. Which one matches changes from file to file, and that
+   //  branch would mostly be mispredicted.
+   __m128i key = _mm_load_si128( reinterpret_cast<const __m128i*>( &slot ));
+   bool found = false;
+   for( auto &s : m_slots ) {
+      __m128i other = _mm_load_si128( reinterpret_cast<const __m128i*>( &s ));
+      found |= _mm_movemask_epi8( _mm_cmpeq_epi8( key, other )) == 0xFFFF;
+   }
+   return found;
+#else
+   bool found = false;
+   for( auto &s : m_slots ) found |= SlotsEqual( s, slot );
+   return found;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+void ExtMatcher::InsertSlot( size_t index ) noexcept {
+   size_t mask = m_table.size() - 1;
+   size_t i = HashSlot( m_slots[index] ) & mask;
+   while( m_table[i] ) i = (i + 1) & mask;
+   m_table[i] = static_cast<uint32_t>( index + 1 );
+}
+
+//-----------------------------------------------------------------------------
+void ExtMatcher::BuildTable() noexcept {
+   size_t size = 1;
+   while( size < m_slots.size() * 4 ) size *= 2;
+   m_table.assign( size, 0 );
+   for( size_t s = 0; s < m_slots.size(); s++ ) InsertSlot( s );
+}
+
+//-----------------------------------------------------------------------------
+static void ToLower( std::string &str ) noexcept {
+   for( char &c : str ) {
+      if( c >= 'A' && c <= 'Z' ) c += 'a' - 'A';
+   }
+}
+
+//-----------------------------------------------------------------------------
+void ExtMatcher::Clear( bool nocase ) noexcept {
+   m_slots.clear();
+   m_table.clear();
+   m_long.clear();
+   m_nocase = nocase;
+   m_empty  = true;
+}
+
+//-----------------------------------------------------------------------------
+void ExtMatcher::Add( std::string_view ext ) noexcept {
+   m_empty = false;
+   Slot slot;
+   if( MakeSlot( ext, slot )) {
+      if( FindSlot( slot )) return;
+      m_slots.push_back( slot );
+      if( m_slots.size() <= LINEAR_MAX ) return;
+      // Kept at most half full.
+      if( m_slots.size() * 2 > m_table.size() ) {
+         BuildTable();
+      } else {
+         InsertSlot( m_slots.size() - 1 );
+      }
+      return;
+   }
+   std::string str( ext );
+   if( m_nocase ) ToLower( str );
+   m_long.insert( std::move( str ));
+}
+
+//-----------------------------------------------------------------------------
+bool ExtMatcher::Match( std::string_view ext ) const noexcept {
+   Slot slot;
+   if( MakeSlot( ext, slot )) return FindSlot( slot );
+   if( m_long.empty() ) return false;
+   std::string str( ext );
+   if( m_nocase ) ToLower( str );
+   return m_long.count( str ) != 0;
+}
+
+} /////////////////////////////////////////////////////////////////////////////
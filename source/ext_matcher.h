@@ -0,0 +1,81 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+// A set of file extensions, with the same meaning as
+//  std::filesystem::path::extension: ".txt", or "" for no extension. The
+//  strings are UTF-8, and with `nocase`, ASCII letters match either case.
+//
+// Extensions up to 15 bytes are kept as zero-padded 16-byte slots, so one
+//  vector compare checks one of them. A few are just compared one after
+//  another. Past that, they're looked up in a hash table of the slots, which
+//  still only compares once per probe, so thousands of them cost about the
+//  same as a handful. Longer extensions go in a plain set.
+//
+// Read-only while scanning, so it can be shared between threads.
+class ExtMatcher {
+//-----------------------------------------------------------------------------
+public:
+   static constexpr size_t SLOT_SIZE = 16;
+   // The bytes in order, little-endian, like every platform we build for.
+   struct alignas( SLOT_SIZE ) Slot {
+      uint64_t half[2];
+   };
+
+private:
+   // Up to this many slots are compared one by one.
+   static constexpr size_t LINEAR_MAX = 16;
+
+   std::vector<Slot> m_slots;
+   // Open addressing over m_slots, holding index + 1, or 0 when empty. Only
+   //  built when there are more than LINEAR_MAX slots.
+   std::vector<uint32_t> m_table;
+   std::unordered_set<std::string> m_long;
+   bool m_nocase = false;
+   bool m_empty  = true;
+
+   //--------------------------------------------------------------------------
+   // Builds the slot for `ext`, lowercased if we ignore case. Returns false
+   //  if it's too long for one.
+   bool MakeSlot( std::string_view ext, Slot &slot ) const noexcept;
+   bool FindSlot( const Slot &slot ) const noexcept;
+   void InsertSlot( size_t index ) noexcept;
+   void BuildTable() noexcept;
+
+public:
+   //--------------------------------------------------------------------------
+   // Removes all extensions and sets whether case is ignored.
+   void Clear( bool nocase ) noexcept;
+
+   //--------------------------------------------------------------------------
+   void Add( std::string_view ext ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // True if there's nothing to match, which means everything passes.
+   bool Empty() const noexcept { return m_empty; }
+
+   //--------------------------------------------------------------------------
+   // True if `ext` is one of ours.
+   bool Match( std::string_view ext ) const noexcept;
+
+   //--------------------------------------------------------------------------
+   // True if the extension of the file `name` is one of ours. `name` must
+   //  not start with a dot.
+   bool MatchName( std::string_view name ) const noexcept {
+      size_t dot = name.rfind( '.' );
+      if( dot == name.npos ) return Match( {} );
+      return Match( name.substr( dot ));
+   }
+};
+
+} /////////////////////////////////////////////////////////////////////////////
@@ -3,13 +3,21 @@
 #pragma once
 
 // Windows only.
-#ifndef TARGET_WINDOWS
-#  endinput
-#endif
+#ifdef TARGET_WINDOWS
 
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
-#include <xmmintrin.h>
+
+#include "ext_matcher.h"
+#include "ignore_matcher.h"
+#include "markers.h"
+#include "visited_set.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
 
 ///////////////////////////////////////////////////////////////////////////////
 namespace Treehash {
@@ -20,46 +28,19 @@ namespace Treehash {
 //                                     time spent for either is with the IO.
 class FastwinScanner : public Scanner {
 //-----------------------------------------------------------------------------
-   // Maximum number of extension filters. Will error and ignore if the user
-   //  specifies more than this.
-   static constexpr int MAX_EXT_FILTERS    = 64;
-   //--------------------------------------------------------------------------
-   // Maximum number of ignore filters. Will error and ignore if the user tries
-   //  to add more than this.
-   static constexpr int MAX_IGNORE_FILTERS = 64;
-   //--------------------------------------------------------------------------
-   // Max length for an ignored filename. Will error and ignore if there is an
-   //  input larger than this.
-   static constexpr int IGNORE_FIELDSIZE = 64;
-   // The above filters if used in excess will also have a tendency to slow
-   //  down the scanner quite a bit (maybe--most of it would still be IO).
-   //--------------------------------------------------------------------------
    // Maximum length of paths we can search. Will probably blow up if there
    //                                   is a path that somehow exceeds this.
    static constexpr int PATHSIZE = 32768+4096;
    //--------------------------------------------------------------------------
-   // Extension filters are stored as a 128-bit SSE2 values. The mask is used
-   //  to determine the length of the comparison.
-   // Input: foo\hello.world
-   //               ^^^^^^^^ 8 chars are loaded, ending at the end of the input.
-   //               lo.world
-   // Extension for .world will be 00.world, and the mask will be 00FFFFFF
-   //  (with each F being a whopping 16-bit 0xFFFF mask)
-   // Transformation example using extension ".world":
-   // foo\hello.world  # Initial input.
-   // lo.world         # Load last 8 characters.
-   // lo000000         # bitwise xor with extension value (00.world).
-   // 00000000         # Mask by mask value (00FFFFFF - F = 0xFFFF whole wchar)
-   // If the result is 0, then it matches the extension.
-   __m128i m_ext_masks[MAX_EXT_FILTERS];
-   __m128i m_exts[MAX_EXT_FILTERS];
-   //--------------------------------------------------------------------------
-   // The number of extension filters that have been registered.
-   int m_ext_count = 0;
-   //--------------------------------------------------------------------------
-   // Ignores are just null terminated strings.
-   wchar_t m_ignores[IGNORE_FIELDSIZE][MAX_IGNORE_FILTERS] = {0};
-   int m_ignore_count = 0;
+   // Extension filters are matched in UTF-8, the same as the other scanners,
+   //  so only a file's extension is converted, not its whole name.
+   ExtMatcher m_exts;
+   //--------------------------------------------------------------------------
+   // Ignores are matched in UTF-8 too, with slashes for separators. Names are
+   //  only converted when there are any.
+   IgnoreMatcher m_ignores;
+   // A name is at most 255 UTF-16 units, which is at most 765 bytes.
+   char m_utf8_name[1024];
    //--------------------------------------------------------------------------
    // Shared FindXFile data structure.
    WIN32_FIND_DATAW m_find_data;
@@ -73,9 +54,75 @@ class FastwinScanner : public Scanner {
    //  to be as wide as any path ever will be.
    wchar_t m_current_path[PATHSIZE];
    //--------------------------------------------------------------------------
+   // Points past the base path at the start of `m_current_path`. Paths are
+   //  hashed and matched from here.
+   wchar_t *m_hash_start = m_current_path;
+   //--------------------------------------------------------------------------
    // True if this is a recursive search, set by the initial * in the input
    //  string.
    bool m_recursive;
+   //--------------------------------------------------------------------------
+   // A directory on the way down to the one being scanned. A stack of these
+   //  takes the place of recursion, so a deep tree can't run us out of
+   //  stack. Only --max-open of them keep their search handle. The rest are
+   //  closed, and when we get back to them, the search starts over and skips
+   //  the `taken` entries it already went through.
+   struct Frame {
+      HANDLE handle = INVALID_HANDLE_VALUE;
+      // Set when `m_find_data` has the next entry already.
+      bool found = false;
+      size_t taken = 0;
+      // Just after the directory's trailing backslash in `m_current_path`.
+      wchar_t *path_start = nullptr;
+      // How far below the root it is.
+      int level = 0;
+      bool recursive = false;
+      Hash seed = 0;
+      const IgnoreNode *ignore = nullptr;
+      const GlobState *glob = nullptr;
+      // The hash so far, with the subdirectories that are done.
+      Hash hash = 0;
+      // True if it or a directory above it is reached through a symlink or
+      //  a junction.
+      bool linked = false;
+      // Its DirId, once `id_known` is set, which is only needed when
+      //  symlinks are followed.
+      DirId id;
+      bool id_known = false;
+      // With --symlinks once, its final path if it's a link.
+      std::wstring real;
+   };
+   std::vector<Frame> m_frames;
+   // How many frames have a handle, and the first one that might. The ones
+   //  below it don't.
+   int m_open = 0;
+   size_t m_first_open = 0;
+   //--------------------------------------------------------------------------
+   // When symlinks are followed, the DirIds of the directories in the root's
+   //  path, down to the root. They're looked up when they're first needed.
+   std::vector<DirId> m_above;
+   bool m_above_known = false;
+   // With --symlinks once, the directories read under this root, and the
+   //  root's final path.
+   std::unique_ptr<VisitedSet> m_visited;
+   std::wstring m_root_real;
+   //--------------------------------------------------------------------------
+   // With --symlinks once, links to directories wait here, by their full
+   //  path, until the rest of the root is done, and are then gone into one
+   //  at a time from the smallest path, as in the other scanners. That way
+   //  which of two links reads a directory doesn't depend on which is found
+   //  first. The fields are the link's own, and `tops` has the final paths
+   //  of the links on the way down to it.
+   struct DeferredLink {
+      int level;
+      Hash seed;
+      const IgnoreNode *ignore;
+      const GlobState *glob;
+      std::vector<std::wstring> tops;
+   };
+   std::map<std::wstring, DeferredLink> m_deferred;
+   // The `tops` of the one being gone into.
+   std::vector<std::wstring> m_replay_tops;
    
    //--------------------------------------------------------------------------
    // `path_short` and `path_end` are both pointers into the `m_current_path`
@@ -84,45 +131,39 @@ class FastwinScanner : public Scanner {
    //  filename part. `m_current_path` can also be used for the full filename
    //  with any number of trailing directories leading to the basepath.
    // `is_directory` is set if we're checking if a directory is excluded
-   //  (basically skip extension matching).
+   //  (basically skip extension matching). `dir` is the IgnoreNode of the
+   //  directory that it's in.
    inline bool IsExcluded( const wchar_t *path_short, const wchar_t *path_end,
-                                                 bool is_directory ) noexcept {
-      // Directories skip extension matching. Here be dragons.
-      if( !is_directory && m_ext_count > 0 ) {
-         // Load the last 8 characters of the filename string. This can read
-         //                             into data before the filename starts.
-         __m128i ext = _mm_loadu_si128(
-                          reinterpret_cast<const __m128i*>( path_end - 16 ));
-
-         // For each extension, mask the input, and xor it against the pattern.
-         // The xor is basically one of the only ways to compare equality
-         //  between two m128 registers, using the SSE4.x test instruction
-         //  after.
-         for( int i = 0; i < m_ext_count; i++ ) {
-            __m128i masked =_mm_and_si128( ext, m_ext_masks[i] );
-            __m128i neq = _mm_xor_si128( masked, m_exts[i] );
-            if( _mm_test_all_zeros( neq, neq )) {
-               goto found_matched_extension;
-            }
+                           bool is_directory,
+                           const IgnoreNode *dir ) noexcept {
+      // Directories skip extension matching.
+      if( !is_directory && !m_exts.Empty() ) {
+         // Same as std::filesystem::path::extension: from the last dot.
+         const wchar_t *dot = path_end;
+         while( dot > path_short && *--dot != L'.' ) {}
+         if( *dot != L'.' ) dot = path_end;
+         char ext[sizeof m_utf8_name];
+         int length = 0;
+         if( dot != path_end ) {
+            length = WideCharToMultiByte( CP_UTF8, 0
+                        , dot, static_cast<int>(path_end - dot)
+                        , ext, sizeof ext, NULL, NULL );
          }
-         return true;
+         if( !m_exts.Match( std::string_view( ext, length ))) return true;
       }
 
-   found_matched_extension:
-      // Ignores are much simpler and less optimized, but honestly I don't know
-      //  of a good use case for ignores. Just don't clutter up your source
-      //                                          tree with garbage, right?
-      for( int i = 0; i < m_ignore_count; i++ ) {
-         wchar_t *ignorestring = m_ignores[i];
-         // lstrcmpW seems like a nasty thing to use but oh well.
-         if( lstrcmpW( path_short, ignorestring ) == 0 ) {
-            return true;
-         }
-         if( lstrcmpW( m_current_path, ignorestring ) == 0 ) {
-            return true;
-         }
-      }
-      return false;
+      if( m_ignores.Empty() ) return false;
+      return m_ignores.IsIgnored( dir, Utf8Name( path_short, path_end ));
+   }
+
+   //--------------------------------------------------------------------------
+   // Converts a name into `m_utf8_name`.
+   std::string_view Utf8Name( const wchar_t *name,
+                              const wchar_t *name_end ) noexcept {
+      int length = WideCharToMultiByte( CP_UTF8, 0
+                      , name, static_cast<int>(name_end - name)
+                      , m_utf8_name, sizeof m_utf8_name, NULL, NULL );
+      return std::string_view( m_utf8_name, length );
    }
 
    //--------------------------------------------------------------------------
@@ -144,15 +185,169 @@ class FastwinScanner : public Scanner {
    }
 
    //--------------------------------------------------------------------------
-   // We accept a pointer into our shared path memory.
-   Hash ScanInner( wchar_t *path_start ) noexcept {
+   // Seed for a directory's contents under hash versions 2 and 3, like
+   //  DirectorySeed but over the wide names.
+   static Hash WideSeed( Hash seed, const wchar_t *name,
+                         const wchar_t *name_end ) noexcept {
+      return SeededHash( name, (name_end - name) * sizeof(*name), seed );
+   }
+
+   //--------------------------------------------------------------------------
+   // True if the directory that `m_current_path` ends with has one of the
+   //  Markers in it. `path_end` is after its trailing backslash. The marker
+   //  names are written there, which the directory's scan overwrites anyway.
+   bool IsMarked( wchar_t *path_end ) noexcept {
+      auto put = [path_end]( std::string_view name ) {
+         // The names are plain ASCII.
+         wchar_t *end = path_end;
+         for( char c : name ) *end++ = c;
+         *end = 0;
+      };
+      put( Markers::STOP_FILE );
+      if( GetFileAttributesW( m_current_path ) != INVALID_FILE_ATTRIBUTES )
+         return true;
+
+      put( Markers::CACHEDIR_TAG );
+      HANDLE file = CreateFileW( m_current_path, GENERIC_READ
+                       , FILE_SHARE_READ | FILE_SHARE_WRITE, NULL
+                       , OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+      if( file == INVALID_HANDLE_VALUE ) return false;
+      char head[64];
+      DWORD nread = 0;
+      BOOL ok = ReadFile( file, head
+                  , (DWORD)Markers::CACHEDIR_SIGNATURE.size(), &nread, NULL );
+      CloseHandle( file );
+      return ok && std::string_view( head, nread )
+                   == Markers::CACHEDIR_SIGNATURE;
+   }
+
+   //--------------------------------------------------------------------------
+   // True if the entry in `m_find_data` is a symlink or a junction. Other
+   //  reparse points, like cloud files, are ordinary files and directories.
+   bool IsLink() const noexcept {
+      return (m_find_data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+             && (m_find_data.dwReserved0 == IO_REPARSE_TAG_SYMLINK
+                 || m_find_data.dwReserved0 == IO_REPARSE_TAG_MOUNT_POINT);
+   }
+
+   //--------------------------------------------------------------------------
+   // Looks up the DirId of the directory that `m_current_path` has up to
+   //  `end`, following links, and if `real` is given, its final path with a
+   //  trailing backslash. The path is put back the way it was.
+   bool DirectoryInfo( wchar_t *end, DirId &id,
+                       std::wstring *real ) noexcept {
+      wchar_t saved = *end;
+      *end = 0;
+      HANDLE handle = CreateFileW( m_current_path, FILE_READ_ATTRIBUTES
+                  , FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE
+                  , NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL );
+      *end = saved;
+      if( handle == INVALID_HANDLE_VALUE ) return false;
+      BY_HANDLE_FILE_INFORMATION info;
+      bool found = GetFileInformationByHandle( handle, &info ) != 0;
+      if( found ) {
+         id = { info.dwVolumeSerialNumber,
+                (uint64_t)info.nFileIndexHigh << 32 | info.nFileIndexLow };
+      }
+      if( found && real ) {
+         real->resize( PATHSIZE );
+         DWORD length = GetFinalPathNameByHandleW( handle, real->data()
+                           , (DWORD)real->size(), FILE_NAME_NORMALIZED );
+         real->resize( length < real->size() ? length : 0 );
+         if( !real->empty() && real->back() != L'\\' )
+            real->push_back( L'\\' );
+      }
+      CloseHandle( handle );
+      return found;
+   }
+
+   //--------------------------------------------------------------------------
+   // The DirId of the frame at `index`.
+   const DirId &FrameId( size_t index ) noexcept {
+      Frame &frame = m_frames[index];
+      if( !frame.id_known ) {
+         DirectoryInfo( frame.path_start, frame.id, nullptr );
+         frame.id_known = true;
+      }
+      return frame.id;
+   }
+
+   //--------------------------------------------------------------------------
+   // True if the directory `id` is the one of the frame at `index`, or one on
+   //  the way down to it. A link to it would go around forever.
+   bool IsAncestor( size_t index, const DirId &id ) noexcept {
+      if( !m_above_known ) {
+         m_above.clear();
+         for( wchar_t *c = m_current_path; c < m_frames[0].path_start; c++ ) {
+            DirId above;
+            if( *c == L'\\' && DirectoryInfo( c + 1, above, nullptr ))
+               m_above.push_back( above );
+         }
+         m_above_known = true;
+      }
+      // That has the root.
+      if( std::find( m_above.begin(), m_above.end(), id ) != m_above.end() )
+         return true;
+      for( size_t i = 1; i <= index; i++ ) {
+         if( FrameId( i ) == id ) return true;
+      }
+      return false;
+   }
+
+   //--------------------------------------------------------------------------
+   // True if the final path `real` is inside the root, or inside a directory
+   //  that one of the links on the way down to the frame at `parent` goes
+   //  to.
+   bool IsInsideTop( const std::wstring &real, size_t parent ) noexcept {
+      auto inside = [&real]( const std::wstring &top ) {
+         return !top.empty() && real.size() >= top.size()
+                && _wcsnicmp( real.c_str(), top.c_str(), top.size() ) == 0;
+      };
+      if( inside( m_root_real )) return true;
+      for( auto &top : m_replay_tops ) {
+         if( inside( top )) return true;
+      }
+      // While a link is gone into by RunDeferred, it's on the bottom.
+      for( size_t i = 0; i <= parent && i < m_frames.size(); i++ ) {
+         if( inside( m_frames[i].real )) return true;
+      }
+      return false;
+   }
+
+   //--------------------------------------------------------------------------
+   // True if the subdirectory at the end of `m_current_path`, which ends at
+   //  `path_end`, is left out when symlinks are followed, since it's read
+   //  somewhere else. `link` is set if it's a link. The frame at `parent`
+   //  is the directory it's in. `real` is set to its final path if that's
+   //  looked up.
+   bool Revisits( size_t parent, bool link, wchar_t *path_end,
+                  std::wstring &real ) noexcept {
+      bool once = opt_symlinks == Symlinks::ONCE;
+      if( !link && !(once && m_frames[parent].linked) ) return false;
+      DirId id;
+      if( !DirectoryInfo( path_end, id, once && link ? &real : nullptr ))
+         return true;
+      if( link && IsAncestor( parent, id )) return true;
+      if( !once ) return false;
+      // A link into the root, or into a directory that a link on the way
+      //  down goes to, is left for the directory's own path, which is the
+      //  same whichever order things are found in.
+      if( link && IsInsideTop( real, parent )) return true;
+      return !m_visited->Insert( id );
+   }
+
+   //--------------------------------------------------------------------------
+   // Starts the search of the directory of `frame`, or starts it over and
+   //  skips the entries that it already took. `m_find_data` is left with the
+   //  next entry. Returns false if there isn't one.
+   bool OpenFrame( Frame &frame ) noexcept {
       // FindFirstFile accepts a path+pattern string, appending an asterisk
       //  matches all files in a folder. There's likely no feasible alternative
       //  that will let you get away from this pattern-matching overhead.
       // Who knows how they implemented it anyway; maybe it's super efficient.
       // The bottleneck will always be the IO.
-      path_start[0] = '*';
-      path_start[1] = 0;
+      frame.path_start[0] = '*';
+      frame.path_start[1] = 0;
 
       // The last param can accept "FIND_FIRST_EX_LARGE_FETCH" which likely
       //  makes the scanner faster if looking at a directory with a ton of
@@ -166,11 +361,81 @@ class FastwinScanner : public Scanner {
       //  or if the path is bad, etc. As far as I know, there will always be
       //  at least one or two matches, due to the directory references "." and
       //  "..".
-      if( handle == INVALID_HANDLE_VALUE ) return 0;
+      if( handle == INVALID_HANDLE_VALUE ) return false;
 
-      Hash hash = 0;
+      frame.handle = handle;
+      m_open++;
+      MakeRoom();
+      for( size_t i = 0; i < frame.taken; i++ ) {
+         if( !FindNextFile( handle, &m_find_data )) return false;
+      }
+      frame.found = true;
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   void CloseFrame( Frame &frame ) noexcept {
+      FindClose( frame.handle );
+      frame.handle = INVALID_HANDLE_VALUE;
+      m_open--;
+   }
+
+   //--------------------------------------------------------------------------
+   // Closes the searches furthest from the top until no more than
+   //  --max-open are left. The one on top is in use.
+   void MakeRoom() noexcept {
+      for( ; m_open > opt_max_open && m_first_open + 1 < m_frames.size();
+             m_first_open++ ) {
+         Frame &frame = m_frames[m_first_open];
+         if( frame.handle != INVALID_HANDLE_VALUE ) CloseFrame( frame );
+      }
+   }
+
+   //--------------------------------------------------------------------------
+   // Pushes a frame for the directory that ends at `path_start`, just after
+   //  its trailing backslash, in our shared path memory. `seed`, `ignore`
+   //  and `glob` are for that directory, which is `level` below the root.
+   //  Returns false if there's nothing in it to look at, in which case
+   //  nothing is pushed.
+   bool PushFrame( wchar_t *path_start, int level, Hash seed,
+                   const IgnoreNode *ignore,
+                   const GlobState *glob ) noexcept {
+      Frame &frame = m_frames.emplace_back();
+      frame.path_start = path_start;
+      frame.level = level;
+      frame.recursive = m_recursive && WithinMaxDepth( level );
+      frame.seed = seed;
+      frame.ignore = ignore;
+      frame.glob = glob;
+      if( OpenFrame( frame )) return true;
+      if( frame.handle != INVALID_HANDLE_VALUE ) CloseFrame( frame );
+      m_frames.pop_back();
+      return false;
+   }
+
+   //--------------------------------------------------------------------------
+   // Goes on through the directory of the frame at `index`, which is on top.
+   //  Returns true when it pushes a frame for a subdirectory, which is done
+   //  before this goes on, or false when the directory is done.
+   bool ReadFrame( size_t index ) noexcept {
+      // The stack may move when a frame is pushed.
+      Frame *frame = &m_frames[index];
+      if( frame->handle == INVALID_HANDLE_VALUE && !OpenFrame( *frame ))
+         return false;
+      wchar_t *path_start = frame->path_start;
+      const IgnoreNode *ignore = frame->ignore;
+      const GlobState *glob = frame->glob;
       
-      do {
+      for(;;) {
+         // A subdirectory's search uses `m_find_data` too, so the next entry
+         //  is only fetched once we're back.
+         if( frame->found ) {
+            frame->found = false;
+         } else if( !FindNextFile( frame->handle, &m_find_data )) {
+            return false;
+         }
+         frame->taken++;
+
          // We always ignore things starting with dot. Just something we won't
          //  be flexible on.
          if( m_find_data.cFileName[0] == L'.' ) continue;
@@ -181,12 +446,15 @@ class FastwinScanner : public Scanner {
          //  the directory name.
          wchar_t *path_end = MoveString( path_start, m_find_data.cFileName );
          *path_end = 0;
+
+         bool link = IsLink();
+         if( link && opt_symlinks == Symlinks::SKIP ) continue;
          
          // Ignore directories if we aren't in recursive mode.
          if( m_find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY
-                                                             && m_recursive ) {
+                                                       && frame->recursive ) {
             // Directory exclusions are only with the ignore list.
-            if( IsExcluded( path_start, path_end, true )) continue;
+            if( IsExcluded( path_start, path_end, true, ignore )) continue;
             
             // Some recommend that you should buffer the directory list and
             //  recurse through them outside of this loop, but I don't think it
@@ -196,113 +464,181 @@ class FastwinScanner : public Scanner {
             //  absurd amount of files, but that can likely be improved with
             //  the FIND_FIRST_EX_LARGE_FETCH flag above.
 
-            // Add a trailing slash and start next level of recursion.
-            // Don't need to add a null terminator because it's added at the 
-            //  start of ScanInner.
+            // Add a trailing slash and push the next level. Don't need to add
+            //  a null terminator because it's added in OpenFrame.
+            const IgnoreNode *child_ignore = nullptr;
+            const GlobState *child_glob = nullptr;
+            if( ignore || glob ) {
+               std::string_view name = Utf8Name( path_start, path_end );
+               child_ignore = m_ignores.Child( ignore, name );
+               child_glob = GlobMatcher::Child( glob, name );
+               if( GlobMatcher::Skip( child_glob )) continue;
+            }
+            // With --symlinks once, links wait for RunDeferred.
+            bool defer = link && opt_symlinks == Symlinks::ONCE;
+            std::wstring real;
+            if( opt_symlinks != Symlinks::SKIP && !defer
+                        && Revisits( index, link, path_end, real ))
+               continue;
+            Hash child = WideSeed( frame->seed, path_start, path_end );
+            bool linked = link || frame->linked;
+            wchar_t *name_end = path_end;
             *path_end++ = '\\';
-            hash ^= ScanInner( path_end );
+            if( opt_skip_marked && IsMarked( path_end )) continue;
+            if( defer ) {
+               Defer( index, name_end, child, child_ignore, child_glob );
+               continue;
+            }
+            if( PushFrame( path_end, frame->level + 1, child, child_ignore,
+                           child_glob )) {
+               m_frames.back().linked = linked;
+               m_frames.back().real = std::move( real );
+               return true;
+            }
+            frame = &m_frames[index];
          } else {
             // File exclusions check extension and path and filename.
-            if( IsExcluded( path_start, path_end, false )) continue;
+            if( IsExcluded( path_start, path_end, false, ignore )) continue;
+            if( glob && !GlobMatcher::MatchFile( glob,
+                                          Utf8Name( path_start, path_end ))) {
+               continue;
+            }
 
             // The resulting hash is dependent on what scanner is used. In this
             //  case we're hashing wide strings with backslash separators.
-            hash ^= XXH64( m_current_path
-                         , (path_end - m_current_path) * sizeof(*m_current_path)
+            if( opt_hash_version == 1 ) {
+               frame->hash ^= XXH64( m_hash_start
+                         , (path_end - m_hash_start) * sizeof(*m_hash_start)
                          , HASH_SEED );
+            } else {
+               frame->hash ^= WideSeed( frame->seed, path_start, path_end );
+            }
          }
-      } while( FindNextFile( handle, &m_find_data ));
-
-      // I had some basic RAII used for this before, but that was unnecessary
-      //  clutter. I added `noexcept` to above instead.
-      FindClose( handle );
-
-      return hash;
+      }
    }
 
-public:
    //--------------------------------------------------------------------------
-   void AddExt( std::string_view ext ) noexcept override {
-      if( m_ext_count == MAX_EXT_FILTERS ) {
-         if( opt_verbose )
-            std::cout << "Too many extension filters.\n";
-         return;
+   // Puts off the link that `m_current_path` has up to `path_end`, in the
+   //  directory of the frame at `parent`, until RunDeferred. `seed`,
+   //  `ignore` and `glob` are its own.
+   void Defer( size_t parent, const wchar_t *path_end, Hash seed,
+               const IgnoreNode *ignore, const GlobState *glob ) noexcept {
+      std::vector<std::wstring> tops = m_replay_tops;
+      for( size_t i = 0; i <= parent; i++ ) {
+         if( !m_frames[i].real.empty() ) tops.push_back( m_frames[i].real );
       }
-      wchar_t work[8] = {0};
-      int length;
-      if( !(length = MultiByteToWideChar( CP_UTF8, 0
-             , ext.data(), static_cast<int>(ext.size()), m_current_path, 8 ))) {
-         if( opt_verbose ) {
-            std::cout
-               << "Extension string is too large for fastwin scanner: "
-               << ext << "\n";
+      m_deferred.emplace( std::wstring( m_current_path,
+                                        path_end - m_current_path ),
+                          DeferredLink{ m_frames[parent].level + 1, seed,
+                                        ignore, glob, std::move( tops )});
+   }
+
+   //--------------------------------------------------------------------------
+   // Goes into the links that Defer put off, smallest path first, until
+   //  there are none left. The ones found under them are put off too.
+   //  Returns the hash of what they lead to.
+   Hash RunDeferred() noexcept {
+      Hash hash = 0;
+      while( !m_deferred.empty() ) {
+         auto next = m_deferred.extract( m_deferred.begin() );
+         const std::wstring &path = next.key();
+         DeferredLink &link = next.mapped();
+         wchar_t *path_end = std::copy( path.begin(), path.end(),
+                                        m_current_path );
+         *path_end = 0;
+         m_replay_tops = std::move( link.tops );
+
+         // The same checks as Revisits, with the directories on the way
+         //  down to it taken from its path, since they aren't on the stack.
+         DirId id;
+         std::wstring real;
+         bool skip = !DirectoryInfo( path_end, id, &real );
+         for( wchar_t *c = m_current_path; !skip && c < path_end; c++ ) {
+            DirId above;
+            if( *c == L'\\' && DirectoryInfo( c + 1, above, nullptr ))
+               skip = above == id;
          }
-         return;
-      }
-      
-      // Here be dragons...
-      __m128i mask = _mm_set1_epi8( (char)0xFF );
-      __m128i mext = _mm_loadu_si128( reinterpret_cast<const __m128i*>( work ));
-      for( int i = 0; i < (int)ext.size(); i++ ) {
-         mask = _mm_slli_si128( mask, 16 );
-         mext = _mm_slli_si128( mext, 16 );
+         if( skip || IsInsideTop( real, 0 ) || !m_visited->Insert( id ))
+            continue;
+
+         *path_end++ = L'\\';
+         m_first_open = 0;
+         if( !PushFrame( path_end, link.level, link.seed, link.ignore,
+                         link.glob ))
+            continue;
+         m_frames.back().linked = true;
+         m_frames.back().real = std::move( real );
+         hash ^= Run();
       }
-      
-      m_ext_masks[m_ext_count] = mask;
-      m_exts[m_ext_count]      = mext;
-      m_ext_count++;
+      m_replay_tops.clear();
+      return hash;
    }
 
    //--------------------------------------------------------------------------
-   void AddIgnore( std::string_view ignore ) noexcept override {
-      if( m_ignore_count == MAX_IGNORE_FILTERS ) {
-         if( opt_verbose )
-            std::cout << "Too many ignore filters.\n";
-         return;
-      }
-      //m_ignores.insert( ignore );
-      wchar_t work[8] = {0};
-      int length;
-      if( !(length = MultiByteToWideChar( CP_UTF8, 0
-             , ignore.data(), static_cast<int>(ignore.size())
-             , m_ignores[m_ignore_count], IGNORE_FIELDSIZE-1 ))) {
-         if( opt_verbose ) {
-            std::cout
-               << "Ignore string is too large for fastwin scanner: "
-               << ignore << "\n";
-         }
-         return;
+   // Works through the stack, which has the root on the bottom, until it's
+   //  empty. Returns the root's hash.
+   Hash Run() noexcept {
+      for(;;) {
+         if( ReadFrame( m_frames.size() - 1 )) continue;
+
+         // It's done. I had some basic RAII used for the handles before, but
+         //  that was unnecessary clutter.
+         Frame &done = m_frames.back();
+         if( done.handle != INVALID_HANDLE_VALUE ) CloseFrame( done );
+         Hash hash = done.hash;
+         m_frames.pop_back();
+         if( m_frames.empty() ) return hash;
+         m_frames.back().hash ^= hash;
+         // Only the new top can be open past the ones that are closed.
+         m_first_open = std::min( m_first_open, m_frames.size() - 1 );
       }
-      m_ignores[m_ignore_count][length] = 0;
-      for( wchar_t *scan = m_ignores[m_ignore_count]; *scan; scan++ ) {
-         if( *scan == L'/' ) *scan = L'\\';
+   }
+
+   //--------------------------------------------------------------------------
+   void AddIgnore( std::string_view ignore ) noexcept {
+      // Either separator works in the ignore list.
+      std::string str( ignore );
+      for( char &c : str ) {
+         if( c == '\\' ) c = '/';
       }
-      m_ignore_count++;
+      m_ignores.Add( str );
    }
 
+public:
    //--------------------------------------------------------------------------
    FastwinScanner() {
-      for( auto &e : opt_exts ) {
-         AddExt( e );
-      }
-      for( auto &i : opt_ignores ) {
-         AddIgnore( i );
-      }
+      ResetExts();
+      ResetIgnores();
    }
 
    //--------------------------------------------------------------------------
-   Hash Scan( std::string_view path, bool recursive ) noexcept override {
+   Hash Scan( std::string_view path, bool recursive,
+              const GlobState *glob ) noexcept override {
+      if( GlobMatcher::Skip( glob )) return 0;
+
       // TODO: There is a special token that you can prefix to paths,
       //  i.e. "\?\" or something, that allows the length of paths to be
       //  extended. There are also other ways to opt-in. Needs experimentation
       //  and research.
+
+      // We open the full path, but the base path isn't part of the hash.
+      std::string base = BasePrefix( path );
+      int base_length = 0;
+      if( !base.empty() ) {
+         base_length = MultiByteToWideChar( CP_UTF8, 0
+                     , base.data(), static_cast<int>(base.size())
+                     , m_current_path, PATHSIZE );
+      }
+      m_hash_start = m_current_path + base_length;
+
       int length;
       if( !(length = MultiByteToWideChar( CP_UTF8, 0
                      , path.data(), static_cast<int>(path.size())
-                     , m_current_path, PATHSIZE ))) {
+                     , m_hash_start, PATHSIZE - base_length ))) {
          std::cout << "Invalid path given.\n";
          return 0;
       }
+      length += base_length;
 
       m_recursive = recursive;
       wchar_t *path_start = m_current_path + length;
@@ -311,18 +647,50 @@ public:
       }
       *path_start = 0;
 
-      return ScanInner( path_start );
+      Hash seed = HASH_SEED;
+      const wchar_t *piece = m_hash_start;
+      for( const wchar_t *c = m_hash_start; c < path_start; c++ ) {
+         if( *c != L'\\' ) continue;
+         seed = WideSeed( seed, piece, c );
+         piece = c + 1;
+      }
+
+      std::string dir( path );
+      for( char &c : dir ) {
+         if( c == '\\' ) c = '/';
+      }
+      if( dir.back() != '/' ) dir.push_back( '/' );
+
+      m_first_open = 0;
+      m_above_known = false;
+      if( !PushFrame( path_start, 0, seed, m_ignores.Find( dir ), glob ))
+         return 0;
+      if( opt_symlinks == Symlinks::ONCE ) {
+         DirId id;
+         m_visited = std::make_unique<VisitedSet>();
+         if( DirectoryInfo( path_start, id, &m_root_real ))
+            m_visited->Insert( id );
+      }
+      Hash hash = Run();
+      if( !m_deferred.empty() ) hash ^= RunDeferred();
+      return hash;
    }
    
    //--------------------------------------------------------------------------
-   void ResetExts() noexcept override {
-      m_ext_count = static_cast<int>(opt_exts.size());
+   void ResetExts() noexcept {
+      m_exts.Clear( opt_exts_nocase );
+      for( auto &e : opt_exts )
+         m_exts.Add( e );
    }
 
    //--------------------------------------------------------------------------
-   void ResetIgnores() noexcept override {
-      m_ignore_count = static_cast<int>(opt_ignores.size());
+   void ResetIgnores() noexcept {
+      m_ignores.Clear();
+      for( auto &i : opt_ignores )
+         AddIgnore( i );
    }
 };
 
-} /////////////////////////////////////////////////////////////////////////////
\ No newline at end of file
+} /////////////////////////////////////////////////////////////////////////////
+
+#endif // TARGET_WINDOWS
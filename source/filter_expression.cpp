@@ -0,0 +1,343 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#include "filter_expression.h"
+#include "glob_matcher.h"
+
+#include <cctype>
+#include <chrono>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+// Recursive descent over the tokens of one expression, adding nodes to the
+//  FilterExpression as it goes:
+//
+//   or   := and { ("or" | "||") and }
+//   and  := not { ["and" | "&&"] not }
+//   not  := ("not" | "!") not | "(" or ")" | predicate
+class FilterParser {
+//-----------------------------------------------------------------------------
+   using Node = FilterExpression::Node;
+
+   FilterExpression &m_expr;
+   std::vector<std::string> m_tokens;
+   size_t m_next = 0;
+   std::string &m_error;
+
+   //--------------------------------------------------------------------------
+   // Words are split off at spaces and operators, unless they're quoted.
+   void Tokenize( std::string_view text ) noexcept {
+      size_t i = 0;
+      while( i < text.size() ) {
+         char c = text[i];
+         if( isspace( (unsigned char)c )) {
+            i++;
+         } else if( c == '"' || c == '\'' ) {
+            size_t end = text.find( c, i + 1 );
+            if( end == text.npos ) end = text.size();
+            m_tokens.emplace_back( text.substr( i + 1, end - i - 1 ));
+            i = end + 1;
+         } else if( c == '(' || c == ')' ) {
+            m_tokens.emplace_back( 1, c );
+            i++;
+         } else if( text.compare( i, 2, "&&" ) == 0
+                    || text.compare( i, 2, "||" ) == 0
+                    || text.compare( i, 2, "<=" ) == 0
+                    || text.compare( i, 2, ">=" ) == 0
+                    || text.compare( i, 2, "!=" ) == 0
+                    || text.compare( i, 2, "==" ) == 0 ) {
+            m_tokens.emplace_back( text.substr( i, 2 ));
+            i += 2;
+         } else if( c == '<' || c == '>' || c == '=' || c == '!' ) {
+            m_tokens.emplace_back( 1, c );
+            i++;
+         } else {
+            // A "!" inside of a word is part of it, like in "[!a]*".
+            size_t end = i;
+            while( end < text.size() && !isspace( (unsigned char)text[end] )
+                   && std::string_view( "()<>=&|" ).find( text[end] )
+                      == std::string_view::npos ) {
+               end++;
+            }
+            m_tokens.emplace_back( text.substr( i, end - i ));
+            i = end;
+         }
+      }
+   }
+
+   //--------------------------------------------------------------------------
+   bool AtEnd() const noexcept { return m_next == m_tokens.size(); }
+
+   //--------------------------------------------------------------------------
+   bool Peek( std::string_view token ) const noexcept {
+      return !AtEnd() && m_tokens[m_next] == token;
+   }
+
+   //--------------------------------------------------------------------------
+   bool Take( std::string_view token ) noexcept {
+      if( !Peek( token )) return false;
+      m_next++;
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   bool Fail( std::string message ) noexcept {
+      if( m_error.empty() ) m_error = std::move( message );
+      return false;
+   }
+
+   //--------------------------------------------------------------------------
+   uint32_t AddNode( Node node ) noexcept {
+      m_expr.m_nodes.push_back( std::move( node ));
+      return (uint32_t)m_expr.m_nodes.size() - 1;
+   }
+
+   //--------------------------------------------------------------------------
+   uint32_t Combine( Node::Kind kind, uint32_t left,
+                     uint32_t right ) noexcept {
+      Node node{};
+      node.kind = kind;
+      node.left = left;
+      node.right = right;
+      return AddNode( std::move( node ));
+   }
+
+   //--------------------------------------------------------------------------
+   // A number with an optional unit from `units`, which are `scales` apart.
+   bool Number( std::string_view word, std::string_view units,
+                const int64_t *scales, int64_t &value ) noexcept {
+      size_t digits = 0;
+      value = 0;
+      while( digits < word.size() && isdigit( (unsigned char)word[digits] )) {
+         value = value * 10 + (word[digits++] - '0');
+      }
+      if( digits == 0 || word.size() > digits + 1 ) return false;
+      if( digits == word.size() ) return true;
+      size_t unit = units.find( word[digits] );
+      if( unit == units.npos ) return false;
+      value *= scales[unit];
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   bool Compare( Node &node ) noexcept {
+      static const char *const OPS[] = { "<", "<=", ">", ">=", "=", "!=" };
+      for( int i = 0; i < 6; i++ ) {
+         if( Take( OPS[i] )) {
+            node.compare = (Node::Compare)i;
+            return true;
+         }
+      }
+      if( Take( "==" )) {
+         node.compare = Node::EQ;
+         return true;
+      }
+      return Fail( "expected a comparison after " + m_tokens[m_next - 1] );
+   }
+
+   //--------------------------------------------------------------------------
+   bool Predicate( uint32_t &out ) noexcept {
+      static const int64_t SIZES[] = {
+         1, 1, 1LL << 10, 1LL << 10, 1LL << 20, 1LL << 20,
+         1LL << 30, 1LL << 30, 1LL << 40, 1LL << 40
+      };
+      static const int64_t TIMES[] = {
+         1'000'000'000LL, 60'000'000'000LL, 3'600'000'000'000LL,
+         86'400'000'000'000LL, 604'800'000'000'000LL
+      };
+      if( AtEnd() ) return Fail( "unexpected end" );
+      const std::string &word = m_tokens[m_next++];
+      Node node{};
+      node.kind = Node::NAME;
+      auto argument = [&]() -> const std::string* {
+         if( AtEnd() ) return nullptr;
+         return &m_tokens[m_next++];
+      };
+
+      if( word == "name" ) {
+         const std::string *glob = argument();
+         if( !glob ) return Fail( "expected a glob after name" );
+         node.text = *glob;
+      } else if( word == "type" ) {
+         const std::string *type = argument();
+         if( !type || (*type != "f" && *type != "l") )
+            return Fail( "expected f or l after type" );
+         node.kind = *type == "f" ? Node::FILE : Node::LINK;
+      } else if( word == "size" ) {
+         node.kind = Node::SIZE;
+         if( !Compare( node )) return false;
+         const std::string *size = argument();
+         if( !size || !Number( *size, "bBkKmMgGtT", SIZES, node.value ))
+            return Fail( "expected a size like 50M" );
+         m_expr.m_needs |= FilterExpression::NEED_SIZE;
+      } else if( word == "age" ) {
+         node.kind = Node::AGE;
+         if( !Compare( node )) return false;
+         const std::string *age = argument();
+         if( !age || !Number( *age, "smhdw", TIMES, node.value ))
+            return Fail( "expected an age like 90d" );
+         // Without a unit, it's seconds.
+         if( age->find_first_not_of( "0123456789" ) == age->npos )
+            node.value *= TIMES[0];
+         m_expr.m_needs |= FilterExpression::NEED_MTIME;
+      } else if( word == "perm" ) {
+         node.kind = Node::PERM;
+         const std::string *perm = argument();
+         if( !perm || perm->empty()
+                   || perm->find_first_not_of( "01234567" ) != perm->npos )
+            return Fail( "expected octal bits like 111 after perm" );
+         node.value = std::stoll( *perm, nullptr, 8 ) & 07777;
+         m_expr.m_needs |= FilterExpression::NEED_MODE;
+      } else {
+         return Fail( "unknown predicate " + word );
+      }
+      out = AddNode( std::move( node ));
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   bool Not( uint32_t &out ) noexcept {
+      if( Take( "not" ) || Take( "!" )) {
+         uint32_t operand;
+         if( !Not( operand )) return false;
+         out = Combine( Node::NOT, operand, 0 );
+         return true;
+      }
+      if( Take( "(" )) {
+         if( !Or( out )) return false;
+         if( !Take( ")" )) return Fail( "expected )" );
+         return true;
+      }
+      return Predicate( out );
+   }
+
+   //--------------------------------------------------------------------------
+   bool And( uint32_t &out ) noexcept {
+      if( !Not( out )) return false;
+      for(;;) {
+         bool explicit_and = Take( "and" ) || Take( "&&" );
+         if( !explicit_and && (AtEnd() || Peek( ")" ) || Peek( "or" )
+                                         || Peek( "||" ))) {
+            return true;
+         }
+         uint32_t right;
+         if( !Not( right )) return false;
+         out = Combine( Node::AND, out, right );
+      }
+   }
+
+   //--------------------------------------------------------------------------
+   bool Or( uint32_t &out ) noexcept {
+      if( !And( out )) return false;
+      while( Take( "or" ) || Take( "||" )) {
+         uint32_t right;
+         if( !And( right )) return false;
+         out = Combine( Node::OR, out, right );
+      }
+      return true;
+   }
+
+public:
+   //--------------------------------------------------------------------------
+   FilterParser( FilterExpression &expr, std::string_view text,
+                 std::string &error ) noexcept
+         : m_expr( expr ), m_error( error ) {
+      Tokenize( text );
+   }
+
+   //--------------------------------------------------------------------------
+   bool Parse( uint32_t &out ) noexcept {
+      if( !Or( out )) return false;
+      if( !AtEnd() ) return Fail( "unexpected " + m_tokens[m_next] );
+      return true;
+   }
+};
+
+//-----------------------------------------------------------------------------
+FilterExpression::FilterExpression() noexcept {
+   m_now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 std::chrono::system_clock::now().time_since_epoch() ).count();
+}
+
+//-----------------------------------------------------------------------------
+bool FilterExpression::Add( std::string_view expression,
+                            std::string &error ) noexcept {
+   error.clear();
+   size_t nodes = m_nodes.size();
+   unsigned needs = m_needs;
+   uint32_t added;
+   FilterParser parser( *this, expression, error );
+   if( !parser.Parse( added )) {
+      m_nodes.resize( nodes );
+      m_needs = needs;
+      return false;
+   }
+
+   if( m_root < 0 ) {
+      m_root = added;
+   } else {
+      Node node{};
+      node.kind = Node::AND;
+      node.left = (uint32_t)m_root;
+      node.right = added;
+      m_nodes.push_back( std::move( node ));
+      m_root = (int64_t)m_nodes.size() - 1;
+   }
+   return true;
+}
+
+//-----------------------------------------------------------------------------
+int FilterExpression::Eval( uint32_t index, std::string_view name, bool link,
+                            const FileMeta *meta ) const noexcept {
+   const Node &node = m_nodes[index];
+   auto compare = [&node]( int64_t value ) {
+      switch( node.compare ) {
+      case Node::LT: return value <  node.value ? YES : NO;
+      case Node::LE: return value <= node.value ? YES : NO;
+      case Node::GT: return value >  node.value ? YES : NO;
+      case Node::GE: return value >= node.value ? YES : NO;
+      case Node::EQ: return value == node.value ? YES : NO;
+      default:       return value != node.value ? YES : NO;
+      }
+   };
+
+   // Unknowns only matter if the other side doesn't settle it.
+   switch( node.kind ) {
+   case Node::AND: {
+      int left = Eval( node.left, name, link, meta );
+      if( left == NO ) return NO;
+      int right = Eval( node.right, name, link, meta );
+      if( right == NO ) return NO;
+      return left == YES && right == YES ? YES : UNKNOWN;
+   }
+   case Node::OR: {
+      int left = Eval( node.left, name, link, meta );
+      if( left == YES ) return YES;
+      int right = Eval( node.right, name, link, meta );
+      if( right == YES ) return YES;
+      return left == NO && right == NO ? NO : UNKNOWN;
+   }
+   case Node::NOT: {
+      int operand = Eval( node.left, name, link, meta );
+      return operand == UNKNOWN ? UNKNOWN : !operand;
+   }
+   case Node::NAME:
+      return GlobMatcher::MatchName( node.text, name ) ? YES : NO;
+   case Node::FILE:
+      return link ? NO : YES;
+   case Node::LINK:
+      return link ? YES : NO;
+   case Node::SIZE:
+      if( !meta ) return UNKNOWN;
+      return compare( (int64_t)meta->size );
+   case Node::AGE:
+      if( !meta ) return UNKNOWN;
+      return compare( m_now_ns - meta->mtime_ns );
+   default:
+      if( !meta ) return UNKNOWN;
+      return (meta->mode & node.value) == node.value ? YES : NO;
+   }
+}
+
+} /////////////////////////////////////////////////////////////////////////////
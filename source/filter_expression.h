@@ -0,0 +1,121 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+// What a filter expression can ask about a file besides its name. Only the
+//  fields that the expression needs are filled in.
+struct FileMeta {
+   uint64_t size = 0;
+   // Nanoseconds since the Unix epoch.
+   int64_t mtime_ns = 0;
+   // Permission bits, like 0755.
+   uint32_t mode = 0;
+};
+
+//-----------------------------------------------------------------------------
+// A filter on files, compiled once from expressions like
+//  "size < 50M and not name *.log". A file only counts if it matches.
+//
+//   name <glob>        The name matches, like a piece of a glob input.
+//   type f | l         A regular file, or a symlink to one.
+//   size <op> <n>      Size in bytes, or with k, M, G or T on the end.
+//   age <op> <n>       Time since the file was modified, in seconds, or
+//                       with s, m, h, d or w on the end.
+//   perm <octal>       All of those permission bits are set.
+//
+// <op> is <, <=, >, >=, = or !=. Predicates are combined with "and" (or
+//  just one after the other), "or", "not" and parentheses, and && || ! work
+//  too. Each one given is and-ed with the rest.
+//
+// Only the name and type come with a directory listing, so a file is first
+//  checked with those, taking everything else as unknown. The scanner only
+//  stats the file if that doesn't settle it, so "name *.iso and size > 1G"
+//  stats just the .iso files, and name-only filters never stat anything.
+//
+// Read-only while scanning, so it can be shared between threads.
+class FilterExpression {
+public:
+   // Which metadata the expression needs, for Needs.
+   enum : unsigned {
+      NEED_SIZE  = 1,
+      NEED_MTIME = 2,
+      NEED_MODE  = 4
+   };
+
+private:
+   //--------------------------------------------------------------------------
+   struct Node {
+      enum Kind : uint8_t {
+         AND, OR, NOT,
+         NAME, FILE, LINK,
+         SIZE, AGE, PERM
+      };
+      enum Compare : uint8_t { LT, LE, GT, GE, EQ, NE };
+      Kind kind;
+      Compare compare = EQ;
+      // Operands of AND, OR and NOT.
+      uint32_t left = 0, right = 0;
+      int64_t value = 0;
+      // The glob for NAME.
+      std::string text;
+   };
+
+   // Results of Eval.
+   static constexpr int NO = 0, YES = 1, UNKNOWN = -1;
+
+   std::vector<Node> m_nodes;
+   int64_t m_root = -1;
+   unsigned m_needs = 0;
+   // When the run started, for AGE.
+   int64_t m_now_ns;
+
+   //--------------------------------------------------------------------------
+   // Without `meta`, anything that needs it is UNKNOWN.
+   int Eval( uint32_t index, std::string_view name, bool link,
+             const FileMeta *meta ) const noexcept;
+
+   friend class FilterParser;
+
+public:
+   //--------------------------------------------------------------------------
+   // Compiles `expression` and ands it with what's already here. Returns
+   //  false with `error` set if it isn't valid.
+   bool Add( std::string_view expression, std::string &error ) noexcept;
+
+   //--------------------------------------------------------------------------
+   bool Empty() const noexcept { return m_root < 0; }
+
+   //--------------------------------------------------------------------------
+   // NEED_* flags for the metadata that some part of the expression uses.
+   unsigned Needs() const noexcept { return m_needs; }
+
+   //--------------------------------------------------------------------------
+   // Checks a file with what's known from its directory listing. `link` is
+   //  true if it's a symlink. Returns 1 or 0 if that's enough to tell, or -1
+   //  if the file's metadata is needed, in which case call Match.
+   int MatchName( std::string_view name, bool link ) const noexcept {
+      if( Empty() ) return YES;
+      return Eval( (uint32_t)m_root, name, link, nullptr );
+   }
+
+   //--------------------------------------------------------------------------
+   bool Match( std::string_view name, bool link,
+               const FileMeta &meta ) const noexcept {
+      if( Empty() ) return true;
+      return Eval( (uint32_t)m_root, name, link, &meta ) == YES;
+   }
+
+   //--------------------------------------------------------------------------
+   FilterExpression() noexcept;
+};
+
+} /////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,281 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#include "gitignore.h"
+#include "glob_matcher.h"
+#include "options.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+// Turns the backslash escapes of an ignore file into something that the glob
+//  matcher takes literally.
+static std::string Unescape( std::string_view piece ) noexcept {
+   std::string out;
+   for( size_t i = 0; i < piece.size(); i++ ) {
+      char c = piece[i];
+      if( c != '\\' || i + 1 == piece.size() ) {
+         out += c;
+         continue;
+      }
+      c = piece[++i];
+      if( c == '*' || c == '?' || c == '[' ) {
+         out += '[';
+         out += c;
+         out += ']';
+      } else {
+         out += c;
+      }
+   }
+   return out;
+}
+
+//-----------------------------------------------------------------------------
+static bool IsWild( std::string_view piece ) noexcept {
+   return piece.find_first_of( "*?[" ) != piece.npos;
+}
+
+//-----------------------------------------------------------------------------
+// Matches `path` against the pieces of an anchored rule from `first` on. A
+//  "**" piece matches any number of directories, but one on the end has to
+//  match something, so "a/**" is what's inside of "a" and not "a" itself.
+static bool MatchPieces( const std::vector<std::string> &pieces, size_t first,
+                         std::string_view path ) noexcept {
+   for( size_t i = first; i < pieces.size(); i++ ) {
+      if( pieces[i] == "**" ) {
+         if( i + 1 == pieces.size() ) return !path.empty();
+         for(;;) {
+            if( MatchPieces( pieces, i + 1, path )) return true;
+            size_t slash = path.find( '/' );
+            if( slash == path.npos ) return false;
+            path.remove_prefix( slash + 1 );
+         }
+      }
+      if( path.empty() ) return false;
+      size_t slash = path.find( '/' );
+      if( !GlobMatcher::MatchName( pieces[i], path.substr( 0, slash ))) {
+         return false;
+      }
+      path.remove_prefix( slash == path.npos ? path.size() : slash + 1 );
+   }
+   return path.empty();
+}
+
+//-----------------------------------------------------------------------------
+IgnoreRules::IgnoreRules( std::string_view text ) noexcept {
+   m_hash = XXH64( text.data(), text.size(), HASH_SEED );
+   while( !text.empty() ) {
+      size_t newline = text.find( '\n' );
+      std::string_view line = text.substr( 0, newline );
+      text.remove_prefix( newline == text.npos ? text.size() : newline + 1 );
+
+      if( !line.empty() && line.back() == '\r' ) line.remove_suffix( 1 );
+      if( line.empty() || line[0] == '#' ) continue;
+      // Trailing spaces don't count unless they're escaped.
+      while( !line.empty() && line.back() == ' '
+             && !(line.size() > 1 && line[line.size() - 2] == '\\') ) {
+         line.remove_suffix( 1 );
+      }
+      if( line.empty() ) continue;
+
+      Rule rule{};
+      if( line[0] == '!' ) {
+         rule.negate = true;
+         line.remove_prefix( 1 );
+      }
+      if( !line.empty() && line.back() == '/' ) {
+         rule.dir_only = true;
+         line.remove_suffix( 1 );
+      }
+      rule.anchored = line.find( '/' ) != line.npos;
+      while( !line.empty() ) {
+         size_t slash = line.find( '/' );
+         std::string_view piece = line.substr( 0, slash );
+         if( !piece.empty() ) rule.pieces.push_back( Unescape( piece ));
+         line.remove_prefix( slash == line.npos ? line.size() : slash + 1 );
+      }
+      if( rule.pieces.empty() ) continue;
+      // "**/name" is the same as "name".
+      if( rule.anchored && rule.pieces.size() == 2
+                        && rule.pieces[0] == "**" && rule.pieces[1] != "**" ) {
+         rule.pieces.erase( rule.pieces.begin() );
+         rule.anchored = false;
+      }
+
+      uint32_t index = (uint32_t)m_rules.size();
+      const Rule &added = m_rules.emplace_back( std::move( rule ));
+      if( !added.anchored && !IsWild( added.pieces[0] )) {
+         m_names[added.pieces[0]].push_back( index );
+      } else {
+         m_others.push_back( index );
+         if( added.anchored ) m_anchored = true;
+      }
+   }
+}
+
+//-----------------------------------------------------------------------------
+int IgnoreRules::Match( std::string_view path, std::string_view name,
+                        bool is_directory ) const noexcept {
+   long best = -1;
+   auto it = m_names.find( name );
+   if( it != m_names.end() ) {
+      for( size_t i = it->second.size(); i-- > 0; ) {
+         uint32_t index = it->second[i];
+         if( !m_rules[index].dir_only || is_directory ) {
+            best = index;
+            break;
+         }
+      }
+   }
+   // Only lines after the best one so far can change the answer.
+   for( size_t i = m_others.size(); i-- > 0 && (long)m_others[i] > best; ) {
+      const Rule &rule = m_rules[m_others[i]];
+      if( rule.dir_only && !is_directory ) continue;
+      bool matched = rule.anchored
+                     ? MatchPieces( rule.pieces, 0, path )
+                     : GlobMatcher::MatchName( rule.pieces[0], name );
+      if( matched ) {
+         best = m_others[i];
+         break;
+      }
+   }
+   if( best < 0 ) return -1;
+   return m_rules[best].negate ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------
+IgnoreRulesPtr GitIgnore::Parse( const std::string &text ) noexcept {
+   auto rules = std::make_shared<const IgnoreRules>( text );
+   if( rules->Empty() ) return nullptr;
+   return rules;
+}
+
+//-----------------------------------------------------------------------------
+IgnoreRulesPtr GitIgnore::LoadFile( const std::string &path ) noexcept {
+   auto it = m_files.find( path );
+   if( it != m_files.end() ) return it->second;
+
+   IgnoreRulesPtr rules;
+   std::ifstream file( path, std::ios::binary );
+   if( file ) {
+      std::string text( std::istreambuf_iterator<char>( file ), {} );
+      rules = Parse( text );
+   }
+   m_files.emplace( path, rules );
+   return rules;
+}
+
+//-----------------------------------------------------------------------------
+bool GitIgnore::IsRepository( const std::string &dir ) noexcept {
+   auto it = m_repos.find( dir );
+   if( it != m_repos.end() ) return it->second;
+   std::error_code error_code;
+   bool repo = std::filesystem::exists(
+                  std::filesystem::path( dir ) / ".git", error_code );
+   m_repos.emplace( dir, repo );
+   return repo;
+}
+
+//-----------------------------------------------------------------------------
+GitFramePtr GitIgnore::MakeFrame( const GitFramePtr &parent, size_t base,
+                                  std::string lead,
+                                  std::vector<IgnoreRulesPtr> rules ) noexcept {
+   auto frame = std::make_shared<GitIgnoreFrame>();
+   frame->parent = parent;
+   frame->base = base;
+   frame->lead = std::move( lead );
+   frame->rules = std::move( rules );
+
+   // Where the files are matters as much as what's in them.
+   std::string key = std::to_string( base ) + "\n" + frame->lead;
+   for( auto &file : frame->rules ) {
+      frame->anchored = frame->anchored || file->Anchored();
+      key += "\n" + HashToHex( file->GetHash() );
+   }
+   frame->key = XXH64( key.data(), key.size(), Key( parent.get() ));
+   return frame;
+}
+
+//-----------------------------------------------------------------------------
+GitFramePtr GitIgnore::Root( std::string_view dir, size_t base ) noexcept {
+   namespace fs = std::filesystem;
+   auto trim = []( std::string path ) {
+      while( path.size() > 1 && path.back() == '/' ) path.pop_back();
+      return path;
+   };
+   std::string path = trim( fs::path( dir ).lexically_normal()
+                                           .generic_string() );
+   std::string top = trim( fs::path( opt_basepath ).lexically_normal()
+                                                   .generic_string() );
+
+   std::lock_guard<std::mutex> lock( m_mutex );
+
+   // Ignore files apply from the top of the repository. Outside of one, they
+   //  apply from the base directory, so that a directory gets the same
+   //  rules whichever root it's reached from. If the root isn't under
+   //  either, only its own files count.
+   std::vector<std::string> dirs{ path };
+   bool repo = false;
+   size_t top_index = 0;
+   for(;;) {
+      const std::string &last = dirs.back();
+      if( IsRepository( last )) {
+         repo = true;
+         break;
+      }
+      if( last == top ) top_index = dirs.size() - 1;
+      size_t slash = last.rfind( '/' );
+      if( slash == last.npos || last.size() == 1 ) break;
+      dirs.push_back( last.substr( 0, slash == 0 ? 1 : slash ));
+   }
+   if( !repo ) dirs.resize( top_index + 1 );
+
+   GitFramePtr frame;
+   for( size_t i = dirs.size(); i-- > 0; ) {
+      std::string prefix = dirs[i];
+      if( prefix.back() != '/' ) prefix.push_back( '/' );
+
+      std::vector<IgnoreRulesPtr> rules;
+      if( repo && i == dirs.size() - 1 ) {
+         if( auto exclude = LoadFile( prefix + ".git/info/exclude" ))
+            rules.push_back( exclude );
+      }
+      for( const char *name : FILE_NAMES ) {
+         if( auto file = LoadFile( prefix + name )) rules.push_back( file );
+      }
+      if( rules.empty() ) continue;
+
+      // The way down from this directory to the root.
+      std::string lead;
+      if( i > 0 ) lead = path.substr( prefix.size() ) + "/";
+      frame = MakeFrame( frame, base, std::move( lead ), std::move( rules ));
+   }
+   return frame;
+}
+
+//-----------------------------------------------------------------------------
+bool GitIgnore::IsIgnored( const GitIgnoreFrame *frame, std::string_view path,
+                           size_t name_start, bool is_directory ) noexcept {
+   std::string_view name = path.substr( name_start );
+   // Only used for the frames above a root.
+   thread_local std::string joined;
+   for( ; frame; frame = frame->parent.get() ) {
+      std::string_view relative = path.substr( frame->base );
+      if( frame->anchored && !frame->lead.empty() ) {
+         joined.assign( frame->lead );
+         joined.append( relative );
+         relative = joined;
+      }
+      for( size_t i = frame->rules.size(); i-- > 0; ) {
+         int match = frame->rules[i]->Match( relative, name, is_directory );
+         if( match >= 0 ) return match > 0;
+      }
+   }
+   return false;
+}
+
+} /////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,172 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "hash.h"
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+// One ignore file, parsed. The syntax is git's: "#" comments, "!" to bring
+//  back something that an earlier line ignored, a trailing "/" for
+//  directories only, and a pattern with a slash anywhere but the end is
+//  relative to the file's directory instead of matching names at any depth.
+//  The last line that matches decides.
+class IgnoreRules {
+//-----------------------------------------------------------------------------
+   struct Rule {
+      // Split at each slash. Only anchored rules have more than one.
+      std::vector<std::string> pieces;
+      bool negate;
+      bool dir_only;
+      bool anchored;
+   };
+
+   // A deque, since m_names holds views into the rules' strings.
+   std::deque<Rule> m_rules;
+   // Plain names, like "node_modules", and the lines that have them, in
+   //  order. That's most lines in practice, and it's one lookup for all of
+   //  them.
+   std::unordered_map<std::string_view, std::vector<uint32_t>> m_names;
+   // Everything else, in order.
+   std::vector<uint32_t> m_others;
+   bool m_anchored = false;
+   Hash m_hash = 0;
+
+public:
+   //--------------------------------------------------------------------------
+   explicit IgnoreRules( std::string_view text ) noexcept;
+
+   //--------------------------------------------------------------------------
+   bool Empty() const noexcept { return m_rules.empty(); }
+
+   //--------------------------------------------------------------------------
+   // True if some rule needs the path and not just the name.
+   bool Anchored() const noexcept { return m_anchored; }
+
+   //--------------------------------------------------------------------------
+   // Hash of the file's contents.
+   Hash GetHash() const noexcept { return m_hash; }
+
+   //--------------------------------------------------------------------------
+   // 1 if the entry is ignored, 0 if a "!" line brought it back, and -1 if
+   //  no line matches it. `path` is relative to the file's directory, and
+   //  ends with `name`.
+   int Match( std::string_view path, std::string_view name,
+              bool is_directory ) const noexcept;
+};
+
+using IgnoreRulesPtr = std::shared_ptr<const IgnoreRules>;
+
+//-----------------------------------------------------------------------------
+// The ignore files that apply to a directory. Only directories that have
+//  some of their own get a frame; the rest share their parent's.
+struct GitIgnoreFrame {
+   std::shared_ptr<const GitIgnoreFrame> parent;
+   // The directory's ignore files, in the order they take effect, so later
+   //  ones win.
+   std::vector<IgnoreRulesPtr> rules;
+   // Paths that `rules` match start this far into the hashed path, with
+   //  `lead` in front. `lead` is only set for directories above a root.
+   size_t base = 0;
+   std::string lead;
+   bool anchored = false;
+   // Identifies all of the rules from here up, for the cache.
+   Hash key = 0;
+};
+
+using GitFramePtr = std::shared_ptr<const GitIgnoreFrame>;
+
+//-----------------------------------------------------------------------------
+// Honours .gitignore files, and .treehashignore files, which work the same
+//  way and win over .gitignore in the same directory. .git/info/exclude is
+//  read at the top of the repository.
+//
+// Every directory being scanned carries its frame. A subdirectory's frame
+//  comes from Enter, which reads its ignore files, so that's done lazily as
+//  directories are reached, and never for ones that are skipped. Entries
+//  are checked before anything is opened, so an ignored directory is never
+//  read. A root's frame comes from Root, which also reads the ignore files
+//  above it, up to the top of its repository. Those are cached, since
+//  verify asks for one directory at a time. They're only checked against
+//  what's inside of the root. A root is scanned even if they ignore it.
+//
+// Frames are read-only once they're made, so they can be shared between
+//  threads.
+class GitIgnore {
+//-----------------------------------------------------------------------------
+   std::mutex m_mutex;
+   // Parsed files by path, or null for ones that aren't there.
+   std::unordered_map<std::string, IgnoreRulesPtr> m_files;
+   // Whether each directory seen so far has a ".git".
+   std::unordered_map<std::string, bool> m_repos;
+
+   //--------------------------------------------------------------------------
+   IgnoreRulesPtr LoadFile( const std::string &path ) noexcept;
+   bool IsRepository( const std::string &dir ) noexcept;
+
+   //--------------------------------------------------------------------------
+   static GitFramePtr MakeFrame( const GitFramePtr &parent, size_t base,
+                                 std::string lead,
+                                 std::vector<IgnoreRulesPtr> rules ) noexcept;
+
+   //--------------------------------------------------------------------------
+   static IgnoreRulesPtr Parse( const std::string &text ) noexcept;
+
+public:
+   //--------------------------------------------------------------------------
+   // Names of the ignore files in each directory, in the order they take
+   //  effect.
+   static constexpr const char *FILE_NAMES[] = {
+      ".gitignore", ".treehashignore"
+   };
+
+   //--------------------------------------------------------------------------
+   // The frame of a subdirectory of a directory with `parent`. `base` is the
+   //  length of the subdirectory's hashed path, with its trailing slash.
+   //  `read( name, text )` reads one of its ignore files into `text`, and
+   //  returns false if there isn't one.
+   template< typename R >
+   static GitFramePtr Enter( const GitFramePtr &parent, size_t base,
+                             R read ) noexcept {
+      std::vector<IgnoreRulesPtr> rules;
+      std::string text;
+      for( const char *name : FILE_NAMES ) {
+         text.clear();
+         if( !read( name, text )) continue;
+         if( IgnoreRulesPtr parsed = Parse( text )) rules.push_back( parsed );
+      }
+      if( rules.empty() ) return parent;
+      return MakeFrame( parent, base, {}, std::move( rules ));
+   }
+
+   //--------------------------------------------------------------------------
+   // The frame of a root. `dir` is where it actually is, and `base` is the
+   //  length of its hashed path, with its trailing slash.
+   GitFramePtr Root( std::string_view dir, size_t base ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // True if the entry at the end of `path`, its hashed path, is ignored.
+   //  Its name starts at `name_start`, and `frame` is the frame of the
+   //  directory it's in.
+   static bool IsIgnored( const GitIgnoreFrame *frame, std::string_view path,
+                          size_t name_start, bool is_directory ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // What to keep in the cache for a directory with `frame`.
+   static Hash Key( const GitIgnoreFrame *frame ) noexcept {
+      return frame ? frame->key : 0;
+   }
+};
+
+} /////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,368 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#include "glob_matcher.h"
+
+#include <algorithm>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+static constexpr const char *GLOB_CHARS = "*?[";
+
+//-----------------------------------------------------------------------------
+// Calls `func` with each piece of `path` between slashes, skipping empty ones
+//  and ".". Stops early if `func` returns false.
+template< typename F >
+static bool ForEachPiece( std::string_view path, F func ) noexcept {
+   while( !path.empty() ) {
+      size_t slash = path.find( '/' );
+      std::string_view piece = path.substr( 0, slash );
+      if( !piece.empty() && piece != "." && !func( piece )) return false;
+      if( slash == path.npos ) break;
+      path.remove_prefix( slash + 1 );
+   }
+   return true;
+}
+
+//-----------------------------------------------------------------------------
+// Moves past one UTF-8 character.
+static inline size_t NextChar( std::string_view name, size_t i ) noexcept {
+   for( i++; i < name.size() && (name[i] & 0xC0) == 0x80; i++ ) {}
+   return i;
+}
+
+//-----------------------------------------------------------------------------
+// Matches `c` against the class that starts at `pattern[start]`, which is
+//  "[". Returns false if there's no closing "]", in which case the "[" is
+//  just a character. Otherwise, `end` is set to just past the class.
+static bool MatchClass( std::string_view pattern, size_t start,
+                        unsigned char c, size_t &end,
+                        bool &matched ) noexcept {
+   size_t i = start + 1;
+   bool negate = i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^');
+   if( negate ) i++;
+   matched = false;
+   // A "]" right at the start is one of the characters.
+   for( size_t first = i; i < pattern.size(); i++ ) {
+      if( pattern[i] == ']' && i != first ) {
+         end = i + 1;
+         matched = matched != negate;
+         return true;
+      }
+      unsigned char low = pattern[i], high = low;
+      if( i + 2 < pattern.size() && pattern[i + 1] == '-'
+                                 && pattern[i + 2] != ']' ) {
+         high = pattern[i + 2];
+         i += 2;
+      }
+      if( c >= low && c <= high ) matched = true;
+   }
+   return false;
+}
+
+//-----------------------------------------------------------------------------
+// Matches one name against one piece of a glob, with backtracking to the
+//  last "*". That's linear for the kind of patterns people write.
+static bool MatchWild( std::string_view pattern,
+                       std::string_view name ) noexcept {
+   size_t p = 0, n = 0;
+   size_t star = pattern.npos, star_n = 0;
+   while( n < name.size() ) {
+      if( p < pattern.size() ) {
+         char c = pattern[p];
+         if( c == '*' ) {
+            star = ++p;
+            star_n = n;
+            continue;
+         }
+         if( c == '?' ) {
+            p++;
+            n = NextChar( name, n );
+            continue;
+         }
+         size_t end;
+         bool matched;
+         if( c == '[' && MatchClass( pattern, p, name[n], end, matched )) {
+            if( matched ) {
+               p = end;
+               n = NextChar( name, n );
+               continue;
+            }
+         } else if( c == name[n] ) {
+            p++;
+            n++;
+            continue;
+         }
+      }
+      // Let the last "*" take one more character and try again from there.
+      if( star == pattern.npos ) return false;
+      p = star;
+      n = star_n = NextChar( name, star_n );
+   }
+   while( p < pattern.size() && pattern[p] == '*' ) p++;
+   return p == pattern.size();
+}
+
+//-----------------------------------------------------------------------------
+bool GlobMatcher::MatchName( std::string_view pattern,
+                             std::string_view name ) noexcept {
+   return MatchWild( pattern, name );
+}
+
+//-----------------------------------------------------------------------------
+bool GlobMatcher::Match( const Segment &segment,
+                         std::string_view name ) noexcept {
+   const std::string &text = segment.text;
+   switch( segment.kind ) {
+   case Segment::LITERAL:
+      return name == text;
+   case Segment::PREFIX:
+      return name.size() >= text.size()
+             && name.compare( 0, text.size(), text ) == 0;
+   case Segment::SUFFIX:
+      return name.size() >= text.size()
+             && name.compare( name.size() - text.size(), text.size(),
+                              text ) == 0;
+   case Segment::WILD:
+      return MatchWild( text, name );
+   default:
+      return true;
+   }
+}
+
+//-----------------------------------------------------------------------------
+size_t GlobMatcher::AddPattern( std::string_view pattern,
+                                bool exclude ) noexcept {
+   Pattern compiled{ std::string( pattern ), exclude, {} };
+   for(;;) {
+      size_t slash = pattern.find( '/' );
+      std::string_view piece = pattern.substr( 0, slash );
+      size_t wild = piece.find_first_of( GLOB_CHARS );
+      Segment segment{ Segment::WILD, std::string( piece ) };
+      if( piece == "**" ) {
+         segment.kind = Segment::DIRS;
+      } else if( wild == piece.npos ) {
+         segment.kind = Segment::LITERAL;
+      } else if( piece == "*" ) {
+         segment.kind = Segment::ANY;
+      } else if( wild == 0 && piece[0] == '*'
+                 && piece.find_first_of( GLOB_CHARS, 1 ) == piece.npos ) {
+         segment.kind = Segment::SUFFIX;
+         segment.text.erase( 0, 1 );
+      } else if( wild == piece.size() - 1 && piece.back() == '*' ) {
+         segment.kind = Segment::PREFIX;
+         segment.text.pop_back();
+      }
+      compiled.segments.push_back( std::move( segment ));
+      if( slash == pattern.npos ) break;
+      pattern.remove_prefix( slash + 1 );
+   }
+   m_patterns.push_back( std::move( compiled ));
+   return m_patterns.size() - 1;
+}
+
+//-----------------------------------------------------------------------------
+void GlobMatcher::Enter( size_t pattern, size_t segment,
+                         std::vector<uint64_t> &out ) const noexcept {
+   const auto &segments = m_patterns[pattern].segments;
+   for(;;) {
+      out.push_back( (uint64_t)pattern << 32 | segment );
+      if( segments[segment].kind != Segment::DIRS
+                                || segment + 1 == segments.size() ) {
+         break;
+      }
+      segment++;
+   }
+}
+
+//-----------------------------------------------------------------------------
+bool GlobMatcher::Advance( const std::vector<uint64_t> &from,
+                           std::string_view name,
+                           std::vector<uint64_t> &to ) const noexcept {
+   to.clear();
+   for( uint64_t position : from ) {
+      size_t index = position >> 32;
+      size_t s = static_cast<uint32_t>( position );
+      const Pattern &pattern = m_patterns[index];
+      const Segment &segment = pattern.segments[s];
+      if( segment.kind == Segment::DIRS ) {
+         // It takes the name, and stays for the next one.
+         Enter( index, s, to );
+         continue;
+      }
+      if( !Match( segment, name )) continue;
+      if( s + 1 < pattern.segments.size() ) {
+         Enter( index, s + 1, to );
+      } else if( pattern.exclude ) {
+         return false;
+      }
+   }
+   std::sort( to.begin(), to.end() );
+   to.erase( std::unique( to.begin(), to.end() ), to.end() );
+   return true;
+}
+
+//-----------------------------------------------------------------------------
+const GlobState *GlobMatcher::Intern( std::vector<uint64_t> &positions,
+                                      bool restricted ) const noexcept {
+   std::sort( positions.begin(), positions.end() );
+   positions.erase( std::unique( positions.begin(), positions.end() ),
+                    positions.end() );
+
+   bool has_include = false, has_exclude = false, included_all = false;
+   for( uint64_t position : positions ) {
+      const Pattern &pattern = m_patterns[position >> 32];
+      size_t s = static_cast<uint32_t>( position );
+      // A "**" at the end of a pattern matches everything under here.
+      bool all = s + 1 == pattern.segments.size()
+                 && pattern.segments[s].kind == Segment::DIRS;
+      if( pattern.exclude ) {
+         if( all ) return &m_dead;
+         has_exclude = true;
+      } else {
+         has_include = true;
+         included_all |= all;
+      }
+   }
+   if( restricted && !has_include ) return &m_dead;
+   if( included_all ) {
+      // The other include patterns don't matter anymore.
+      positions.erase( std::remove_if( positions.begin(), positions.end(),
+                                       [&]( uint64_t position ) {
+         return !m_patterns[position >> 32].exclude;
+      }), positions.end() );
+      restricted = false;
+   }
+   if( !restricted && !has_exclude ) return nullptr;
+
+   std::string id( reinterpret_cast<const char*>( positions.data() ),
+                   positions.size() * sizeof positions[0] );
+   id.push_back( restricted );
+
+   std::lock_guard<std::mutex> lock( m_mutex );
+   auto &state = m_states[id];
+   if( state ) return state.get();
+
+   state = std::make_unique<GlobState>();
+   state->matcher = this;
+   state->positions = positions;
+   state->restricted = restricted;
+   // Pattern indexes can be different next run, so the key is made from
+   //  the patterns themselves.
+   std::string key = restricted ? "restricted" : "";
+   for( uint64_t position : positions ) {
+      const Pattern &pattern = m_patterns[position >> 32];
+      key += pattern.exclude ? "\n!" : "\n";
+      key += pattern.text;
+      key += "\n" + std::to_string( static_cast<uint32_t>( position ));
+   }
+   state->key = XXH64( key.data(), key.size(), HASH_SEED );
+   return state.get();
+}
+
+//-----------------------------------------------------------------------------
+bool GlobMatcher::IsGlob( std::string_view input ) noexcept {
+   if( !input.empty() && input.back() == '*'
+         && (input.size() == 1 || input[input.size() - 2] != '*') ) {
+      input.remove_suffix( 1 );
+   }
+   return input.find_first_of( GLOB_CHARS ) != input.npos;
+}
+
+//-----------------------------------------------------------------------------
+void GlobMatcher::Split( std::string_view glob, std::string &dir,
+                         std::string &rest ) noexcept {
+   size_t piece = 0;
+   for(;;) {
+      size_t slash = glob.find( '/', piece );
+      size_t end = slash == glob.npos ? glob.size() : slash;
+      if( glob.substr( piece, end - piece ).find_first_of( GLOB_CHARS )
+                                                         != glob.npos ) {
+         break;
+      }
+      if( slash == glob.npos ) {
+         piece = glob.size();
+         break;
+      }
+      piece = slash + 1;
+   }
+   rest = glob.substr( piece );
+   if( piece == 0 ) {
+      dir = ".";
+   } else if( piece == 1 ) {
+      dir = "/";
+   } else {
+      dir = glob.substr( 0, piece - 1 );
+   }
+}
+
+//-----------------------------------------------------------------------------
+void GlobMatcher::AddExclude( std::string_view pattern ) noexcept {
+   // Hashed paths don't start with these, or they're skipped.
+   while( !pattern.empty() && pattern[0] == '/' ) pattern.remove_prefix( 1 );
+   while( pattern.substr( 0, 2 ) == "./" ) pattern.remove_prefix( 2 );
+   if( pattern.empty() ) return;
+   m_excludes.push_back( AddPattern( pattern, true ));
+}
+
+//-----------------------------------------------------------------------------
+const GlobState *GlobMatcher::Start( std::string_view path,
+                    const std::vector<std::string> &includes ) noexcept {
+   std::vector<uint64_t> positions, next;
+   for( size_t e : m_excludes ) Enter( e, 0, positions );
+   bool excluded = !ForEachPiece( path, [&]( std::string_view piece ) {
+      if( !Advance( positions, piece, next )) return false;
+      positions.swap( next );
+      return true;
+   });
+   if( excluded ) return &m_dead;
+
+   for( auto &include : includes ) {
+      Enter( AddPattern( include, false ), 0, positions );
+   }
+   return Intern( positions, !includes.empty() );
+}
+
+//-----------------------------------------------------------------------------
+const GlobState *GlobMatcher::Child( const GlobState *dir,
+                                     std::string_view name ) noexcept {
+   if( !dir || dir->dead ) return dir;
+   const GlobMatcher &matcher = *dir->matcher;
+   std::vector<uint64_t> positions;
+   if( !matcher.Advance( dir->positions, name, positions )) {
+      return &matcher.m_dead;
+   }
+   return matcher.Intern( positions, dir->restricted );
+}
+
+//-----------------------------------------------------------------------------
+const GlobState *GlobMatcher::Find( const GlobState *dir,
+                                    std::string_view path ) noexcept {
+   ForEachPiece( path, [&]( std::string_view piece ) {
+      dir = Child( dir, piece );
+      return dir && !dir->dead;
+   });
+   return dir;
+}
+
+//-----------------------------------------------------------------------------
+bool GlobMatcher::MatchFile( const GlobState *dir,
+                             std::string_view name ) noexcept {
+   if( !dir ) return true;
+   if( dir->dead ) return false;
+   const GlobMatcher &matcher = *dir->matcher;
+   bool included = !dir->restricted;
+   for( uint64_t position : dir->positions ) {
+      const Pattern &pattern = matcher.m_patterns[position >> 32];
+      size_t s = static_cast<uint32_t>( position );
+      // Only the last piece of a pattern can match a file.
+      if( s + 1 != pattern.segments.size() ) continue;
+      if( !Match( pattern.segments[s], name )) continue;
+      if( pattern.exclude ) return false;
+      included = true;
+   }
+   return included;
+}
+
+} /////////////////////////////////////////////////////////////////////////////
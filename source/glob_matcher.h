@@ -0,0 +1,176 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "hash.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+class GlobMatcher;
+
+//-----------------------------------------------------------------------------
+// Where a directory is in the glob patterns. Directories that end up in the
+//  same place share one state. A null state means that globs don't filter
+//  anything under the directory, which is the usual case.
+struct GlobState {
+   const GlobMatcher *matcher;
+   // The pattern index in the top half and the segment that the next name
+   //  has to match in the bottom half. Sorted.
+   std::vector<uint64_t> positions;
+   // True if files only count when an include pattern matches them.
+   bool restricted = false;
+   // True if nothing under here can count, so the directory is skipped
+   //  without being read.
+   bool dead = false;
+   // Identifies the state from one run to the next, for the cache.
+   Hash key = 0;
+};
+
+//-----------------------------------------------------------------------------
+// Glob patterns, compiled into an automaton over path pieces. A pattern is
+//  split at each slash, and each piece matches one name:
+//
+//   *       Any run of characters.
+//   ?       Any one character.
+//   [abc]   One of the characters listed. Ranges like [a-z] work, and [!a]
+//            or [^a] is any character but those.
+//   **      As a whole piece, any number of directories, even none.
+//
+// Each root has its own include patterns, relative to the root, and a file
+//  only counts if one of them matches. Exclude patterns go for every root,
+//  and match the path as it's hashed. A directory that an exclude pattern
+//  matches is skipped entirely.
+//
+// Every directory carries its state, taken from its parent's with Child. A
+//  directory is skipped without being read once no include pattern can match
+//  anything under it, or an exclude pattern has matched all of it.
+//
+// States are made as they're first reached, so Child takes a lock for that,
+//  but everything else is read-only while scanning and can be shared between
+//  threads.
+class GlobMatcher {
+//-----------------------------------------------------------------------------
+   struct Segment {
+      enum Kind : uint8_t {
+         LITERAL,  // `text` exactly.
+         ANY,      // "*"
+         PREFIX,   // `text` then "*".
+         SUFFIX,   // "*" then `text`.
+         WILD,     // Anything else, with `text` being the whole piece.
+         DIRS      // "**"
+      };
+      Kind kind;
+      std::string text;
+   };
+
+   struct Pattern {
+      std::string text;
+      bool exclude;
+      std::vector<Segment> segments;
+   };
+
+   std::vector<Pattern> m_patterns;
+   std::vector<size_t> m_excludes;
+
+   mutable std::mutex m_mutex;
+   mutable std::unordered_map<std::string,
+                              std::unique_ptr<GlobState>> m_states;
+   GlobState m_dead;
+
+   //--------------------------------------------------------------------------
+   size_t AddPattern( std::string_view pattern, bool exclude ) noexcept;
+
+   //--------------------------------------------------------------------------
+   static bool Match( const Segment &segment, std::string_view name ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // Adds the position at `segment` of `pattern` to `out`, and the ones after
+   //  it that a "**" there can skip to.
+   void Enter( size_t pattern, size_t segment,
+               std::vector<uint64_t> &out ) const noexcept;
+
+   //--------------------------------------------------------------------------
+   // The positions for the subdirectory `name` of a directory at `from`.
+   //  Returns false if an exclude pattern matches the subdirectory.
+   bool Advance( const std::vector<uint64_t> &from, std::string_view name,
+                 std::vector<uint64_t> &to ) const noexcept;
+
+   //--------------------------------------------------------------------------
+   // Finds or makes the state for `positions`, which is reordered.
+   const GlobState *Intern( std::vector<uint64_t> &positions,
+                            bool restricted ) const noexcept;
+
+public:
+   //--------------------------------------------------------------------------
+   // True if `input` is a glob and not a plain path. A single "*" on the end
+   //  of a path is the recursive mark for inputs, and doesn't count.
+   static bool IsGlob( std::string_view input ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // True if `name` matches `pattern`, which is one piece of a glob.
+   static bool MatchName( std::string_view pattern,
+                          std::string_view name ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // Splits a glob into the directory in front of its first wildcard, and
+   //  the rest. The directory is where scanning starts, and nothing outside
+   //  of it is read. It's "." if the glob starts with a wildcard.
+   static void Split( std::string_view glob, std::string &dir,
+                      std::string &rest ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // Adds a pattern that excludes what it matches from every root. All of
+   //  them have to be added before the first Start.
+   void AddExclude( std::string_view pattern ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // The state of the root `path`, whose files have to match one of
+   //  `includes` to count, or all count if there are none.
+   const GlobState *Start( std::string_view path,
+                           const std::vector<std::string> &includes ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // The state of the subdirectory `name` of a directory with `dir`.
+   static const GlobState *Child( const GlobState *dir,
+                                  std::string_view name ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // The state of the directory `path` under a directory with `dir`. `path`
+   //  ends with a slash.
+   static const GlobState *Find( const GlobState *dir,
+                                 std::string_view path ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // True if the file `name` in a directory with `dir` counts.
+   static bool MatchFile( const GlobState *dir,
+                          std::string_view name ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // True if a directory with `state` should be skipped.
+   static bool Skip( const GlobState *state ) noexcept {
+      return state && state->dead;
+   }
+
+   //--------------------------------------------------------------------------
+   // What to keep in the cache for a directory with `state`.
+   static Hash Key( const GlobState *state ) noexcept {
+      return state ? state->key : 0;
+   }
+
+   //--------------------------------------------------------------------------
+   GlobMatcher() {
+      m_dead.matcher = this;
+      m_dead.dead = true;
+   }
+};
+
+} /////////////////////////////////////////////////////////////////////////////
@@ -4,9 +4,9 @@
 #include "options.h"
 #include "util.h"
 #include "scanner.h"
+#include "glob_matcher.h"
 
 #include <fstream>
-#include <unordered_set>
 #include <filesystem>
 #include <iostream>
 #include <regex>
@@ -16,33 +16,58 @@ namespace fs = std::filesystem;
 ///////////////////////////////////////////////////////////////////////////////
 namespace Treehash {
 
-struct {
-   std::unordered_set<std::string> exts;
-   std::vector<std::string> ignores;
+// Defined in hash_avx2.cpp.
+Xxh3Function GetAvx2Xxh3() noexcept;
 
-   void ResetExts() {
-      exts.clear();
-      for( auto &i : opt_exts ) {
-         // _ = no extension.
-         if( i == "_" ) exts.insert( "" );
-         else exts.insert( i );
-      }
-   }
+//-----------------------------------------------------------------------------
+static uint64_t Xxh3Default( const void *data, size_t len,
+                             uint64_t seed ) noexcept {
+   return XXH3_64bits_withSeed( data, len, seed );
+}
 
-   void ResetIgnores() {
-      ignores.clear();
-      for( auto &i : opt_ignores ) {
-         ignores.push_back( i );
-      }
-   }
+//-----------------------------------------------------------------------------
+// True if the CPU has AVX2 and the OS saves the registers for it.
+static bool CpuHasAvx2() noexcept {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+   int info[4];
+   __cpuid( info, 0 );
+   if( info[0] < 7 ) return false;
+   __cpuid( info, 1 );
+   const int OSXSAVE = 1 << 27, AVX = 1 << 28;
+   if( (info[2] & OSXSAVE) == 0 || (info[2] & AVX) == 0 ) return false;
+   // XMM and YMM state.
+   if( (_xgetbv( 0 ) & 6) != 6 ) return false;
+   __cpuidex( info, 7, 0 );
+   const int AVX2 = 1 << 5;
+   return (info[1] & AVX2) != 0;
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+   __builtin_cpu_init();
+   return __builtin_cpu_supports( "avx2" );
+#else
+   return false;
+#endif
+}
 
-   void Reset() {
-      ResetExts();
-      ResetIgnores();
-   }
+//-----------------------------------------------------------------------------
+static Xxh3Function SelectXxh3Long() noexcept {
+   Xxh3Function avx2 = GetAvx2Xxh3();
+   if( avx2 && CpuHasAvx2() ) return avx2;
+   return Xxh3Default;
+}
 
-} Filter;
+Xxh3Function Xxh3Long = SelectXxh3Long();
 
+//-----------------------------------------------------------------------------
+const char *Xxh3LongName() noexcept {
+   if( Xxh3Long != Xxh3Default ) return "AVX2";
+   switch( XXH_VECTOR ) {
+   case XXH_AVX2: return "AVX2";
+   case XXH_SSE2: return "SSE2";
+   case XXH_NEON: return "NEON";
+   case XXH_VSX:  return "VSX";
+   default:       return "scalar";
+   }
+}
 
 //-----------------------------------------------------------------------------
 std::string HashToHex( Hash hash ) noexcept {
@@ -60,71 +85,71 @@ std::string HashToHex( Hash hash ) noexcept {
 }
 
 //-----------------------------------------------------------------------------
-bool IsExcluded( const fs::path &path, bool directory ) {
-   // Ignore files that start with "."
-   std::string filename = path.filename().string();
+std::string ResultToString( Hash hash ) noexcept {
+   if( opt_hash_version == 1 ) return HashToHex( hash );
+   return "v" + std::to_string( opt_hash_version ) + ":" + HashToHex( hash );
+}
 
-   if( filename[0] == '.' ) {
-      return true;
+//-----------------------------------------------------------------------------
+Hash DirectorySeed( std::string_view path ) noexcept {
+   Hash seed = HASH_SEED;
+   for( size_t slash; (slash = path.find( '/' )) != path.npos; ) {
+      seed = SubdirectorySeed( seed, path.substr( 0, slash ));
+      path.remove_prefix( slash + 1 );
    }
+   return seed;
+}
 
-   if( !directory ) {
-      // Ignore files that have an excluded extension.
-      auto &exts = Filter.exts;
-      if( !exts.empty() && exts.find( path.extension().string() ) == exts.end() ) {
-         return true;
+//-----------------------------------------------------------------------------
+Hash HashBatch( NameBatch &batch, std::string_view dir,
+                Hash seed ) noexcept {
+   // The version is checked once for the batch, and each loop is only the
+   //  hash, so the hashes of neighbouring names can overlap in the CPU.
+   Hash hash = 0;
+   const std::string_view *names = batch.names;
+   size_t count = batch.count;
+   switch( opt_hash_version ) {
+   case 1: {
+      std::string &path = batch.path;
+      path.assign( dir );
+      for( size_t i = 0; i < count; i++ ) {
+         path.resize( dir.size() );
+         path.append( names[i] );
+         hash ^= XXH64( path.data(), path.size(), HASH_SEED );
       }
+      break;
    }
-
-   // Ignore files that match the pattern specified.
-   auto &ignores = Filter.ignores;
-   for( auto &i : ignores ) {
-      if( filename == i ) return true;
-      if( path.generic_string() == i ) return true;
+   case 2:
+      for( size_t i = 0; i < count; i++ ) {
+         hash ^= XXH64( names[i].data(), names[i].size(), seed );
+      }
+      break;
+   default:
+      for( size_t i = 0; i < count; i++ ) {
+         hash ^= Xxh3( names[i].data(), names[i].size(), seed );
+      }
+      break;
    }
-
-   return false;
+   batch.count = 0;
+   return hash;
 }
 
 //-----------------------------------------------------------------------------
-Hash AddFolder( const fs::path &path, bool recursive ) {
-   
-   Hash hash = 0;
-
-   std::error_code error_code;
-   auto dir_iter = fs::directory_iterator( path
-                        , fs::directory_options::follow_directory_symlink
-                        | fs::directory_options::skip_permission_denied
-                        , error_code );
-
-   if( error_code ) {
-      return 0;
-   }
-
-   for( auto &p : dir_iter ) {
-      if( p.is_directory() && recursive ) {
-         auto &path = p.path();
-         if( IsExcluded( path, true )) continue;
-         hash ^= AddFolder( p, recursive );
-      } else if( p.is_regular_file() ) {
-         auto path = p.path();
-         if( IsExcluded( path, false )) {
-            if( opt_verbose ) {
-               std::string file = path.generic_string();
-               std::cout << "   " << file << "\n";
-            }
-            continue;
-         }
-
-         auto &file = path.generic_string();
-         hash ^= XXH64( file.data(), file.size(), HASH_SEED );
-
-         if( opt_verbose ) {
-            std::cout << " * " << file << "\n";
-         }
+bool HexToHash( std::string_view hex, Hash &hash ) noexcept {
+   if( hex.size() != 16 ) return false;
+   hash = 0;
+   for( char c : hex ) {
+      int digit;
+      if( c >= '0' && c <= '9' ) {
+         digit = c - '0';
+      } else if( c >= 'A' && c <= 'F' ) {
+         digit = c - 'A' + 10;
+      } else {
+         return false;
       }
+      hash = (hash << 4) | digit;
    }
-   return hash;
+   return true;
 }
 
 //-----------------------------------------------------------------------------
@@ -138,77 +163,125 @@ bool StripRecurseMark( std::string *path ) {
 std::regex re_inputfile_directive( R"(^\[([^]*)\])" );
 
 //-----------------------------------------------------------------------------
-Hash ProcessInputFile( std::string path, Scanner &scanner ) {
+std::string BasePrefix( std::string_view path ) noexcept {
+   if( opt_basepath.empty() || fs::path( path ).is_absolute() ) return "";
+   std::string prefix = opt_basepath;
+   if( prefix.back() != '/' ) prefix.push_back( '/' );
+   return prefix;
+}
+
+//-----------------------------------------------------------------------------
+// Adds a root for a glob input. `dir` and `rest` are from GlobMatcher::Split.
+//  Globs that start in the same directory share a root, so that it's only
+//  scanned once. Only roots from `first` on are shared, which are the ones
+//  from the same input.
+static void AddGlobRoot( std::string dir, const std::string &rest,
+                         std::vector<ScanRoot> &roots, size_t first ) {
+   bool recursive = rest.find( '/' ) != rest.npos || rest == "**";
+   for( size_t i = first; i < roots.size(); i++ ) {
+      ScanRoot &root = roots[i];
+      if( root.patterns.empty() || root.path != dir ) continue;
+      root.patterns.push_back( rest );
+      root.recursive |= recursive;
+      return;
+   }
+   ScanRoot root{ std::move( dir ), recursive, {}, nullptr, 0 };
+   root.patterns.push_back( rest );
+   roots.push_back( std::move( root ));
+}
+
+//-----------------------------------------------------------------------------
+void ProcessInputFile( std::string path, std::vector<ScanRoot> &roots ) {
    std::ifstream file( path );
    std::string line;
-
-   Hash hash = 0;
+   size_t first = roots.size();
 
    while( std::getline( file, line )) {
       InplaceTrim( &line );
       if( line.empty() || line[0] == '#' ) continue;
 
-      if( line[0] == '[' ) {
+      if( line.compare( 0, 8, "[filter]" ) == 0 ) {
+         // Filters go for every input, like excludes.
+         opt_filters.push_back( line.substr( 8 ));
+      } else if( line[0] == '[' ) {
          std::smatch match;
          std::regex_search( line, match, re_inputfile_directive );
          if( !match.empty() ) {
-            if( match[1] == "ext" || match[1] == "exts" || match[1] == "extensions" ) {
-               Filter.ResetExts();
-               SplitForeach( line.substr( 6 ), " |", []( std::string piece ) {
-                  if( piece == "_" ) piece = "";
-                  Filter.exts.insert( piece );
-               });
-            } else if( match[1] == "ignores" || match[1] == "ignore" ) {
-               Filter.ResetIgnores();
-               SplitForeach( line.substr( 9 ), "|", []( std::string piece ) {
-                  Filter.ignores.push_back( piece );
-               });
+            // [ext] and [ignore] were never hooked up to the scanners.
+            //  Rather than hash every file without a word, say so, on
+            //  stderr so that scripts reading the hash aren't thrown off.
+            std::string name = match[1];
+            if( name == "ext" || name == "exts" || name == "extensions"
+                  || name == "ignore" || name == "ignores" ) {
+               std::cerr << "Ignoring [" << name << "] in " << path
+                         << ". Input lists don't support it; use -e or -i,"
+                            " or [filter] and \"!\" lines.\n";
             }
          } else {
             if( opt_verbose ) {
                std::cout << "Unknown directive in input file: " << line << "\n";
             }
          }
+      } else if( line[0] == '!' ) {
+         opt_excludes.push_back( line.substr( 1 ));
+      } else if( GlobMatcher::IsGlob( line )) {
+         std::string dir, rest;
+         GlobMatcher::Split( line, dir, rest );
+         AddGlobRoot( std::move( dir ), rest, roots, first );
       } else {
          bool recursive = StripRecurseMark( &line );
-         hash ^= scanner.Scan( line, recursive );
+         roots.push_back( ScanRoot{ line, recursive, {}, nullptr, 0 } );
       }
    }
-
-   return hash;
 }
 
 //-----------------------------------------------------------------------------
-Hash HashInput( std::string input, Scanner &scanner ) noexcept {
-   
-   std::error_code error_code;
-   std::filesystem::current_path( opt_basepath, error_code );
-   if( error_code ) {
-      std::cout << "Error with basepath.";
-      return 0;
-   }
-   
+void CollectRoots( std::string input, std::vector<ScanRoot> &roots ) noexcept {
    InplaceTrim( &input );
-   if( input.empty() ) return 0;
+   if( input.empty() ) return;
 
-   bool recurse = StripRecurseMark( &input );
-   auto path = fs::relative( input );
+   // Something that exists by that name is never a glob.
+   std::error_code error_code;
+   bool glob = GlobMatcher::IsGlob( input )
+               && !fs::exists( input, error_code );
+   bool recurse = !glob && StripRecurseMark( &input );
 
    try {
-      if( !fs::exists( path )) {
-         return 0;
+      if( glob ) {
+         std::string dir, rest;
+         GlobMatcher::Split( input, dir, rest );
+         if( opt_verbose ) {
+            std::cout << "Input is a glob. Scanning from " << dir
+                      << ".\n";
+         }
+         if( !fs::is_directory( dir )) return;
+         auto path = fs::relative( dir, opt_basepath );
+         AddGlobRoot( path.generic_string(), rest, roots, roots.size() );
+         return;
+      }
+
+
+      // Inputs are absolute, and are hashed relative to the base path.
+      // We don't change the working directory for that, so that roots can
+      //  be scanned side by side.
+      if( !fs::exists( input )) {
+         return;
       }
 
-      if( !recurse && fs::is_regular_file( path )) {
+      if( !recurse && fs::is_regular_file( input )) {
          if( opt_verbose )
             std::cout << "Input is an input file (or we think it is).\n";
          // Input file
-         return ProcessInputFile( input, scanner );
-      } else if( fs::is_directory( path )) {
+         ProcessInputFile( input, roots );
+         return;
+      } else if( fs::is_directory( input )) {
          if( opt_verbose )
             std::cout << "Input is a directory. Scanning directly!\n";
          // Directory
-         return scanner.Scan( path.generic_string(), recurse );
+         auto path = fs::relative( input, opt_basepath );
+         roots.push_back( ScanRoot{ path.generic_string(), recurse, {},
+                                   nullptr, 0 } );
+         return;
       }
    } catch( fs::filesystem_error &e ) {
       std::cout << "Filesystem error: " << e.what()
@@ -3,17 +3,96 @@
 #pragma once
 
 #include "hash/xxh3.h"
+#include "options.h"
 
 #include <cstdint>
 #include <string>
+#include <string_view>
+#include <vector>
 
 ///////////////////////////////////////////////////////////////////////////////
 namespace Treehash {
    using Hash = uint64_t;
    constexpr Hash HASH_SEED = 0;
 
-   class Scanner;
-   Hash HashInput( std::string input, Scanner &scanner ) noexcept;
+   // Hash versions, selected with opt_hash_version. The result is always the
+   //  XOR of one hash per file.
+   //  1: XXH64 of the file's whole path. The default.
+   //  2: Each directory's path is folded into a seed once, one name at a
+   //     time, and a file only hashes its own name with that seed. Deep
+   //     trees don't pay for their prefix on every file.
+   //  3: The same as 2, with XXH3 instead of XXH64.
+   constexpr int HASH_VERSION_MAX = 3;
+
+   // XXH3 with a seed. Inputs longer than XXH3_MIDSIZE_MAX go through a
+   //  vector loop, and that's picked at startup for the CPU we're on. The
+   //  shorter ones don't use vectors at all.
+   using Xxh3Function = uint64_t (*)( const void*, size_t, uint64_t ) noexcept;
+   extern Xxh3Function Xxh3Long;
+   inline Hash Xxh3( const void *data, size_t len, Hash seed ) noexcept {
+      if( len > XXH3_MIDSIZE_MAX ) return Xxh3Long( data, len, seed );
+      return XXH3_64bits_withSeed( data, len, seed );
+   }
+
+   // The name of the vector loop that Xxh3Long uses, for verbose output.
+   const char *Xxh3LongName() noexcept;
+
+   // A name or path piece hashed with a seed, with the hash version's
+   //  function.
+   inline Hash SeededHash( const void *data, size_t len, Hash seed ) noexcept {
+      if( opt_hash_version == 3 ) return Xxh3( data, len, seed );
+      return XXH64( data, len, seed );
+   }
+
+   // The seed for the files in the directory `path`, which ends with a slash.
+   Hash DirectorySeed( std::string_view path ) noexcept;
+
+   // The seed for the subdirectory `name` of a directory with `seed`.
+   inline Hash SubdirectorySeed( Hash seed, std::string_view name ) noexcept {
+      return SeededHash( name.data(), name.size(), seed );
+   }
+
+   // The hash of a file. `path` is the full path as it's hashed, with the
+   //  name starting at `name_start`, and `seed` is its directory's seed.
+   inline Hash FileHash( std::string_view path, size_t name_start,
+                         Hash seed ) noexcept {
+      if( opt_hash_version == 1 ) {
+         return XXH64( path.data(), path.size(), HASH_SEED );
+      }
+      return SeededHash( path.data() + name_start, path.size() - name_start,
+                         seed );
+   }
+
+   // File names from one batch of directory entries, to be hashed together
+   //  by HashBatch. The names point into the scanner's buffers, so they have
+   //  to be hashed before those are reused.
+   struct NameBatch {
+      static constexpr size_t SIZE = 256;
+      std::string_view names[SIZE];
+      size_t count = 0;
+      // Scratch space for version 1, which hashes whole paths.
+      std::string path;
+
+      bool Full() const noexcept { return count == SIZE; }
+      void Add( std::string_view name ) noexcept { names[count++] = name; }
+   };
+
+   // The XOR of FileHash for every name in `batch`, which is then emptied.
+   //  `dir` is the names' directory as it's hashed, and `seed` is its seed.
+   Hash HashBatch( NameBatch &batch, std::string_view dir,
+                   Hash seed ) noexcept;
+
+   struct ScanRoot;
+   // Expands an input into the directories to scan, reading input list files.
+   void CollectRoots( std::string input, std::vector<ScanRoot> &roots ) noexcept;
+   // What to put in front of a root's path to open it. Roots are relative to
+   //  the base path unless they are absolute.
+   std::string BasePrefix( std::string_view path ) noexcept;
    std::string HashToHex( Hash hash ) noexcept;
+   // Reads back what HashToHex writes. Returns false if `hex` isn't that.
+   bool HexToHash( std::string_view hex, Hash &hash ) noexcept;
+   // How a result is printed. Hashes from versions other than the first are
+   //  tagged with the version, so they can't be mistaken for each other.
+   std::string ResultToString( Hash hash ) noexcept;
 
 } /////////////////////////////////////////////////////////////////////////////
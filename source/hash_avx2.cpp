@@ -0,0 +1,36 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+// This file alone is built with AVX2 enabled (see premake5.lua), so xxh3
+//  picks its AVX2 loop here. Nothing in here may run until the CPU has been
+//  checked, and nothing with external linkage other than GetAvx2Xxh3 may be
+//  defined here, or the linker could hand AVX2 code to the rest of the
+//  program.
+#include "hash/xxh3.h"
+
+#include <cstddef>
+#include <cstdint>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+using Xxh3Function = uint64_t (*)( const void*, size_t, uint64_t ) noexcept;
+
+#if defined(__AVX2__)
+//-----------------------------------------------------------------------------
+static uint64_t Xxh3Avx2( const void *data, size_t len,
+                          uint64_t seed ) noexcept {
+   return XXH3_64bits_withSeed( data, len, seed );
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// Null if this build doesn't have an AVX2 version.
+Xxh3Function GetAvx2Xxh3() noexcept {
+#if defined(__AVX2__)
+   return Xxh3Avx2;
+#else
+   return nullptr;
+#endif
+}
+
+} /////////////////////////////////////////////////////////////////////////////
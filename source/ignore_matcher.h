@@ -0,0 +1,110 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+// The ignore list, compiled. An ignore matches an entry if it's the entry's
+//  name, or the entry's whole path as it's hashed.
+//
+// Names without a slash go in a hash set. Paths are split at each slash into
+//  a trie, and every directory that's scanned carries its node in the trie,
+//  taken from its parent's with Child. That's null once no ignored path goes
+//  through the directory, which is nearly everywhere. Either way, checking
+//  an entry is at most two lookups, however many ignores there are.
+//
+// Read-only while scanning, so it can be shared between threads.
+class IgnoreMatcher {
+//-----------------------------------------------------------------------------
+public:
+   struct Node {
+      std::unordered_map<std::string_view, std::unique_ptr<Node>> children;
+      // True if the path that ends here is ignored.
+      bool ignored = false;
+   };
+
+private:
+   // Strings are owned here, and everything else holds views into them.
+   std::deque<std::string> m_strings;
+   std::unordered_set<std::string_view> m_names;
+   Node m_root;
+   bool m_empty = true;
+
+public:
+   //--------------------------------------------------------------------------
+   void Clear() noexcept {
+      m_names.clear();
+      m_root.children.clear();
+      m_strings.clear();
+      m_empty = true;
+   }
+
+   //--------------------------------------------------------------------------
+   void Add( std::string_view ignore ) noexcept {
+      m_empty = false;
+      std::string_view str = m_strings.emplace_back( ignore );
+      if( str.find( '/' ) == str.npos ) {
+         m_names.insert( str );
+         return;
+      }
+
+      // Empty pieces are kept, so that "/a" and "a//b" only match paths
+      //  that are exactly that.
+      Node *node = &m_root;
+      for(;;) {
+         size_t slash = str.find( '/' );
+         auto &child = node->children[str.substr( 0, slash )];
+         if( !child ) child = std::make_unique<Node>();
+         node = child.get();
+         if( slash == str.npos ) break;
+         str.remove_prefix( slash + 1 );
+      }
+      node->ignored = true;
+   }
+
+   //--------------------------------------------------------------------------
+   bool Empty() const noexcept { return m_empty; }
+
+   //--------------------------------------------------------------------------
+   // The node of the entry `name` in the directory with `dir`.
+   const Node *Child( const Node *dir, std::string_view name ) const noexcept {
+      if( !dir ) return nullptr;
+      auto it = dir->children.find( name );
+      if( it == dir->children.end() ) return nullptr;
+      return it->second.get();
+   }
+
+   //--------------------------------------------------------------------------
+   // The node of the directory `path`, which ends with a slash. That's the
+   //  form the scanners keep directory paths in.
+   const Node *Find( std::string_view path ) const noexcept {
+      const Node *node = &m_root;
+      for( size_t slash; node && (slash = path.find( '/' )) != path.npos; ) {
+         node = Child( node, path.substr( 0, slash ));
+         path.remove_prefix( slash + 1 );
+      }
+      return node;
+   }
+
+   //--------------------------------------------------------------------------
+   // True if the entry `name` in the directory with `dir` is ignored.
+   bool IsIgnored( const Node *dir, std::string_view name ) const noexcept {
+      if( m_empty ) return false;
+      if( m_names.find( name ) != m_names.end() ) return true;
+      const Node *node = Child( dir, name );
+      return node && node->ignored;
+   }
+};
+
+using IgnoreNode = IgnoreMatcher::Node;
+
+} /////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,399 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+// Linux only.
+#ifdef TARGET_LINUX
+
+#include "dir_cache.h"
+#include "filter_expression.h"
+#include "markers.h"
+#include "options.h"
+#include "visited_set.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/magic.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// Low level directory reading shared by the Linux scanners.
+namespace Treehash::LinuxDir {
+
+//-----------------------------------------------------------------------------
+// Size of the buffers handed to getdents64.
+constexpr int DIRBUFSIZE = 64 * 1024;
+
+//-----------------------------------------------------------------------------
+// Relative paths handed to the kernel are kept under this, well inside of
+//  PATH_MAX, leaving room for a name and a marker file on the end.
+constexpr size_t REACH = 2048;
+
+//-----------------------------------------------------------------------------
+// The layout that the kernel writes for getdents64. glibc doesn't expose
+//  this under a stable name, so we mirror it here.
+struct Dirent64 {
+   ino64_t        d_ino;
+   off64_t        d_off;
+   unsigned short d_reclen;
+   unsigned char  d_type;
+   char           d_name[];
+};
+
+//-----------------------------------------------------------------------------
+// Fills `buffer` with records for the open directory `fd`. Returns the number
+//  of bytes written, 0 at the end of the directory, or -1 on error.
+inline long ReadEntries( int fd, char *buffer, int size ) noexcept {
+   return syscall( SYS_getdents64, fd, buffer, size );
+}
+
+//-----------------------------------------------------------------------------
+// Returns 'd' for directories, 'f' for regular files, 0 for anything else,
+//  or '?' if d_type doesn't tell us and we need to stat the entry.
+inline char EntryType( const Dirent64 *entry ) noexcept {
+   switch( entry->d_type ) {
+   case DT_DIR: return 'd';
+   case DT_REG: return 'f';
+   case DT_LNK:
+   case DT_UNKNOWN: return '?';
+   default: return 0;
+   }
+}
+
+//-----------------------------------------------------------------------------
+// Reads the mode of `name` in `dirfd` into `mode`. We only ask for the file
+//  type, and tell network filesystems not to revalidate their attribute
+//  caches for it. An automount point isn't mounted just to find out that
+//  it's a directory.
+inline bool StatMode( int dirfd, const char *name, int flags,
+                      mode_t &mode ) noexcept {
+   flags |= AT_NO_AUTOMOUNT;
+   struct statx stx;
+   if( statx( dirfd, name, flags | AT_STATX_DONT_SYNC, STATX_TYPE,
+              &stx ) != 0 ) {
+      if( errno != ENOSYS ) return false;
+      // Kernels older than 4.11.
+      struct stat st;
+      if( fstatat( dirfd, name, &st, flags ) != 0 ) return false;
+      stx.stx_mode = st.st_mode;
+   }
+   mode = stx.stx_mode;
+   return true;
+}
+
+//-----------------------------------------------------------------------------
+// Classifies an entry the slow way. A symlink is neither, unless `follow` is
+//  set, in which case it's whatever it points at. `link` is set if the entry
+//  is a symlink. That's known from d_type for DT_LNK, and asked for first
+//  otherwise, so a DT_UNKNOWN directory isn't taken for a link to one.
+inline char StatType( int dirfd, const Dirent64 *entry, bool follow,
+                      bool &link ) noexcept {
+   mode_t mode;
+   link = entry->d_type == DT_LNK;
+   if( !link ) {
+      if( !StatMode( dirfd, entry->d_name, AT_SYMLINK_NOFOLLOW, mode ))
+         return 0;
+      link = S_ISLNK( mode );
+   }
+   if( link ) {
+      if( !follow ) return 0;
+      if( !StatMode( dirfd, entry->d_name, 0, mode )) return 0;
+   }
+   if( S_ISDIR( mode )) return 'd';
+   if( S_ISREG( mode )) return 'f';
+   return 0;
+}
+
+//-----------------------------------------------------------------------------
+// True if the directory at the end of `path` has one of the Markers in it.
+//  It's relative to `dirfd` from `start` on, and ends with a slash. `path`
+//  is put back the way it was.
+inline bool IsMarked( int dirfd, std::string &path, size_t start ) noexcept {
+   size_t length = path.size();
+   path.append( Markers::STOP_FILE );
+   bool marked = faccessat( dirfd, path.c_str() + start, F_OK, 0 ) == 0;
+   if( !marked ) {
+      path.resize( length );
+      path.append( Markers::CACHEDIR_TAG );
+      int fd = openat( dirfd, path.c_str() + start,
+                       O_RDONLY | O_CLOEXEC | O_NONBLOCK );
+      if( fd >= 0 ) {
+         char head[64];
+         ssize_t nread = read( fd, head, Markers::CACHEDIR_SIGNATURE.size() );
+         close( fd );
+         marked = nread > 0 && std::string_view( head, nread )
+                               == Markers::CACHEDIR_SIGNATURE;
+      }
+   }
+   path.resize( length );
+   return marked;
+}
+
+//-----------------------------------------------------------------------------
+// Fetches what a filter expression needs to know about a file, following
+//  symlinks. `needs` is from FilterExpression::Needs.
+inline bool StatFile( int dirfd, const char *name, unsigned needs,
+                      FileMeta &meta ) noexcept {
+   unsigned mask = 0;
+   if( needs & FilterExpression::NEED_SIZE )  mask |= STATX_SIZE;
+   if( needs & FilterExpression::NEED_MTIME ) mask |= STATX_MTIME;
+   if( needs & FilterExpression::NEED_MODE )  mask |= STATX_MODE;
+   struct statx stx;
+   if( statx( dirfd, name, AT_STATX_DONT_SYNC, mask, &stx ) != 0 ) {
+      if( errno != ENOSYS ) return false;
+      // Kernels older than 4.11.
+      struct stat st;
+      if( fstatat( dirfd, name, &st, 0 ) != 0 ) return false;
+      stx.stx_size = st.st_size;
+      stx.stx_mtime.tv_sec = st.st_mtim.tv_sec;
+      stx.stx_mtime.tv_nsec = st.st_mtim.tv_nsec;
+      stx.stx_mode = st.st_mode;
+   }
+   meta.size     = stx.stx_size;
+   meta.mtime_ns = stx.stx_mtime.tv_sec * 1'000'000'000LL
+                 + stx.stx_mtime.tv_nsec;
+   meta.mode     = stx.stx_mode & 07777;
+   return true;
+}
+
+//-----------------------------------------------------------------------------
+// Fetches what the directory cache needs to know about a directory. `name`
+//  is relative to `dirfd`, or empty with `dirfd` being the directory itself.
+inline bool StatDirectory( int dirfd, const char *name, bool follow,
+                           DirStamp &stamp ) noexcept {
+   int flags = follow ? 0 : AT_SYMLINK_NOFOLLOW;
+   if( name[0] == 0 ) flags |= AT_EMPTY_PATH;
+   struct statx stx;
+   if( statx( dirfd, name, flags, STATX_TYPE | STATX_INO | STATX_MTIME
+                                             | STATX_CTIME, &stx ) != 0 ) {
+      return false;
+   }
+   if( !S_ISDIR( stx.stx_mode )) return false;
+   stamp.dev      = makedev( stx.stx_dev_major, stx.stx_dev_minor );
+   stamp.ino      = stx.stx_ino;
+   stamp.mtime_ns = stx.stx_mtime.tv_sec * 1'000'000'000LL
+                  + stx.stx_mtime.tv_nsec;
+   stamp.ctime_ns = stx.stx_ctime.tv_sec * 1'000'000'000LL
+                  + stx.stx_ctime.tv_nsec;
+   return true;
+}
+
+//-----------------------------------------------------------------------------
+// Looks up the DirId of the directory `name`, relative to `dirfd`, following
+//  symlinks. With an empty `name`, it's `dirfd` itself.
+inline bool DirectoryId( int dirfd, const char *name, DirId &id ) noexcept {
+   struct stat st;
+   if( fstatat( dirfd, name, &st, name[0] ? AT_NO_AUTOMOUNT
+                                          : AT_EMPTY_PATH ) != 0 )
+      return false;
+   id = { (uint64_t)st.st_dev, (uint64_t)st.st_ino };
+   return true;
+}
+
+//-----------------------------------------------------------------------------
+// With --one-file-system or --skip-fs, returns why the subdirectory `name`
+//  of `dirfd` is left out for being a mount point, or null if it isn't one
+//  or it can stay. `dev` is the device of `dirfd`, and `follow` is set if
+//  `name` is a symlink. Nothing under `name` is looked at, so an automount
+//  point that isn't mounted yet stays that way, and counts as autofs.
+inline const char *SkipsMount( int dirfd, const char *name, bool follow,
+                               uint64_t dev ) noexcept {
+   int flags = AT_NO_AUTOMOUNT | (follow ? 0 : AT_SYMLINK_NOFOLLOW);
+   uint64_t its_dev;
+   bool automount = false;
+   struct statx stx;
+   if( statx( dirfd, name, flags | AT_STATX_DONT_SYNC, STATX_TYPE,
+              &stx ) == 0 ) {
+      its_dev = makedev( stx.stx_dev_major, stx.stx_dev_minor );
+      automount = stx.stx_attributes_mask & stx.stx_attributes
+                  & STATX_ATTR_AUTOMOUNT;
+   } else {
+      if( errno != ENOSYS ) return nullptr;
+      // Kernels older than 4.11.
+      struct stat st;
+      if( fstatat( dirfd, name, &st, flags ) != 0 ) return nullptr;
+      its_dev = st.st_dev;
+   }
+   if( its_dev == dev && !automount ) return nullptr;
+   if( opt_one_file_system )
+      return automount ? "automount point" : "other filesystem";
+
+   uint32_t type = AUTOFS_SUPER_MAGIC;
+   if( !automount ) {
+      // Without O_DIRECTORY, this doesn't set off an automount either.
+      int fd = openat( dirfd, name, O_PATH | O_CLOEXEC
+                                    | (follow ? 0 : O_NOFOLLOW) );
+      struct statfs fs;
+      bool known = fd >= 0 && fstatfs( fd, &fs ) == 0;
+      if( fd >= 0 ) close( fd );
+      if( !known ) return nullptr;
+      type = (uint32_t)fs.f_type;
+   }
+   if( std::find( opt_skip_fs.begin(), opt_skip_fs.end(), type )
+          == opt_skip_fs.end() )
+      return nullptr;
+   return "skipped filesystem type";
+}
+
+//-----------------------------------------------------------------------------
+// The DirIds of the directories in `path`, from "/" down to the last one, as
+//  the path goes, so through any symlinks in it. Each one is opened
+//  relative to the last, so the length doesn't matter.
+inline void PathIds( const std::string &path,
+                     std::vector<DirId> &ids ) noexcept {
+   int flags = O_PATH | O_DIRECTORY | O_CLOEXEC;
+   ids.clear();
+   int at = open( path[0] == '/' ? "/" : ".", flags );
+   std::string name;
+   for( size_t start = 0; at >= 0; ) {
+      DirId id;
+      if( !DirectoryId( at, "", id )) break;
+      ids.push_back( id );
+      while( start < path.size() && path[start] == '/' ) start++;
+      if( start == path.size() ) break;
+      size_t end = std::min( path.find( '/', start ), path.size() );
+      name.assign( path, start, end - start );
+      start = end;
+      int next = openat( at, name.c_str(), flags );
+      close( at );
+      at = next;
+   }
+   if( at >= 0 ) close( at );
+}
+
+//-----------------------------------------------------------------------------
+// True if the open directory `fd` is one of `dirs`, or somewhere under one.
+//  This goes up through "..", so it's where `fd` really is that counts, and
+//  not the path that it was opened by.
+inline bool IsInside( int fd, const std::vector<DirId> &dirs ) noexcept {
+   DirId id;
+   if( !DirectoryId( fd, "", id )) return false;
+   int at = fd;
+   bool inside = false;
+   for(;;) {
+      if( std::find( dirs.begin(), dirs.end(), id ) != dirs.end() ) {
+         inside = true;
+         break;
+      }
+      int up = openat( at, "..", O_PATH | O_DIRECTORY | O_CLOEXEC );
+      if( at != fd ) close( at );
+      at = up;
+      DirId up_id;
+      // ".." of "/" is itself.
+      if( up < 0 || !DirectoryId( up, "", up_id ) || up_id == id ) break;
+      id = up_id;
+   }
+   if( at >= 0 && at != fd ) close( at );
+   return inside;
+}
+
+//-----------------------------------------------------------------------------
+// Opens a directory entry for scanning, relative to the directory that
+//  contains it. Directories are opened with O_NOFOLLOW; only entries that
+//  were symlinks to begin with are followed.
+inline int OpenDirectory( int dirfd, const char *name, bool follow ) noexcept {
+   int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+   if( !follow ) flags |= O_NOFOLLOW;
+   return openat( dirfd, name, flags );
+}
+
+//-----------------------------------------------------------------------------
+// Called with the errno of a directory `path` that couldn't be opened. One
+//  that's gone or that we aren't allowed into is left out, as it always has
+//  been. Anything else, like running out of descriptors, would leave a hole
+//  in the hash that nobody sees, so the scan stops with an error instead.
+inline void CheckOpenError( std::string_view path, int error ) noexcept {
+   if( error == ENOENT || error == ENOTDIR || error == EACCES
+                       || error == EPERM || error == ELOOP )
+      return;
+   std::cout << "Couldn't open " << path << ": " << strerror( error ) << "\n";
+   std::cout.flush();
+   std::_Exit( opt_diff_file.empty() && opt_verify_file.empty() ? 1 : 2 );
+}
+
+//-----------------------------------------------------------------------------
+// Called with the errno of a directory `path` that couldn't be read, or
+//  couldn't be seeked back to where it was after being opened again. One
+//  that was deleted while it was being read has just ended. Anything else
+//  stops the scan, like in CheckOpenError.
+inline void CheckReadError( std::string_view path, int error ) noexcept {
+   if( error == ENOENT ) return;
+   std::cout << "Couldn't read " << path << ": " << strerror( error ) << "\n";
+   std::cout.flush();
+   std::_Exit( opt_diff_file.empty() && opt_verify_file.empty() ? 1 : 2 );
+}
+
+//-----------------------------------------------------------------------------
+// True if the subdirectory `name` of `dirfd`, at `path`, can be opened. A
+//  scan leaves one that can't out of the manifest, so listings that are
+//  checked against it do too. Errors are checked with CheckOpenError.
+inline bool CanOpen( int dirfd, const char *name, bool follow,
+                     std::string_view path ) noexcept {
+   int fd = OpenDirectory( dirfd, name, follow );
+   if( fd < 0 ) {
+      CheckOpenError( path, errno );
+      return false;
+   }
+   close( fd );
+   return true;
+}
+
+//-----------------------------------------------------------------------------
+// Opens the directory `path`, which may be longer than open takes. Long ones
+//  are opened a piece of up to `reach` at a time, each relative to the last.
+inline int OpenPath( std::string &path, size_t reach ) noexcept {
+   int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+   int at = AT_FDCWD;
+   size_t from = 0;
+   while( path.size() - from > reach ) {
+      // Not at a trailing slash, which would leave nothing after it.
+      size_t slash = path.rfind( '/', std::min( from + reach,
+                                                path.size() - 2 ));
+      if( slash == path.npos || slash <= from ) break;
+      path[slash] = 0;
+      int next = openat( at, path.c_str() + from, flags );
+      path[slash] = '/';
+      if( at != AT_FDCWD ) close( at );
+      if( next < 0 ) return -1;
+      at = next;
+      from = slash + 1;
+   }
+   int fd = openat( at, path.c_str() + from, flags );
+   if( at != AT_FDCWD ) close( at );
+   return fd;
+}
+
+//-----------------------------------------------------------------------------
+// Appends the contents of the file `name`, relative to `dirfd`, to `text`.
+//  Returns false if there's no such file.
+inline bool ReadFile( int dirfd, const char *name,
+                      std::string &text ) noexcept {
+   // Non-blocking, so that a FIFO by that name can't hang us.
+   int fd = openat( dirfd, name, O_RDONLY | O_CLOEXEC | O_NONBLOCK );
+   if( fd < 0 ) return false;
+   char buffer[4096];
+   for(;;) {
+      ssize_t nread = read( fd, buffer, sizeof buffer );
+      if( nread <= 0 ) break;
+      text.append( buffer, nread );
+   }
+   close( fd );
+   return true;
+}
+
+} /////////////////////////////////////////////////////////////////////////////
+
+#endif // TARGET_LINUX
@@ -0,0 +1,1059 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+// Linux only.
+#ifdef TARGET_LINUX
+
+#include "hash.h"
+#include "scanner.h"
+#include "options.h"
+#include "name_filter.h"
+#include "linux_dir.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+// A Linux directory scanner that reads directories with getdents64 directly.
+// Like the fastwin scanner, the path is built in-place in one buffer as we
+//  traverse the tree, so there are no allocations per entry. The hashes
+//  produced are the same as the default scanner's.
+// Directories are opened relative to their parent's descriptor, so the kernel
+//  only resolves one path component per open, and the path string is only
+//  used for hashing. That also means there is no limit on path length.
+// There's no recursion. The directories on the way down are on a stack of
+//  frames, and only --max-open of them are open at a time, so neither the
+//  C++ stack nor the descriptors run out in a tree that goes very deep.
+// The loop over a directory's entries is a template, so the checks that are
+//  settled before the scan starts aren't made for every entry. VERBOSE is
+//  picked by CreateScanner, and ReadFrame is instantiated for recursion and
+//  for whether there are extensions or ignores to check.
+template< bool VERBOSE >
+class LinuxScanner : public Scanner {
+//-----------------------------------------------------------------------------
+   // Initial capacity of the path buffer. It grows if we go deeper than this.
+   static constexpr int PATHSIZE = 4096;
+   //--------------------------------------------------------------------------
+   NameFilter m_filter;
+   //--------------------------------------------------------------------------
+   // A directory on the way down to the one being scanned. The stack of these
+   //  takes the place of recursion, so a deep tree only costs a frame for
+   //  each level. Directories that are read hold a descriptor and a
+   //  getdents64 buffer, but only while they're among the --max-open
+   //  nearest the top. The rest are closed, and read on from `offset` once
+   //  they're opened again.
+   struct Frame {
+      // -1 if it isn't open.
+      int fd = -1;
+      // Length of `m_current_path` for this directory, with its trailing
+      //  slash.
+      size_t path_start = 0;
+      // How far below the root it is.
+      int level = 0;
+      // True if it's opened through a symlink.
+      bool follow = false;
+      // True if it or a directory above it was opened through a symlink.
+      bool linked = false;
+      // Its DirId, once `id_known` is set, which is only needed when
+      //  symlinks are followed. Frames that are closed have it.
+      DirId id;
+      bool id_known = false;
+      // Descends( level ), which picks the version of ReadFrame.
+      bool recursive = false;
+      Hash seed = 0;
+      const IgnoreNode *ignore = nullptr;
+      const GlobState *glob = nullptr;
+      GitFramePtr git;
+      // The hash so far, with the subdirectories that are done.
+      Hash hash = 0;
+      // Set for cache hits, which aren't read. `next` is the subdirectory to
+      //  go into next.
+      DirEntryPtr cached;
+      size_t next = 0;
+      // What's found in a directory that's read goes into `record`, which is
+      //  kept if `keep` is set. It's stored in the cache if `stamped` is.
+      bool keep = false;
+      bool stamped = false;
+      DirCacheEntry record;
+      // Records left in the buffer are between `bpos` and `nread`.
+      std::unique_ptr<char[]> buffer;
+      long bpos = 0;
+      long nread = 0;
+      // The d_off of the last record taken.
+      off64_t offset = 0;
+   };
+   std::vector<Frame> m_frames;
+   //--------------------------------------------------------------------------
+   // getdents64 buffers that no frame is using. There's at most one for each
+   //  open directory, and they're reused from one to the next.
+   std::vector<std::unique_ptr<char[]>> m_dirbufs;
+   //--------------------------------------------------------------------------
+   // How many frames are open, and the first one above the root that might
+   //  be. The ones in between are all closed.
+   int m_open = 0;
+   size_t m_first_open = 1;
+   //--------------------------------------------------------------------------
+   static constexpr size_t REACH = LinuxDir::REACH;
+   //--------------------------------------------------------------------------
+   // When symlinks are followed, the DirIds of the directories in the root's
+   //  path, down to the root, from PathIds. They're looked up when they're
+   //  first needed. The root's hashed path is `m_root_length` long.
+   std::vector<DirId> m_above;
+   bool m_above_known = false;
+   size_t m_root_length = 0;
+   // The directories read under this root with --symlinks once, the root's
+   //  DirId, and scratch space for Revisits.
+   std::unique_ptr<VisitedSet> m_visited;
+   DirId m_root_id;
+   std::vector<DirId> m_tops;
+   //--------------------------------------------------------------------------
+   // With --symlinks once, which of two links to the same directory gets to
+   //  read it can't depend on which is found first, since that's up to the
+   //  order of the entries, and with -j, the workers. So links to
+   //  directories aren't gone into when they're found. They wait here, by
+   //  their path, until the rest of the root is done, and are then taken
+   //  one at a time from the smallest path. The fields are the ones of the
+   //  directory that the link is in, and `tops` has the DirIds of the links
+   //  on the way down to it, for Revisits.
+   struct DeferredLink {
+      size_t parent_start;
+      int level;
+      bool linked;
+      Hash seed;
+      const IgnoreNode *ignore;
+      const GlobState *glob;
+      GitFramePtr git;
+      std::vector<DirId> tops;
+   };
+   std::map<std::string, DeferredLink> m_deferred;
+   // Set while RunDeferred goes into one of them. That link is the only
+   //  subdirectory of the bottom frame, and isn't put off again. Its `tops`
+   //  are kept here.
+   bool m_replaying = false;
+   std::vector<DirId> m_replay_tops;
+   // Mount points left out with --one-file-system or --skip-fs.
+   std::vector<std::string> m_mounts;
+   // With --deadline, the path of the directory on top of the stack, for
+   //  GetUnfinished. It's empty between roots.
+   mutable std::mutex m_where_mutex;
+   std::string m_where;
+   //--------------------------------------------------------------------------
+   // We work on the path variable in-place as we traverse the tree. Only
+   //  the hashing and the full-path ignores read this.
+   std::string m_current_path;
+   //--------------------------------------------------------------------------
+   // Files waiting to be hashed. The names point into a getdents64 buffer,
+   //  so this is emptied before the buffer is refilled, and before going
+   //  into a subdirectory, which uses the batch too.
+   NameBatch m_batch;
+   //--------------------------------------------------------------------------
+   // True if this is a recursive search.
+   bool m_recursive;
+   //--------------------------------------------------------------------------
+   // Counters for diagnostics.
+   ScanStats m_stats;
+
+   //--------------------------------------------------------------------------
+   // Optional cache of directory contents from earlier runs.
+   DirCache *m_cache = nullptr;
+   // Optional manifest that every directory is added to.
+   Manifest *m_manifest = nullptr;
+   // Set if .gitignore files are honoured.
+   GitIgnore *m_gitignore = nullptr;
+   // Optional filter on the files' metadata.
+   const FilterExpression *m_expr = nullptr;
+   //--------------------------------------------------------------------------
+   // Set while ReadDirectory is working. Subdirectories aren't scanned, and
+   //  what we find goes here instead of into the cache or the manifest.
+   DirCacheEntry *m_listing = nullptr;
+   //--------------------------------------------------------------------------
+   // The versions of ReadFrame for the filters we have, from SelectScan. One
+   //  is for directories whose subdirectories are scanned too, and the other
+   //  is for ones whose aren't.
+   using ScanFunction = bool (LinuxScanner::*)( size_t );
+   ScanFunction m_scan_recursive = nullptr;
+   ScanFunction m_scan_flat = nullptr;
+
+   //--------------------------------------------------------------------------
+   // Reads on through the open directory of the frame at `index`, which is on
+   //  top. Returns true when it pushes a frame for a subdirectory, which is
+   //  done before this goes on, or false when the directory is done. What we
+   //  find is added to the frame's hash and record. RECURSIVE is the frame's
+   //  `recursive`. Called through Run, which picks the right version.
+   template< bool RECURSIVE, bool EXTS, bool IGNORES >
+   bool ReadFrame( size_t index ) noexcept {
+      using namespace LinuxDir;
+      // The stack may move when a frame is pushed.
+      Frame *frame = &m_frames[index];
+      size_t path_start = frame->path_start;
+      const IgnoreNode *ignore = frame->ignore;
+      const GlobState *glob = frame->glob;
+      const GitIgnoreFrame *git = frame->git.get();
+      auto hash_batch = [&]() {
+         if( m_batch.count == 0 ) return;
+         Hash files = HashBatch( m_batch,
+                  std::string_view( m_current_path ).substr( 0, path_start ),
+                  frame->seed );
+         frame->hash ^= files;
+         frame->record.files ^= files;
+      };
+
+      for(;;) {
+         if( frame->bpos == frame->nread ) {
+            hash_batch();
+            frame->bpos = 0;
+            frame->nread = ReadEntries( frame->fd, frame->buffer.get(),
+                                        DIRBUFSIZE );
+            if( frame->nread <= 0 ) {
+               if( frame->nread < 0 ) {
+                  CheckReadError( std::string_view( m_current_path )
+                                  .substr( 0, path_start ), errno );
+               }
+               frame->nread = 0;
+               return false;
+            }
+         }
+
+         int fd = frame->fd;
+         auto *entry = reinterpret_cast<Dirent64*>( frame->buffer.get()
+                                                    + frame->bpos );
+         frame->bpos += entry->d_reclen;
+         frame->offset = entry->d_off;
+
+         // This also takes care of "." and "..".
+         if( entry->d_name[0] == '.' ) continue;
+
+         m_current_path.resize( path_start );
+         m_current_path.append( entry->d_name );
+         m_stats.entries++;
+
+         char type = EntryType( entry );
+         bool link = false;
+         if( type == '?' ) {
+            if( entry->d_type == DT_LNK && opt_symlinks == Symlinks::SKIP )
+               continue;
+            // In verbose mode, excluded files are listed, so we need to
+            //  know what they are.
+            if constexpr( !VERBOSE ) {
+               if( m_filter.IsExcludedByName<EXTS, IGNORES>(
+                       m_current_path, path_start, RECURSIVE, ignore ))
+                  continue;
+            }
+            m_stats.stats++;
+            type = StatType( fd, entry, opt_symlinks != Symlinks::SKIP, link );
+         }
+
+         std::string_view name = std::string_view( m_current_path )
+                                    .substr( path_start );
+         if( type == 'd' && RECURSIVE ) {
+            if( m_filter.IsExcluded<false, IGNORES>( m_current_path,
+                                                    path_start, true,
+                                                    ignore ))
+               continue;
+            const GlobState *child_glob = GlobMatcher::Child( glob, name );
+            if( GlobMatcher::Skip( child_glob )) continue;
+            // Pruned here, so an ignored directory is never opened.
+            if( git && GitIgnore::IsIgnored( git, m_current_path,
+                                             path_start, true ))
+               continue;
+            m_current_path.push_back( '/' );
+            bool follow = link;
+            // Before the marker is looked for, which would go past it.
+            bool mount = ChecksMounts()
+                         && SkipsMount( FrameId( index ).dev, fd, path_start,
+                                        follow );
+            bool marked = !mount && opt_skip_marked
+                          && IsMarked( fd, m_current_path, path_start );
+            // Marked ones stay in the cache, so that taking the marker out
+            //  is noticed. Cache hits check them again. So do mount points,
+            //  links back up, and ones that can't be opened. They're only
+            //  left out of listings.
+            bool dropped = m_listing && (mount || marked || (follow
+                              && LinksBack( index, fd, entry->d_name ))
+                              || !CanOpen( fd, entry->d_name, follow,
+                                           m_current_path ));
+            if( frame->keep && !dropped )
+               frame->record.subdirs.push_back({ entry->d_name, follow });
+            if( m_listing || marked || mount ) {
+               if constexpr( VERBOSE ) {
+                  if( marked )
+                     std::cout << " - " << m_current_path << " (marked)\n";
+               }
+               continue;
+            }
+            hash_batch();
+            // The path may have moved when the slash was added.
+            name = std::string_view( m_current_path ).substr( path_start,
+                                                              name.size() );
+            Hash child_seed = SubdirectorySeed( frame->seed, name );
+            const IgnoreNode *child_ignore = m_filter.IgnoreChild( ignore,
+                                                                   name );
+            if( PushChild( index, follow, child_seed, child_ignore,
+                           child_glob ))
+               return true;
+            frame = &m_frames[index];
+         } else if( type == 'f' ) {
+            if( m_filter.IsExcluded<EXTS, IGNORES>( m_current_path,
+                                                   path_start, false,
+                                                   ignore )
+                  || !GlobMatcher::MatchFile( glob, name )
+                  || (git && GitIgnore::IsIgnored( git, m_current_path,
+                                                   path_start, false ))
+                  || (m_expr && !MatchExpression( fd, entry, name, link ))) {
+               if constexpr( VERBOSE )
+                  std::cout << "   " << m_current_path << "\n";
+               continue;
+            }
+
+            if( m_batch.Full() ) hash_batch();
+            m_batch.Add({ entry->d_name, name.size() });
+            if( m_manifest ) {
+               frame->record.names.append( entry->d_name, name.size() + 1 );
+            }
+
+            if constexpr( VERBOSE )
+               std::cout << " * " << m_current_path << "\n";
+         }
+      }
+   }
+
+   //--------------------------------------------------------------------------
+   // Keeps what was found in the directory of `frame`, which is done.
+   void Record( Frame &frame ) noexcept {
+      DirCacheEntry &record = frame.record;
+      record.filter = FilterKey( frame.glob, frame.git.get() );
+      record.recursive = frame.recursive;
+      if( m_listing ) {
+         if( m_cache ) m_stats.cache_misses++;
+         *m_listing = std::move( record );
+      } else if( frame.keep ) {
+         record.named = m_manifest != nullptr;
+         auto ptr = std::make_shared<const DirCacheEntry>( std::move( record ));
+         std::string path = m_current_path.substr( 0, frame.path_start );
+         if( m_manifest ) m_manifest->Add( path, ptr );
+         if( frame.stamped ) {
+            m_stats.cache_misses++;
+            m_cache->Store( std::move( path ), std::move( ptr ));
+         }
+      }
+   }
+
+   //--------------------------------------------------------------------------
+   // Checks a file in the open directory `fd` against the filter expression,
+   //  only statting it if its name and type don't settle it. `link` is set
+   //  if the entry is a symlink.
+   bool MatchExpression( int fd, const LinuxDir::Dirent64 *entry,
+                         std::string_view name, bool link ) noexcept {
+      int match = m_expr->MatchName( name, link );
+      if( match >= 0 ) return match > 0;
+      m_stats.stats++;
+      FileMeta meta;
+      if( !LinuxDir::StatFile( fd, entry->d_name, m_expr->Needs(), meta ))
+         return false;
+      return m_expr->Match( name, link, meta );
+   }
+
+   //--------------------------------------------------------------------------
+   // Counts a cache hit for the directory in `m_current_path`.
+   void CacheHit( const DirEntryPtr &cached ) noexcept {
+      m_stats.cache_hits++;
+      if constexpr( VERBOSE )
+         std::cout << " = " << m_current_path << " (cached)\n";
+      if( m_manifest ) m_manifest->Add( m_current_path, cached );
+   }
+
+   //--------------------------------------------------------------------------
+   // Pushes a frame for the directory in `m_current_path`, which ends with a
+   //  slash. `fd` is its descriptor, which the frame takes, or -1 for a
+   //  cache hit, which is `cached`. If `stamp` is given, what we find is
+   //  recorded in the cache. It's also recorded in the manifest, if there is
+   //  one. `seed` is the directory's DirectorySeed, `ignore` is its
+   //  IgnoreNode, `glob` is its GlobState, and `git` is its GitIgnore frame.
+   void PushFrame( int fd, int level, bool follow, Hash seed,
+                   const IgnoreNode *ignore, const GlobState *glob,
+                   GitFramePtr git, DirEntryPtr cached,
+                   const DirStamp *stamp ) noexcept {
+      Frame &frame = m_frames.emplace_back();
+      frame.path_start = m_current_path.size();
+      frame.level = level;
+      frame.follow = follow;
+      frame.recursive = Descends( level );
+      frame.seed = seed;
+      frame.ignore = ignore;
+      frame.glob = glob;
+      frame.git = std::move( git );
+      if( const DirStamp *known = cached ? &cached->stamp : stamp ) {
+         frame.id = { known->dev, known->ino };
+         frame.id_known = true;
+      }
+      if( cached ) {
+         frame.hash = cached->files;
+         frame.cached = std::move( cached );
+      } else {
+         frame.keep = stamp || m_manifest || m_listing;
+         frame.stamped = stamp != nullptr;
+         if( stamp ) frame.record.stamp = *stamp;
+      }
+      if( fd >= 0 ) {
+         frame.fd = fd;
+         m_open++;
+         if( !frame.cached ) frame.buffer = TakeBuffer();
+         MakeRoom();
+      }
+   }
+
+   //--------------------------------------------------------------------------
+   std::unique_ptr<char[]> TakeBuffer() noexcept {
+      if( m_dirbufs.empty() ) {
+         return std::unique_ptr<char[]>( new char[LinuxDir::DIRBUFSIZE] );
+      }
+      std::unique_ptr<char[]> buffer = std::move( m_dirbufs.back() );
+      m_dirbufs.pop_back();
+      return buffer;
+   }
+
+   //--------------------------------------------------------------------------
+   // Closes the directory of `frame`. If it's being read, the records left in
+   //  its buffer are read again after it's opened.
+   void CloseFrame( Frame &frame ) noexcept {
+      close( frame.fd );
+      frame.fd = -1;
+      m_open--;
+      if( frame.buffer ) m_dirbufs.push_back( std::move( frame.buffer ));
+      frame.bpos = 0;
+      frame.nread = 0;
+   }
+
+   //--------------------------------------------------------------------------
+   // Closes the open frames furthest from the top until no more than
+   //  --max-open are left. The root stays open, and so do the two frames on
+   //  top, which are in use.
+   void MakeRoom() noexcept {
+      for( ; m_open > opt_max_open && m_first_open + 2 < m_frames.size();
+             m_first_open++ ) {
+         Frame &frame = m_frames[m_first_open];
+         if( frame.fd < 0 ) continue;
+         if( opt_symlinks != Symlinks::SKIP ) FrameId( m_first_open );
+         CloseFrame( frame );
+      }
+   }
+
+   //--------------------------------------------------------------------------
+   // The DirId of the frame at `index`.
+   const DirId &FrameId( size_t index ) noexcept {
+      Frame &frame = m_frames[index];
+      if( !frame.id_known ) {
+         LinuxDir::DirectoryId( frame.fd, "", frame.id );
+         frame.id_known = true;
+      }
+      return frame.id;
+   }
+
+   //--------------------------------------------------------------------------
+   // True if the directory `id` is the one of the frame at `index`, or one on
+   //  the way down to it, from "/". A symlink to it would go around forever.
+   bool IsAncestor( size_t index, const DirId &id ) noexcept {
+      if( !m_above_known ) {
+         std::string_view root = std::string_view( m_current_path )
+                                    .substr( 0, m_root_length );
+         LinuxDir::PathIds( BasePrefix( root ).append( root ), m_above );
+         m_above_known = true;
+      }
+      // That has the root.
+      if( std::find( m_above.begin(), m_above.end(), id ) != m_above.end() )
+         return true;
+      for( size_t i = 1; i <= index; i++ ) {
+         if( FrameId( i ) == id ) return true;
+      }
+      return false;
+   }
+
+   //--------------------------------------------------------------------------
+   // True if the subdirectory at the end of `m_current_path`, which ends
+   //  with a slash, is a mount point that's left out. It's looked up
+   //  relative to `at`, from `at_start` on. `dev` is the device of the
+   //  directory it's in, and `follow` is set if it's a symlink.
+   bool SkipsMount( uint64_t dev, int at, size_t at_start,
+                    bool follow ) noexcept {
+      char *slash = &m_current_path[m_current_path.size() - 1];
+      *slash = 0;
+      const char *reason = LinuxDir::SkipsMount(
+                              at, m_current_path.c_str() + at_start, follow,
+                              dev );
+      *slash = '/';
+      if( !reason ) return false;
+      if constexpr( VERBOSE )
+         std::cout << " - " << m_current_path << " (" << reason << ")\n";
+      m_mounts.push_back( m_current_path + " (" + reason + ")" );
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   // True if symlinks are followed and the subdirectory `name` of the open
+   //  directory of the frame at `index` is a link back up to it or above.
+   bool LinksBack( size_t index, int fd, const char *name ) noexcept {
+      DirId id;
+      return opt_symlinks != Symlinks::SKIP
+             && LinuxDir::DirectoryId( fd, name, id )
+             && IsAncestor( index, id );
+   }
+
+   //--------------------------------------------------------------------------
+   // Checks the directory `id`, a subdirectory of the frame at `parent`, at
+   //  `name` relative to `at`, which is left out if it's read somewhere else.
+   //  Only called for links to directories, and with --symlinks once, for
+   //  any directory under one. `follow` is set for links. Returns why it's
+   //  left out, or null if it isn't.
+   const char *Revisits( size_t parent, bool follow, const DirId &id,
+                         int at, const char *name ) noexcept {
+      if( follow && IsAncestor( parent, id )) return "symlink loop";
+      if( opt_symlinks != Symlinks::ONCE ) return nullptr;
+      if( follow ) {
+         // A link into the root, or into a directory that a link on the way
+         //  down goes to, is left for the directory's own path, which is the
+         //  same whichever order things are found in.
+         m_tops.assign( 1, m_root_id );
+         m_tops.insert( m_tops.end(), m_replay_tops.begin(),
+                        m_replay_tops.end() );
+         for( size_t i = 1; i <= parent; i++ ) {
+            if( m_frames[i].follow ) m_tops.push_back( FrameId( i ));
+         }
+         int fd = openat( at, name, O_PATH | O_DIRECTORY | O_CLOEXEC );
+         bool inside = fd >= 0 && LinuxDir::IsInside( fd, m_tops );
+         if( fd >= 0 ) close( fd );
+         if( inside ) return "read where it is";
+      }
+      if( !m_visited->Insert( id )) return "read already";
+      return nullptr;
+   }
+
+   //--------------------------------------------------------------------------
+   // Opens the directory of the frame at `index` again, relative to the
+   //  nearest open frame below it. The root is always open. When that's
+   //  further up than REACH, it goes in steps that end at the frames in
+   //  between. Returns false if it can't be opened, or read from where it
+   //  was left.
+   bool Reopen( size_t index ) noexcept {
+      size_t anchor = index;
+      while( m_frames[--anchor].fd < 0 ) {}
+      int at = m_frames[anchor].fd;
+      size_t from = m_frames[anchor].path_start;
+      int fd = -1;
+      for( size_t i = anchor + 1; i <= index; i++ ) {
+         if( i < index && m_frames[i + 1].path_start - from < REACH ) continue;
+         // Without the trailing slash, as in PushChild.
+         char *slash = &m_current_path[m_frames[i].path_start - 1];
+         *slash = 0;
+         int next = LinuxDir::OpenDirectory( at, m_current_path.c_str() + from,
+                                             m_frames[i].follow );
+         *slash = '/';
+         int error = errno;
+         if( fd >= 0 ) close( fd );
+         if( next < 0 ) {
+            LinuxDir::CheckOpenError( std::string_view( m_current_path )
+                                      .substr( 0, m_frames[i].path_start ),
+                                      error );
+            return false;
+         }
+         at = fd = next;
+         from = m_frames[i].path_start;
+      }
+
+      Frame &frame = m_frames[index];
+      if( !frame.cached && lseek( fd, frame.offset, SEEK_SET ) < 0 ) {
+         int error = errno;
+         close( fd );
+         LinuxDir::CheckReadError( std::string_view( m_current_path )
+                                   .substr( 0, frame.path_start ), error );
+         return false;
+      }
+      frame.fd = fd;
+      m_open++;
+      m_first_open = std::min( m_first_open, index );
+      if( !frame.cached ) frame.buffer = TakeBuffer();
+      MakeRoom();
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   // The nearest open frame at or below `index`, which its subdirectories
+   //  are looked up relative to. Cache hits aren't opened, so that can be
+   //  further up, but if it's too far, `index` is opened.
+   size_t Anchor( size_t index ) noexcept {
+      size_t anchor = index;
+      while( m_frames[anchor].fd < 0 ) anchor--;
+      if( m_frames[index].path_start - m_frames[anchor].path_start < REACH
+            || !Reopen( index ))
+         return anchor;
+      return index;
+   }
+
+   //--------------------------------------------------------------------------
+   // Starts on the directory at the end of `m_current_path`, which ends with
+   //  a slash, and is a subdirectory of the frame at `parent`. `seed`,
+   //  `ignore` and `glob` are its own. Returns true if it pushed a frame for
+   //  it. Otherwise it was skipped, or it was a cache hit with nothing to go
+   //  into, and it's done.
+   bool PushChild( size_t parent, bool follow, Hash seed,
+                   const IgnoreNode *ignore, const GlobState *glob ) noexcept {
+      using namespace LinuxDir;
+      if( follow && opt_symlinks == Symlinks::ONCE && !m_listing
+                 && !(m_replaying && parent == 0) ) {
+         std::vector<DirId> tops = m_replay_tops;
+         for( size_t i = 1; i <= parent; i++ ) {
+            if( m_frames[i].follow ) tops.push_back( FrameId( i ));
+         }
+         Frame &frame = m_frames[parent];
+         m_deferred.emplace( m_current_path,
+                             DeferredLink{ frame.path_start, frame.level,
+                                           frame.linked, frame.seed,
+                                           frame.ignore, frame.glob,
+                                           frame.git, std::move( tops )});
+         return false;
+      }
+      size_t anchor = Anchor( parent );
+      int at = m_frames[anchor].fd;
+      size_t at_start = m_frames[anchor].path_start;
+      int level = m_frames[parent].level + 1;
+      bool linked = follow || m_frames[parent].linked;
+      bool check = opt_symlinks == Symlinks::FOLLOW ? follow
+                 : opt_symlinks == Symlinks::ONCE && linked;
+      const char *skip = nullptr;
+      auto skipped = [&]() {
+         if constexpr( VERBOSE ) {
+            std::cout << " - " << m_current_path << " (" << skip << ")\n";
+         }
+         return false;
+      };
+      // The ignore files are read first, since the cache entry depends on
+      //  them too.
+      GitFramePtr git = m_gitignore ? EnterGitIgnore( at, at_start,
+                                                      m_frames[parent].git )
+                                    : nullptr;
+      // Cut off the trailing slash for the kernel, which would otherwise
+      //  follow symlinks. It's put back before the path is used again.
+      char *slash = &m_current_path[m_current_path.size() - 1];
+      const char *name = m_current_path.c_str() + at_start;
+
+      DirStamp stamp;
+      bool stamped = false;
+      if( m_cache ) {
+         *slash = 0;
+         stamped = StatDirectory( at, name, follow, stamp );
+         if( stamped && check ) {
+            skip = Revisits( parent, follow, { stamp.dev, stamp.ino }, at,
+                             name );
+         }
+         *slash = '/';
+         if( !stamped ) return false;
+         if( skip ) return skipped();
+         DirEntryPtr entry = m_cache->Find( m_current_path, stamp,
+                                            Descends( level ),
+                                            FilterKey( glob, git.get() ));
+         if( entry ) {
+            CacheHit( entry );
+            if( !Descends( level ) || entry->subdirs.empty() ) {
+               m_frames[parent].hash ^= entry->files;
+               return false;
+            }
+            PushFrame( -1, level, follow, seed, ignore, glob, std::move( git ),
+                       std::move( entry ), nullptr );
+            m_frames.back().linked = linked;
+            return true;
+         }
+      }
+
+      *slash = 0;
+      int fd = OpenDirectory( at, name, follow );
+      DirId id;
+      if( fd >= 0 && check && !stamped ) {
+         skip = LinuxDir::DirectoryId( fd, "", id )
+                ? Revisits( parent, follow, id, at, name ) : "can't stat";
+      }
+      *slash = '/';
+      if( fd < 0 ) {
+         CheckOpenError( m_current_path, errno );
+         return false;
+      }
+      if( skip ) {
+         close( fd );
+         return skipped();
+      }
+      PushFrame( fd, level, follow, seed, ignore, glob, std::move( git ),
+                 nullptr, stamped ? &stamp : nullptr );
+      Frame &child = m_frames.back();
+      child.linked = linked;
+      if( check && !stamped ) {
+         child.id = id;
+         child.id_known = true;
+      }
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   // Goes into the next subdirectory of the cache hit at `index`, which is
+   //  on top. Returns false when there are no more.
+   bool NextCached( size_t index ) noexcept {
+      for(;;) {
+         Frame &frame = m_frames[index];
+         const DirCacheEntry &entry = *frame.cached;
+         if( frame.next == entry.subdirs.size() ) return false;
+         const DirCacheEntry::Subdir &sub = entry.subdirs[frame.next++];
+
+         size_t anchor = Anchor( index );
+         m_current_path.resize( frame.path_start );
+         m_current_path.append( sub.name );
+         m_current_path.push_back( '/' );
+         int at = m_frames[anchor].fd;
+         size_t at_start = m_frames[anchor].path_start;
+         if( ChecksMounts()
+               && SkipsMount( FrameId( index ).dev, at, at_start,
+                              sub.follow ))
+            continue;
+         if( opt_skip_marked
+               && LinuxDir::IsMarked( at, m_current_path, at_start ))
+            continue;
+         if( PushChild( index, sub.follow,
+                        SubdirectorySeed( frame.seed, sub.name ),
+                        m_filter.IgnoreChild( frame.ignore, sub.name ),
+                        GlobMatcher::Child( frame.glob, sub.name )))
+            return true;
+      }
+   }
+
+   //--------------------------------------------------------------------------
+   // Works through the stack, which has the root on the bottom, until it's
+   //  empty. Returns the root's hash.
+   Hash Run() noexcept {
+      m_first_open = 1;
+      for(;;) {
+         size_t top = m_frames.size() - 1;
+         Frame &frame = m_frames[top];
+         if( opt_deadline_ms > 0 ) {
+            std::lock_guard<std::mutex> lock( m_where_mutex );
+            m_where.assign( m_current_path, 0, frame.path_start );
+         }
+         bool pushed = false;
+         if( frame.cached ) {
+            pushed = NextCached( top );
+         } else if( frame.fd >= 0 || Reopen( top )) {
+            ScanFunction scan = frame.recursive ? m_scan_recursive
+                                                : m_scan_flat;
+            pushed = (this->*scan)( top );
+         }
+         if( pushed ) continue;
+
+         // It's done.
+         Frame &done = m_frames.back();
+         if( done.fd >= 0 ) CloseFrame( done );
+         if( !done.cached ) Record( done );
+         Hash hash = done.hash;
+         m_frames.pop_back();
+         if( m_frames.empty() ) {
+            if( opt_deadline_ms > 0 ) {
+               std::lock_guard<std::mutex> lock( m_where_mutex );
+               m_where.clear();
+            }
+            return hash;
+         }
+         m_frames.back().hash ^= hash;
+         // Only the new top can be open past the ones that are closed.
+         m_first_open = std::min( m_first_open,
+                                  std::max<size_t>( m_frames.size() - 1, 1 ));
+      }
+   }
+
+   //--------------------------------------------------------------------------
+   // Goes into the links that PushChild put off, smallest path first, until
+   //  there are none left. The ones found under them are put off too. Each
+   //  is pushed as the only subdirectory of a frame for the directory it's
+   //  in, which is opened from `base`. Returns the hash of what they lead
+   //  to.
+   Hash RunDeferred( std::string_view base ) noexcept {
+      Hash hash = 0;
+      while( !m_deferred.empty() ) {
+         auto next = m_deferred.extract( m_deferred.begin() );
+         const std::string &path = next.key();
+         DeferredLink &link = next.mapped();
+         m_current_path.assign( base );
+         m_current_path.append( path, 0, link.parent_start );
+         int fd = LinuxDir::OpenPath( m_current_path, REACH );
+         if( fd < 0 ) {
+            LinuxDir::CheckOpenError( m_current_path, errno );
+            continue;
+         }
+         m_current_path.assign( path, 0, link.parent_start );
+
+         auto only = std::make_shared<DirCacheEntry>();
+         only->subdirs.push_back({ path.substr( link.parent_start,
+                                      path.size() - link.parent_start - 1 ),
+                                   true });
+         PushFrame( fd, link.level, false, link.seed, link.ignore, link.glob,
+                    std::move( link.git ), std::move( only ), nullptr );
+         Frame &frame = m_frames.back();
+         frame.linked = link.linked;
+         // It isn't really from the cache. Its DirId is looked up from `fd`.
+         frame.id_known = false;
+         m_replaying = true;
+         m_replay_tops = std::move( link.tops );
+         hash ^= Run();
+         m_replaying = false;
+         m_replay_tops.clear();
+      }
+      return hash;
+   }
+
+   //--------------------------------------------------------------------------
+   template< bool RECURSIVE >
+   ScanFunction PickScan() const noexcept {
+      if( m_filter.HasExts() ) {
+         if( m_filter.HasIgnores() )
+            return &LinuxScanner::ReadFrame<RECURSIVE, true, true>;
+         return &LinuxScanner::ReadFrame<RECURSIVE, true, false>;
+      }
+      if( m_filter.HasIgnores() )
+         return &LinuxScanner::ReadFrame<RECURSIVE, false, true>;
+      return &LinuxScanner::ReadFrame<RECURSIVE, false, false>;
+   }
+
+   //--------------------------------------------------------------------------
+   // Called from the constructor. The filter is set from the options once
+   //  and doesn't change after that.
+   void SelectScan() noexcept {
+      m_scan_recursive = PickScan<true>();
+      m_scan_flat = PickScan<false>();
+   }
+
+   //--------------------------------------------------------------------------
+   // True if the subdirectories of a directory `level` below the root are
+   //  scanned. ReadDirectory goes by what it's asked for, which comes from a
+   //  manifest that already took the depth into account.
+   bool Descends( int level ) const noexcept {
+      return m_recursive && (m_listing || WithinMaxDepth( level ));
+   }
+
+   //--------------------------------------------------------------------------
+   // The GitIgnore frame of the directory at the end of `m_current_path`,
+   //  whose ignore files are read relative to `anchor`.
+   GitFramePtr EnterGitIgnore( int anchor, size_t anchor_start,
+                               const GitFramePtr &parent ) noexcept {
+      size_t path_start = m_current_path.size();
+      return GitIgnore::Enter( parent, path_start,
+                               [&]( const char *name, std::string &text ) {
+         m_current_path.append( name );
+         bool found = LinuxDir::ReadFile( anchor, m_current_path.c_str()
+                                                  + anchor_start, text );
+         m_current_path.resize( path_start );
+         return found;
+      });
+   }
+
+   //--------------------------------------------------------------------------
+   // The GitIgnore frame of the root `path`, which is in `m_current_path`.
+   GitFramePtr RootGitIgnore( std::string_view path ) noexcept {
+      if( !m_gitignore ) return nullptr;
+      std::string dir = BasePrefix( path );
+      dir.append( path );
+      return m_gitignore->Root( dir, m_current_path.size() );
+   }
+
+   //--------------------------------------------------------------------------
+   // Takes the subdirectories that ReadFrame would leave out of a listing,
+   //  the mount points, marked ones, links back up and ones that can't be
+   //  opened, out of a cached listing of the open directory `fd`, which is
+   //  in `m_current_path`. `stamp` is the directory's.
+   void DropSkipped( int fd, const DirStamp &stamp,
+                     DirCacheEntry &entry ) noexcept {
+      size_t path_start = m_current_path.size();
+      auto skipped = [&]( const DirCacheEntry::Subdir &sub ) {
+         m_current_path.resize( path_start );
+         m_current_path.append( sub.name );
+         m_current_path.push_back( '/' );
+         if( ChecksMounts()
+               && SkipsMount( stamp.dev, fd, path_start, sub.follow ))
+            return true;
+         return (opt_skip_marked
+                 && LinuxDir::IsMarked( fd, m_current_path, path_start ))
+                || (sub.follow && LinksBack( 0, fd, sub.name.c_str() ))
+                || !LinuxDir::CanOpen( fd, sub.name.c_str(), sub.follow,
+                                       m_current_path );
+      };
+      entry.subdirs.erase( std::remove_if( entry.subdirs.begin(),
+                                           entry.subdirs.end(), skipped ),
+                           entry.subdirs.end() );
+      m_current_path.resize( path_start );
+   }
+
+   //--------------------------------------------------------------------------
+   // Opens a root and sets `m_current_path` to it, with a trailing slash.
+   //  Returns the descriptor, or -1.
+   int OpenRoot( std::string_view path ) noexcept {
+      if( path.empty() ) {
+         std::cout << "Invalid path given.\n";
+         return -1;
+      }
+
+      m_current_path.assign( BasePrefix( path ));
+      m_current_path.append( path );
+      int fd = LinuxDir::OpenPath( m_current_path, REACH );
+      if( fd < 0 ) return -1;
+      m_current_path.assign( path );
+
+      // Same joining rule as std::filesystem::path::operator/.
+      if( m_current_path.back() != '/' ) {
+         m_current_path.push_back( '/' );
+      }
+      m_root_length = m_current_path.size();
+      m_above_known = false;
+      return fd;
+   }
+
+public:
+   //--------------------------------------------------------------------------
+   ScanStats GetStats() const noexcept override {
+      return m_stats;
+   }
+
+   //--------------------------------------------------------------------------
+   bool SetCache( DirCache *cache ) noexcept override {
+      m_cache = cache;
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   bool SetManifest( Manifest *manifest ) noexcept override {
+      m_manifest = manifest;
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   bool SetGitIgnore( GitIgnore *gitignore ) noexcept override {
+      m_gitignore = gitignore;
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   bool SetFilter( const FilterExpression *filter ) noexcept override {
+      m_expr = filter;
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   bool CanSkipMounts() const noexcept override {
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   std::vector<std::string> GetSkippedMounts() const noexcept override {
+      return m_mounts;
+   }
+
+   //--------------------------------------------------------------------------
+   void GetUnfinished( const std::vector<ScanRoot> &roots,
+                       std::vector<std::string> &paths )
+                       const noexcept override {
+      Scanner::GetUnfinished( roots, paths );
+      std::lock_guard<std::mutex> lock( m_where_mutex );
+      if( !m_where.empty() ) paths.push_back( m_where );
+   }
+
+   //--------------------------------------------------------------------------
+   Hash Scan( std::string_view path, bool recursive,
+              const GlobState *glob ) noexcept override {
+      if( GlobMatcher::Skip( glob )) return 0;
+      int fd = OpenRoot( path );
+      if( fd < 0 ) return 0;
+
+      m_recursive = recursive;
+      Hash seed = DirectorySeed( m_current_path );
+      const IgnoreNode *ignore = m_filter.IgnoreRoot( m_current_path );
+      GitFramePtr git = RootGitIgnore( path );
+      DirStamp stamp;
+      DirEntryPtr entry;
+      if( m_cache ) {
+         if( !LinuxDir::StatDirectory( fd, "", true, stamp )) {
+            close( fd );
+            return 0;
+         }
+         entry = m_cache->Find( m_current_path, stamp, Descends( 0 ),
+                                FilterKey( glob, git.get() ));
+         if( entry ) {
+            CacheHit( entry );
+            if( !Descends( 0 )) {
+               close( fd );
+               return entry->files;
+            }
+         }
+      }
+
+      // A cache hit keeps the root open too, to look up its subdirectories.
+      PushFrame( fd, 0, true, seed, ignore, glob, std::move( git ), entry,
+                 m_cache && !entry ? &stamp : nullptr );
+      if( opt_symlinks == Symlinks::ONCE ) {
+         m_visited = std::make_unique<VisitedSet>();
+         m_root_id = FrameId( 0 );
+         m_visited->Insert( m_root_id );
+      }
+      Hash hash = Run();
+      if( !m_deferred.empty() ) hash ^= RunDeferred( BasePrefix( path ));
+      return hash;
+   }
+
+   //--------------------------------------------------------------------------
+   bool ReadDirectory( std::string_view path, bool recursive,
+                       const GlobState *glob,
+                       DirCacheEntry &entry ) noexcept override {
+      int fd = OpenRoot( path );
+      if( fd < 0 ) return false;
+
+      m_recursive = recursive;
+      GitFramePtr git = RootGitIgnore( path );
+      if( m_cache ) {
+         DirStamp stamp;
+         DirEntryPtr cached;
+         if( LinuxDir::StatDirectory( fd, "", true, stamp )) {
+            cached = m_cache->Find( m_current_path, stamp, m_recursive,
+                                    FilterKey( glob, git.get() ));
+         }
+         if( cached ) {
+            m_stats.cache_hits++;
+            entry = *cached;
+            DropSkipped( fd, stamp, entry );
+            close( fd );
+            return true;
+         }
+      }
+
+      m_listing = &entry;
+      PushFrame( fd, 0, true, DirectorySeed( m_current_path ),
+                 m_filter.IgnoreRoot( m_current_path ), glob, std::move( git ),
+                 nullptr, nullptr );
+      Run();
+      m_listing = nullptr;
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   bool CanReadDirectory() const noexcept override {
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   LinuxScanner() {
+      m_current_path.reserve( PATHSIZE );
+      SelectScan();
+   }
+};
+
+} /////////////////////////////////////////////////////////////////////////////
+
+#endif // TARGET_LINUX
@@ -0,0 +1,314 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#include "manifest.h"
+#include "scanner.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string_view>
+#include <unordered_map>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+void Manifest::AppendEscaped( std::string &out,
+                              std::string_view str ) noexcept {
+   for( char c : str ) {
+      if( c == '\\' ) {
+         out += "\\\\";
+      } else if( c == '\n' ) {
+         out += "\\n";
+      } else {
+         out += c;
+      }
+   }
+}
+
+//-----------------------------------------------------------------------------
+void Manifest::Add( std::string path, DirEntryPtr entry ) noexcept {
+   std::lock_guard<std::mutex> lock( m_mutex );
+   m_dirs.push_back({ std::move( path ), std::move( entry )});
+}
+
+//-----------------------------------------------------------------------------
+void Manifest::Finish() noexcept {
+   if( m_finished ) return;
+   m_finished = true;
+
+   // Recursive first among duplicates, so that's the one that stays.
+   std::sort( m_dirs.begin(), m_dirs.end(),
+              []( const Directory &a, const Directory &b ) {
+      if( a.path != b.path ) return a.path < b.path;
+      return a.entry->recursive > b.entry->recursive;
+   });
+   m_dirs.erase( std::unique( m_dirs.begin(), m_dirs.end(),
+                              []( const Directory &a, const Directory &b ) {
+      return a.path == b.path;
+   }), m_dirs.end() );
+
+   // A subdirectory sorts after its parent, so going backwards, the children
+   //  are always done first.
+   std::unordered_map<std::string_view, size_t> index;
+   for( size_t i = 0; i < m_dirs.size(); i++ ) {
+      index.emplace( m_dirs[i].path, i );
+   }
+   std::string child;
+   for( size_t i = m_dirs.size(); i-- > 0; ) {
+      const DirCacheEntry &entry = *m_dirs[i].entry;
+      m_dirs[i].subtree = entry.files;
+      if( !entry.recursive ) continue;
+      for( auto &sub : entry.subdirs ) {
+         child.assign( m_dirs[i].path );
+         child.append( sub.name );
+         child.push_back( '/' );
+         auto it = index.find( child );
+         // Subdirectories that couldn't be opened aren't there.
+         if( it != index.end() ) {
+            m_dirs[i].subtree ^= m_dirs[it->second].subtree;
+         }
+      }
+   }
+}
+
+//-----------------------------------------------------------------------------
+void Manifest::SortedNames( const DirCacheEntry &entry,
+                            std::vector<std::string_view> &names ) noexcept {
+   // Names are in whatever order the directory listed them.
+   names.clear();
+   std::string_view all = entry.names;
+   for( size_t end; (end = all.find( '\0' )) != all.npos; ) {
+      names.push_back( all.substr( 0, end ));
+      all.remove_prefix( end + 1 );
+   }
+   std::sort( names.begin(), names.end() );
+}
+
+//-----------------------------------------------------------------------------
+std::string_view Manifest::ParentPath( std::string_view path ) noexcept {
+   if( path.size() < 2 ) return {};
+   size_t slash = path.rfind( '/', path.size() - 2 );
+   if( slash == path.npos ) return {};
+   return path.substr( 0, slash + 1 );
+}
+
+//-----------------------------------------------------------------------------
+size_t Manifest::Find( std::string_view path ) const noexcept {
+   auto it = std::lower_bound( m_dirs.begin(), m_dirs.end(), path,
+                  []( const Directory &dir, std::string_view path ) {
+      return dir.path < path;
+   });
+   if( it == m_dirs.end() || it->path != path ) return (size_t)-1;
+   return it - m_dirs.begin();
+}
+
+//-----------------------------------------------------------------------------
+bool Manifest::Save( const std::string &filename,
+                     const std::vector<ScanRoot> &roots, Hash hash,
+                     int64_t now ) noexcept {
+   Finish();
+
+   // A directory has changed if its files are different, or if it gained or
+   //  lost a subdirectory. Anything we can't match up counts as changed.
+   std::vector<int64_t> changed( m_dirs.size(), now );
+   ManifestReader previous;
+   if( previous.Open( filename, false )) {
+      std::vector<bool> seen( m_dirs.size() );
+      auto touch_parent = [&]( std::string_view path ) {
+         size_t parent = Find( ParentPath( path ));
+         if( parent != (size_t)-1 ) changed[parent] = now;
+      };
+
+      // Both are sorted the same way, so this is a merge.
+      ManifestReader::Directory old;
+      std::string old_path;
+      size_t i = 0;
+      while( previous.Next( old )) {
+         ManifestReader::Unescape( old.path, old_path );
+         while( i < m_dirs.size() && m_dirs[i].path < old_path ) i++;
+         if( i < m_dirs.size() && m_dirs[i].path == old_path ) {
+            seen[i] = true;
+            if( old.files == m_dirs[i].entry->files ) changed[i] = old.changed;
+            i++;
+         } else {
+            touch_parent( old_path );
+         }
+      }
+      for( i = 0; i < m_dirs.size(); i++ ) {
+         if( !seen[i] ) touch_parent( m_dirs[i].path );
+      }
+   }
+
+   std::string out = "treehash-manifest 2\n";
+   out += "V " + std::to_string( opt_hash_version ) + "\n";
+   out += "H " + HashToHex( hash ) + "\n";
+   for( auto &root : roots ) {
+      out += "R " + HashToHex( root.hash ) + (root.recursive ? " D " : " L ");
+      AppendEscaped( out, root.path );
+      if( !root.path.empty() && root.path.back() != '/' ) out += '/';
+      out += '\n';
+   }
+
+   std::vector<std::string_view> names;
+   for( size_t i = 0; i < m_dirs.size(); i++ ) {
+      const DirCacheEntry &entry = *m_dirs[i].entry;
+      out += entry.recursive ? "D " : "L ";
+      out += HashToHex( m_dirs[i].subtree ) + " " + HashToHex( entry.files )
+           + " " + std::to_string( changed[i] ) + " ";
+      AppendEscaped( out, m_dirs[i].path );
+      out += '\n';
+
+      SortedNames( entry, names );
+      for( auto &name : names ) {
+         out += "F ";
+         AppendEscaped( out, name );
+         out += '\n';
+      }
+   }
+
+   std::string temp = filename + ".tmp";
+   {
+      std::ofstream file( temp, std::ios::binary | std::ios::trunc );
+      file.write( out.data(), out.size() );
+      if( !file ) {
+         std::cout << "Couldn't write manifest " << temp << ".\n";
+         return false;
+      }
+   }
+   std::error_code error_code;
+   std::filesystem::rename( temp, filename, error_code );
+   if( error_code ) {
+      std::cout << "Couldn't write manifest " << filename << ".\n";
+      return false;
+   }
+   return true;
+}
+
+//-----------------------------------------------------------------------------
+std::string_view ManifestReader::TakeLine() noexcept {
+   const char *start = m_read;
+   const char *newline = static_cast<const char*>(
+                            memchr( start, '\n', m_end - start ));
+   if( !newline ) newline = m_end;
+   m_read = newline == m_end ? m_end : newline + 1;
+   return std::string_view( start, newline - start );
+}
+
+//-----------------------------------------------------------------------------
+bool ManifestReader::Open( const std::string &filename,
+                           bool report ) noexcept {
+   std::ifstream file( filename, std::ios::binary );
+   if( !file ) {
+      if( report ) std::cout << "Couldn't read manifest " << filename << ".\n";
+      return false;
+   }
+   m_data.assign( std::istreambuf_iterator<char>( file ), {} );
+   m_read = m_data.data();
+   m_end  = m_data.data() + m_data.size();
+
+   if( TakeLine() != "treehash-manifest 2" ) {
+      if( report )
+         std::cout << filename << " isn't a manifest from this version.\n";
+      return false;
+   }
+   m_roots.clear();
+   while( m_read < m_end && *m_read != 'D' && *m_read != 'L' ) {
+      std::string_view line = TakeLine();
+      if( line.size() > 2 && line[0] == 'H' ) {
+         HexToHash( line.substr( 2 ), m_hash );
+      } else if( line.size() > 2 && line[0] == 'V' ) {
+         std::from_chars( line.data() + 2, line.data() + line.size(),
+                          m_version );
+      } else if( line.size() > 21 && line[0] == 'R' ) {
+         Root root;
+         if( HexToHash( line.substr( 2, 16 ), root.hash )) {
+            root.recursive = line[19] == 'D';
+            root.path = line.substr( 21 );
+            m_roots.push_back( root );
+         }
+      }
+   }
+   return true;
+}
+
+//-----------------------------------------------------------------------------
+bool ManifestReader::CheckVersion() const noexcept {
+   if( m_version == opt_hash_version ) return true;
+   std::cout << "The manifest was made with hash version " << m_version
+             << ". Use -H " << m_version << " to compare with it.\n";
+   return false;
+}
+
+//-----------------------------------------------------------------------------
+bool ManifestReader::Next( Directory &dir ) noexcept {
+   if( m_read >= m_end ) return false;
+   std::string_view line = TakeLine();
+   // "D <subtree> <files> <changed> <path>"
+   const char *changed = line.data() + 36;
+   std::from_chars_result parsed{};
+   if( line.size() < 39 || (line[0] != 'D' && line[0] != 'L')
+                        || !HexToHash( line.substr( 2, 16 ), dir.subtree )
+                        || !HexToHash( line.substr( 19, 16 ), dir.files )
+         || (parsed = std::from_chars( changed, line.data() + line.size(),
+                                       dir.changed )).ec != std::errc()
+         || parsed.ptr == line.data() + line.size() || *parsed.ptr != ' ' ) {
+      m_read = m_end;
+      return false;
+   }
+   dir.recursive = line[0] == 'D';
+   dir.path = line.substr( parsed.ptr + 1 - line.data() );
+
+   const char *names = m_read;
+   while( m_read < m_end && *m_read == 'F' ) TakeLine();
+   dir.names = std::string_view( names, m_read - names );
+   return true;
+}
+
+//-----------------------------------------------------------------------------
+void ManifestReader::SkipSubtree( std::string_view path ) noexcept {
+   // Everything under it comes right after it.
+   while( m_read < m_end ) {
+      const char *start = m_read;
+      std::string_view line = TakeLine();
+      if( !line.empty() && line[0] == 'F' ) continue;
+      // The path comes after <changed>.
+      size_t field = line.size() > 36 ? line.find( ' ', 36 ) : line.npos;
+      if( field == line.npos
+                    || line.substr( field + 1, path.size() ) != path ) {
+         m_read = start;
+         return;
+      }
+   }
+}
+
+//-----------------------------------------------------------------------------
+bool ManifestReader::NextName( std::string_view &names,
+                               std::string &name ) noexcept {
+   if( names.size() < 2 ) return false;
+   size_t end = names.find( '\n' );
+   if( end == names.npos ) end = names.size();
+   Unescape( names.substr( 2, end - 2 ), name );
+   names.remove_prefix( end == names.size() ? end : end + 1 );
+   return true;
+}
+
+//-----------------------------------------------------------------------------
+void ManifestReader::Unescape( std::string_view str,
+                               std::string &out ) noexcept {
+   out.clear();
+   for( size_t i = 0; i < str.size(); i++ ) {
+      if( str[i] == '\\' && i + 1 < str.size() ) {
+         i++;
+         out += str[i] == 'n' ? '\n' : str[i];
+      } else {
+         out += str[i];
+      }
+   }
+}
+
+} /////////////////////////////////////////////////////////////////////////////
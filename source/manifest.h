@@ -0,0 +1,182 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "hash.h"
+#include "dir_cache.h"
+
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+// Collects every directory that the scanner visits, and writes them out with
+//  a hash for each subtree. Two manifests can be compared from the top down,
+//  skipping any subtree whose hash matches.
+//
+// The file is text, one record per line:
+//
+//   treehash-manifest 2
+//   V <version>            The hash version used. 1 if it's missing.
+//   H <hash>               The final result.
+//   R <hash> <D|L> <path>  One per scanned root, in order. XORed together
+//                           they make the final result. L if the root was
+//                           scanned without its subdirectories.
+//   D <subtree> <files> <changed> <path>
+//                          A directory. <files> covers the files directly
+//                           inside, and <subtree> also covers every D record
+//                           under it. <changed> is when the directory's
+//                           files or subdirectories last changed, as far as
+//                           earlier manifests saved to the same file know.
+//   L <subtree> <files> <changed> <path>
+//                          A directory that was scanned without its
+//                           subdirectories, so <subtree> is <files>.
+//   F <name>               A file in the directory above.
+//
+// Hashes are 16 hex digits, and times are in seconds since 1970. Directory
+//  paths are as they're hashed, with a trailing slash, and are sorted
+//  bytewise, so a subtree is always one contiguous run of records.
+//  Backslashes and newlines in paths and names are escaped as "\\" and
+//  "\n".
+//
+// Directories can be added from several threads.
+class Manifest {
+//-----------------------------------------------------------------------------
+public:
+   struct Directory {
+      std::string path;
+      DirEntryPtr entry;
+      // Filled in by Finish.
+      Hash subtree = 0;
+   };
+
+private:
+   std::vector<Directory> m_dirs;
+   std::mutex m_mutex;
+   bool m_finished = false;
+
+public:
+   //--------------------------------------------------------------------------
+   // `path` has a trailing slash, and `entry` should have its names filled
+   //  in. If the same directory is added twice, the recursive one is kept.
+   void Add( std::string path, DirEntryPtr entry ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // Sorts the directories and works out the subtree hashes. Called once the
+   //  scan is done.
+   void Finish() noexcept;
+
+   //--------------------------------------------------------------------------
+   // Valid after Finish, sorted by path.
+   const std::vector<Directory> &Directories() const noexcept {
+      return m_dirs;
+   }
+
+   //--------------------------------------------------------------------------
+   // Index of the directory with `path`, or -1. Valid after Finish.
+   size_t Find( std::string_view path ) const noexcept;
+
+   //--------------------------------------------------------------------------
+   // Writes the manifest for a finished scan. If there's already a manifest
+   //  in `filename`, the change times are carried over from it, and
+   //  directories that changed since get `now`.
+   bool Save( const std::string &filename, const std::vector<ScanRoot> &roots,
+              Hash hash, int64_t now ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // Escapes a path or name for the file, onto the end of `out`.
+   static void AppendEscaped( std::string &out, std::string_view str ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // "a/b/c/" -> "a/b/", or empty if there's no slash before the last one.
+   static std::string_view ParentPath( std::string_view path ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // Splits a directory's file names out and sorts them.
+   static void SortedNames( const DirCacheEntry &entry,
+                            std::vector<std::string_view> &names ) noexcept;
+};
+
+//-----------------------------------------------------------------------------
+// Reads a manifest file back, one directory at a time, in the order they're
+//  written. The file is kept in one buffer and nothing is copied out of it
+//  unless it needs unescaping, so this is cheap even for huge trees.
+class ManifestReader {
+//-----------------------------------------------------------------------------
+   std::string m_data;
+   const char *m_read = nullptr;
+   const char *m_end  = nullptr;
+   Hash m_hash = 0;
+   int m_version = 1;
+public:
+   struct Root {
+      Hash hash;
+      bool recursive;
+      // Still escaped.
+      std::string_view path;
+   };
+private:
+   std::vector<Root> m_roots;
+
+   //--------------------------------------------------------------------------
+   // Returns the next line without its newline, and moves past it.
+   std::string_view TakeLine() noexcept;
+
+public:
+   //--------------------------------------------------------------------------
+   struct Directory {
+      bool recursive;
+      Hash subtree;
+      Hash files;
+      int64_t changed;
+      // Still escaped.
+      std::string_view path;
+      // The F lines that follow, for NextName.
+      std::string_view names;
+   };
+
+   //--------------------------------------------------------------------------
+   // Reads the file and its header. Returns false if it's not a manifest,
+   //  and prints why if `report` is set.
+   bool Open( const std::string &filename, bool report = true ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // The final result that was recorded.
+   Hash GetHash() const noexcept { return m_hash; }
+
+   //--------------------------------------------------------------------------
+   // The hash version it was made with.
+   int GetVersion() const noexcept { return m_version; }
+
+   //--------------------------------------------------------------------------
+   // Prints an error and returns false if the manifest's hash version isn't
+   //  the one we're using.
+   bool CheckVersion() const noexcept;
+
+   //--------------------------------------------------------------------------
+   // The roots that were scanned, in order.
+   const std::vector<Root> &Roots() const noexcept { return m_roots; }
+
+   //--------------------------------------------------------------------------
+   // Reads the next directory. Returns false at the end, or if the rest of
+   //  the file is malformed.
+   bool Next( Directory &dir ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // Skips over the directories under `path`, which is still escaped.
+   void SkipSubtree( std::string_view path ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // Takes the next file name off of `names`, unescaped into `name`. Returns
+   //  false when there are no more.
+   static bool NextName( std::string_view &names, std::string &name ) noexcept;
+
+   //--------------------------------------------------------------------------
+   static void Unescape( std::string_view str, std::string &out ) noexcept;
+};
+
+} /////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,23 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <string_view>
+
+///////////////////////////////////////////////////////////////////////////////
+// Files that mark a directory to be skipped with --skip-marked, along with
+//  everything under it.
+namespace Treehash::Markers {
+
+//-----------------------------------------------------------------------------
+// Skips the directory whatever is in it.
+constexpr const char *STOP_FILE = ".treehash-stop";
+
+//-----------------------------------------------------------------------------
+// From the Cache Directory Tagging spec. Only counts if it starts with
+//  CACHEDIR_SIGNATURE, so that a file that happens to have the name doesn't.
+constexpr const char *CACHEDIR_TAG = "CACHEDIR.TAG";
+constexpr std::string_view CACHEDIR_SIGNATURE =
+   "Signature: 8a477f597d28d172789f06886806bc55";
+
+} /////////////////////////////////////////////////////////////////////////////
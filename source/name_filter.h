@@ -0,0 +1,114 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "options.h"
+#include "ext_matcher.h"
+#include "ignore_matcher.h"
+
+#include <string>
+#include <string_view>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+// The name-based filters, with the same rules as the default scanner:
+//  dotfiles, unlisted extensions, and ignored names or paths. This is
+//  read-only while scanning, so workers on several threads can share one.
+//
+// Each directory being scanned keeps its IgnoreNode, from IgnoreRoot for a
+//  root and IgnoreChild for everything under it.
+//
+// The checks take EXTS and IGNORES as template arguments. A scanner whose
+//  loop is instantiated for HasExts() and HasIgnores() passes those along,
+//  so a check that can't exclude anything isn't compiled in at all.
+class NameFilter {
+//-----------------------------------------------------------------------------
+   ExtMatcher m_exts;
+   IgnoreMatcher m_ignores;
+
+public:
+   //--------------------------------------------------------------------------
+   // `path` ends with the entry's name, which starts at `name_start`. `dir`
+   //  is the IgnoreNode of the directory it's in.
+   inline bool IsIgnored( std::string_view path, size_t name_start,
+                          const IgnoreNode *dir ) const noexcept {
+      return m_ignores.IsIgnored( dir, path.substr( name_start ));
+   }
+
+   //--------------------------------------------------------------------------
+   inline bool IsExtExcluded( std::string_view path,
+                              size_t name_start ) const noexcept {
+      if( m_exts.Empty() ) return false;
+      return !m_exts.MatchName( path.substr( name_start ));
+   }
+
+   //--------------------------------------------------------------------------
+   template< bool EXTS = true, bool IGNORES = true >
+   inline bool IsExcluded( std::string_view path, size_t name_start,
+                           bool is_directory,
+                           const IgnoreNode *dir ) const noexcept {
+      if( path[name_start] == '.' ) return true;
+      if constexpr( EXTS ) {
+         if( !is_directory && IsExtExcluded( path, name_start )) return true;
+      }
+      if constexpr( IGNORES ) return IsIgnored( path, name_start, dir );
+      return false;
+   }
+
+   //--------------------------------------------------------------------------
+   // True if the entry would be dropped whether it turns out to be a file or
+   //  a directory. Directories only matter for recursive scans.
+   template< bool EXTS = true, bool IGNORES = true >
+   inline bool IsExcludedByName( std::string_view path, size_t name_start,
+                                 bool recursive,
+                                 const IgnoreNode *dir ) const noexcept {
+      if( !recursive ) {
+         return IsExcluded<EXTS, IGNORES>( path, name_start, false, dir );
+      }
+      return IsExcluded<false, IGNORES>( path, name_start, true, dir );
+   }
+
+   //--------------------------------------------------------------------------
+   // Whether there are any extensions or ignores to check.
+   bool HasExts() const noexcept { return !m_exts.Empty(); }
+   bool HasIgnores() const noexcept { return !m_ignores.Empty(); }
+
+   //--------------------------------------------------------------------------
+   // The IgnoreNode of a root, whose path ends with a slash.
+   const IgnoreNode *IgnoreRoot( std::string_view path ) const noexcept {
+      return m_ignores.Find( path );
+   }
+
+   //--------------------------------------------------------------------------
+   // The IgnoreNode of the subdirectory `name` of a directory with `dir`.
+   const IgnoreNode *IgnoreChild( const IgnoreNode *dir,
+                                  std::string_view name ) const noexcept {
+      return m_ignores.Child( dir, name );
+   }
+
+   //--------------------------------------------------------------------------
+   void ResetExts() noexcept {
+      m_exts.Clear( opt_exts_nocase );
+
+      for( auto &e : opt_exts )
+         m_exts.Add( e );
+   }
+
+   //--------------------------------------------------------------------------
+   void ResetIgnores() noexcept {
+      m_ignores.Clear();
+
+      for( auto &i : opt_ignores )
+         m_ignores.Add( i );
+   }
+
+   //--------------------------------------------------------------------------
+   NameFilter() {
+      ResetExts();
+      ResetIgnores();
+   }
+};
+
+} /////////////////////////////////////////////////////////////////////////////
@@ -1,12 +1,14 @@
 // treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
 ///////////////////////////////////////////////////////////////////////////////
 #include "options.h"
+#include "hash.h"
 #include "usage.h"
 #include "util.h"
 
 #include <iostream>
 #include <algorithm>
 #include <filesystem>
+#include <thread>
 ///////////////////////////////////////////////////////////////////////////////
 namespace Treehash {
 
@@ -52,6 +54,35 @@ std::string AbsolutePath( std::string input ) {
    }
 }
 
+//-----------------------------------------------------------------------------
+// The statfs f_type of a filesystem named for --skip-fs, or 0 if it isn't
+//  one we know. A number in hex, like "0x6969", is taken as it is.
+static uint32_t FilesystemType( const std::string &name ) {
+   static const struct { const char *name; uint32_t type; } TYPES[] = {
+      { "9p",       0x01021997 }, { "afs",     0x5346414F },
+      { "autofs",   0x00000187 }, { "ceph",    0x00C36400 },
+      { "cgroup2",  0x63677270 }, { "cifs",    0xFF534D42 },
+      { "debugfs",  0x64626720 }, { "devpts",  0x00001CD1 },
+      { "fuse",     0x65735546 }, { "iso9660", 0x00009660 },
+      { "nfs",      0x00006969 }, { "overlay", 0x794C7630 },
+      { "proc",     0x00009FA0 }, { "smb2",    0xFE534D42 },
+      { "squashfs", 0x73717368 }, { "sysfs",   0x62656572 },
+      { "tmpfs",    0x01021994 }, { "tracefs", 0x74726163 },
+   };
+   for( auto &known : TYPES ) {
+      if( name == known.name ) return known.type;
+   }
+   if( name.size() > 2 && name[0] == '0' && (name[1] == 'x' || name[1] == 'X')
+         && name.find_first_not_of( "0123456789abcdefABCDEF", 2 )
+            == name.npos ) {
+      try {
+         return (uint32_t)std::stoul( name, nullptr, 16 );
+      } catch( std::logic_error & ) {
+      }
+   }
+   return 0;
+}
+
 //-----------------------------------------------------------------------------
 void ReadOption( ArgIterator &args ) {
    if( args.End() ) return;
@@ -68,6 +99,24 @@ void ReadOption( ArgIterator &args ) {
             std::cout << "Invalid base path.\n";
             std::exit( 1 );
          }
+      } else if( arg == "--cache" || arg == "-c" ) {
+         opt_cache_file = AbsolutePath( args.Get() );
+         if( opt_cache_file.empty() ) {
+            std::cout << "Invalid cache file path.\n";
+            std::exit( 1 );
+         }
+      } else if( arg == "--manifest" || arg == "-o" ) {
+         opt_manifest_file = AbsolutePath( args.Get() );
+         if( opt_manifest_file.empty() ) {
+            std::cout << "Invalid manifest file path.\n";
+            std::exit( 1 );
+         }
+      } else if( arg == "--history" || arg == "-p" ) {
+         opt_history_file = AbsolutePath( args.Get() );
+         if( opt_history_file.empty() ) {
+            std::cout << "Invalid history file path.\n";
+            std::exit( 1 );
+         }
       } else if( arg == "--help" || arg == "-h" ) {
          PrintUsage();
          std::exit( 0 );
@@ -75,21 +124,118 @@ void ReadOption( ArgIterator &args ) {
          SplitForeach( args.Get(), "|", []( std::string &a ) {
             opt_exts.push_back( a );
          });
+      } else if( arg == "--exts-nocase" || arg == "-E" ) {
+         opt_exts_nocase = true;
       } else if( arg == "--ignore" || arg == "-i" ) {
          SplitForeach( args.Get(), "|", []( std::string &a ) {
             opt_ignores.push_back( a );
          });
+      } else if( arg == "--filter" || arg == "-f" ) {
+         opt_filters.push_back( args.Get() );
+      } else if( arg == "--gitignore" || arg == "-g" ) {
+         opt_gitignore = true;
       } else if( arg == "--verbose" || arg == "-v" ) {
          opt_verbose = true;
          opt_print_time = true;
       } else if( arg == "--symlinks" || arg == "-m" ) {
-         opt_symlinks = true;
+         // On its own, it follows them, which is the default anyway.
+         opt_symlinks = Symlinks::FOLLOW;
+      } else if( arg.rfind( "--symlinks=", 0 ) == 0 ) {
+         std::string mode = arg.substr( arg.find( '=' ) + 1 );
+         if( mode == "ignore" ) {
+            opt_symlinks = Symlinks::SKIP;
+         } else if( mode == "follow" ) {
+            opt_symlinks = Symlinks::FOLLOW;
+         } else if( mode == "once" ) {
+            opt_symlinks = Symlinks::ONCE;
+         } else {
+            std::cout << "Unknown symlink mode: " << mode << "\n";
+            std::exit( 1 );
+         }
+      } else if( arg == "--one-file-system" || arg == "-X" ) {
+         opt_one_file_system = true;
+      } else if( arg == "--skip-fs" || arg == "-S" ) {
+         SplitForeach( args.Get(), "|", []( std::string &a ) {
+            uint32_t type = FilesystemType( a );
+            if( type == 0 ) {
+               std::cout << "Unknown filesystem type: " << a << "\n";
+               std::exit( 1 );
+            }
+            opt_skip_fs.push_back( type );
+         });
       } else if( arg == "--time" || arg == "-t" ) {
          opt_print_time = true;
+      } else if( arg == "--scanner" || arg == "-s" ) {
+         opt_scanner = args.Get();
+      } else if( arg == "--hash" || arg == "-H" ) {
+         std::string version = args.Get();
+         try {
+            opt_hash_version = std::stoi( version );
+         } catch( std::logic_error & ) {
+            opt_hash_version = 0;
+         }
+         if( opt_hash_version < 1 || opt_hash_version > HASH_VERSION_MAX ) {
+            std::cout << "Unknown hash version: " << version << "\n";
+            std::exit( 1 );
+         }
+      } else if( arg == "--max-depth" || arg == "-d" ) {
+         std::string depth = args.Get();
+         try {
+            opt_max_depth = std::stoi( depth );
+         } catch( std::logic_error & ) {
+            opt_max_depth = -1;
+         }
+         if( opt_max_depth < 0 ) {
+            std::cout << "Invalid depth: " << depth << "\n";
+            std::exit( 1 );
+         }
+      } else if( arg == "--max-open" || arg == "-O" ) {
+         std::string count = args.Get();
+         try {
+            opt_max_open = std::stoi( count );
+         } catch( std::logic_error & ) {
+            opt_max_open = -1;
+         }
+         // The root and the two directories on top are always open.
+         if( opt_max_open < 3 ) {
+            std::cout << "Invalid open directory limit: " << count << "\n";
+            std::exit( 1 );
+         }
+      } else if( arg == "--deadline" || arg == "-D" ) {
+         std::string ms = args.Get();
+         try {
+            opt_deadline_ms = std::stoi( ms );
+         } catch( std::logic_error & ) {
+            opt_deadline_ms = 0;
+         }
+         if( opt_deadline_ms <= 0 ) {
+            std::cout << "Invalid deadline: " << ms << "\n";
+            std::exit( 1 );
+         }
+      } else if( arg == "--skip-marked" || arg == "-x" ) {
+         opt_skip_marked = true;
+      } else if( arg == "--jobs" || arg == "-j" ) {
+         std::string jobs = args.Get();
+         try {
+            opt_jobs = std::stoi( jobs );
+         } catch( std::logic_error & ) {
+            opt_jobs = -1;
+         }
+         if( opt_jobs < 0 ) {
+            std::cout << "Invalid job count: " << jobs << "\n";
+            std::exit( 1 );
+         }
+         if( opt_jobs == 0 ) {
+            opt_jobs = std::max( 1u, std::thread::hardware_concurrency() );
+         }
       } else {
          std::cout << "Unknown arg: " << arg << "\n";
          std::exit( 1 );
       }
+   } else if( arg[0] == '!' ) {
+      // Exclude pattern. These match the paths as they're hashed, so they
+      //  aren't made absolute.
+      opt_excludes.push_back( arg.substr( 1 ));
    } else {
       // Input.
       std::string path = AbsolutePath( arg );
@@ -108,6 +254,17 @@ void ReadOption( ArgIterator &args ) {
 void ReadOptions( int argc, char *argv[] ) {
    ArgIterator args( argc, argv );
    try {
+      // Subcommands go before any options.
+      std::string command = argc > 1 ? argv[1] : "";
+      if( command == "diff" || command == "verify" ) {
+         args.Get();
+         std::string manifest = AbsolutePath( args.Get() );
+         if( manifest.empty() ) {
+            std::cout << "Invalid manifest file path.\n";
+            std::exit( 2 );
+         }
+         (command == "diff" ? opt_diff_file : opt_verify_file) = manifest;
+      }
       ReadOption( args );
    } catch( NoMoreArgs& ) {
       std::cout << "Missing expected argument after " << args.GetLast();
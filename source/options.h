@@ -2,6 +2,7 @@
 ///////////////////////////////////////////////////////////////////////////////
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -12,13 +13,64 @@ void ReadOptions( int argc, char **argv );
 
 inline bool opt_print_time     = false;
 inline bool opt_verbose        = false;
-inline bool opt_symlinks       = false;
+inline bool opt_exts_nocase    = false;
+inline bool opt_gitignore      = false;
+inline bool opt_skip_marked    = false;
+inline int  opt_jobs           = 1;
+inline int  opt_hash_version   = 1;
+// How many levels below each root a recursive scan goes, or -1 for all.
+inline int  opt_max_depth      = -1;
+// How many directories a scanner keeps open at once on the way down. Deeper
+//  trees close the ones furthest up and open them again later.
+inline int  opt_max_open       = 256;
+// What's done with symlinks, from -m or --symlinks. They've always been
+//  followed, so that's still the default.
+enum class Symlinks {
+   // They're left out, like anything else that isn't a file or a directory.
+   SKIP,
+   // They're followed, except to a directory that the link is already
+   //  inside of, which would go around forever.
+   FOLLOW,
+   // Like FOLLOW, but no directory is read twice under a root.
+   ONCE
+};
+inline Symlinks opt_symlinks = Symlinks::FOLLOW;
+// How long the scan has, from --deadline, or 0 for no limit.
+inline int  opt_deadline_ms    = 0;
+// Set to stay on the filesystem of each root, from --one-file-system.
+inline bool opt_one_file_system = false;
+// The statfs f_type numbers of filesystems whose mount points are left out,
+//  from --skip-fs.
+inline std::vector<uint32_t> opt_skip_fs;
 //inline bool opt_ignore_missing = false;
 inline std::string opt_basepath;
+inline std::string opt_cache_file;
+inline std::string opt_manifest_file;
+// Where the parallel scanner keeps what subtrees cost last time, from
+//  --history.
+inline std::string opt_history_file;
+// Set by the "diff" and "verify" subcommands.
+inline std::string opt_diff_file;
+inline std::string opt_verify_file;
 inline std::vector<std::string> opt_inputs;
 
 inline std::vector<std::string> opt_exts;
 inline std::vector<std::string> opt_ignores;
+// Glob patterns given with "!" in front, which exclude what they match from
+//  every input.
+inline std::vector<std::string> opt_excludes;
+// Filter expressions that files have to match, from -f.
+inline std::vector<std::string> opt_filters;
+
+// The scanner used to walk the directories. Defaults to the fastest one
+//  available on the platform.
+#if defined( TARGET_WINDOWS )
+inline std::string opt_scanner{ "fastwin" };
+#elif defined( TARGET_LINUX )
+inline std::string opt_scanner{ "linux" };
+#else
+inline std::string opt_scanner{ "default" };
+#endif
 
 //-----------------------------------------------------------------------------
 // Static options:
@@ -0,0 +1,1114 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+// Linux only.
+#ifdef TARGET_LINUX
+
+#include "hash.h"
+#include "scanner.h"
+#include "options.h"
+#include "name_filter.h"
+#include "linux_dir.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+// A multithreaded version of the Linux scanner. Nearly all of the time spent
+//  scanning is waiting on the kernel, so we keep several directory reads in
+//  flight at once.
+// Each worker has its own deque of pending work. Workers push and pop at the
+//  back of their own deque, which keeps them going depth-first, and steal
+//  from the front of the others' when they run dry, which takes the oldest
+//  and usually largest subtrees. Files are XORed into a per-worker hash, and
+//  those are combined at the end. XOR doesn't care about order, so the result
+//  is the same as the single-threaded scanners.
+// All of the roots are fed to the same pool, so a lot of small inputs are
+//  spread across the workers just like subdirectories are.
+// With a history from earlier runs, subtrees that took long last time are
+//  put at the front of the deques, most expensive first, so that they're
+//  stolen and split up early instead of being left for one worker at the end.
+// Like the Linux scanner, the loop over entries is instantiated for VERBOSE,
+//  recursion, and whether there are extensions or ignores to check.
+template< bool VERBOSE >
+class ParallelScanner : public Scanner {
+//-----------------------------------------------------------------------------
+   // When symlinks are followed, the DirIds of a directory and of the ones
+   //  on the way down to it, from "/", so that a link back up can be seen.
+   struct Lineage {
+      DirId id;
+      // True if it was opened through a symlink.
+      bool link;
+      std::shared_ptr<const Lineage> up;
+   };
+
+   // An open directory. Children are opened relative to it, so it stays open
+   //  until the last task that refers to it is done.
+   // Directories that came from the cache aren't opened at all. Those have
+   //  an `fd` of -1, and their children are opened relative to `anchor`, the
+   //  nearest directory above them that is held open. Past --max-open, new
+   //  directories are the same, except that they're open while they're read.
+   struct Directory {
+      int fd;
+      // True if it stays open for its children. Counted in `holds`.
+      bool held = true;
+      std::atomic<int> *holds = nullptr;
+      // Path used for hashing, with a trailing slash.
+      std::string path;
+      // Index of the root that this is under.
+      size_t root;
+      // How far below the root it is.
+      int level = 0;
+      // DirectorySeed of `path`.
+      Hash seed;
+      // Where this is in the ignore trie.
+      const IgnoreNode *ignore = nullptr;
+      const GlobState *glob = nullptr;
+      GitFramePtr git;
+      std::shared_ptr<Directory> anchor;
+      // Set when symlinks are followed.
+      std::shared_ptr<const Lineage> lineage;
+      // True if it or a directory above it was opened through a symlink.
+      bool linked = false;
+      // The device it's on, when mount points are looked for.
+      uint64_t dev = 0;
+      //-----------------------------------------------------------------------
+      // When the cache or a manifest is on, what we find in the directory
+      //  is collected here. It can be read by several workers if it's large,
+      //  so it's stored by whichever finishes last.
+      bool record = false;
+      DirStamp stamp;
+      std::atomic<Hash> files{ 0 };
+      std::atomic<int> readers{ 1 };
+      std::mutex record_mutex;
+      std::vector<DirCacheEntry::Subdir> subdirs;
+      std::string names;
+      // With a history, what reading the directory cost, from all of its
+      //  readers.
+      std::atomic<uint64_t> ns{ 0 };
+      std::atomic<uint64_t> entries{ 0 };
+
+      Directory( int fd, std::string path, size_t root, Hash seed ) noexcept
+         : fd( fd ), path( std::move( path )), root( root ), seed( seed ) {}
+      ~Directory() noexcept {
+         if( fd >= 0 ) close( fd );
+         if( holds ) (*holds)--;
+      }
+   };
+
+   //--------------------------------------------------------------------------
+   // A unit of work. If `name` is set, this is a subdirectory of `dir` that
+   //  still needs to be opened and scanned. If `entries` is set, it's a batch
+   //  of getdents64 records from `dir` that were split off from a large
+   //  directory so that other workers can share it. Otherwise, `dir` itself
+   //  is waiting to be scanned.
+   struct Task {
+      std::shared_ptr<Directory> dir;
+      std::string name;
+      bool follow = false;
+      // The GlobState of the subdirectory `name`.
+      const GlobState *glob = nullptr;
+      std::vector<char> entries;
+      // What the subtree cost last time, from the history, or 0.
+      uint64_t cost = 0;
+   };
+
+   //--------------------------------------------------------------------------
+   struct Worker {
+      std::mutex mutex;
+      std::deque<Task> tasks;
+      // The hash of the files this worker has seen, for each root.
+      std::vector<Hash> hashes;
+      ScanStats stats;
+      // Mount points left out with --one-file-system or --skip-fs.
+      std::vector<std::string> mounts;
+      // With --deadline, the path of the task being run, which is only
+      //  changed with `mutex` held, for GetUnfinished.
+      std::string running;
+      // Scratch space for building paths and reading directories.
+      std::string path;
+      std::string names;
+      NameBatch batch;
+      std::unique_ptr<char[]> buffer{ new char[LinuxDir::DIRBUFSIZE] };
+   };
+
+   //--------------------------------------------------------------------------
+   NameFilter m_filter;
+   int m_jobs;
+   // Optional cache of directory contents from earlier runs.
+   DirCache *m_cache = nullptr;
+   // Optional manifest that every directory is added to.
+   Manifest *m_manifest = nullptr;
+   // Set if .gitignore files are honoured.
+   GitIgnore *m_gitignore = nullptr;
+   // Optional filter on the files' metadata.
+   const FilterExpression *m_expr = nullptr;
+   // Optional costs of earlier runs, which this one's are added to.
+   ScanHistory *m_history = nullptr;
+   // The roots being scanned.
+   std::vector<ScanRoot> *m_roots = nullptr;
+   // With --symlinks once, the directories read under each root, and the
+   //  roots' DirIds.
+   std::vector<std::unique_ptr<VisitedSet>> m_visited;
+   std::vector<DirId> m_root_ids;
+   // With --symlinks once, the links to directories under each root that
+   //  haven't been gone into yet, by path. They're taken after the rest of
+   //  the roots are done, one for each root at a time from the smallest
+   //  path, so which link reads a directory doesn't depend on which worker
+   //  finds it first. That's the order the Linux scanner goes in too.
+   mutable std::mutex m_deferred_mutex;
+   std::vector<std::map<std::string, Task>> m_deferred;
+   std::vector<std::unique_ptr<Worker>> m_workers;
+   // How many directories are held open for their children, and how many
+   //  can be, from --max-open and the descriptor limit.
+   std::atomic<int> m_holds{ 0 };
+   int m_hold_limit = 0;
+   // How many times an open that ran out of descriptors is tried again,
+   //  10ms apart, before giving up.
+   static constexpr int OPEN_TRIES = 200;
+   //--------------------------------------------------------------------------
+   // Tasks that have been pushed but not finished yet. The scan is done when
+   //  this drops to zero.
+   std::atomic<size_t> m_pending{ 0 };
+   // Tasks that are sitting in a deque, so idle workers know when to wake.
+   std::atomic<size_t> m_queued{ 0 };
+   std::atomic<int> m_sleepers{ 0 };
+   // With --deadline, how many tasks each root has that aren't finished,
+   //  plus one until it's been dealt out.
+   std::unique_ptr<std::atomic<size_t>[]> m_root_pending;
+   std::atomic<bool> m_tracking{ false };
+   std::mutex m_idle_mutex;
+   std::condition_variable m_idle_cv;
+   //--------------------------------------------------------------------------
+   // Keeps verbose output from different workers from interleaving.
+   std::mutex m_output_mutex;
+   //--------------------------------------------------------------------------
+   ScanStats m_stats;
+   std::vector<std::string> m_mounts;
+   //--------------------------------------------------------------------------
+   // The versions of ScanEntries for the filters we have, from SelectScan,
+   //  for directories whose subdirectories are scanned and ones whose aren't.
+   using ScanFunction = void (ParallelScanner::*)( Worker&,
+                           const std::shared_ptr<Directory>&, const char*,
+                           long );
+   ScanFunction m_scan_recursive = nullptr;
+   ScanFunction m_scan_flat = nullptr;
+
+   //--------------------------------------------------------------------------
+   void Push( Worker &self, Task &&task ) noexcept {
+      m_pending++;
+      if( opt_deadline_ms > 0 ) m_root_pending[task.dir->root]++;
+      {
+         std::lock_guard<std::mutex> lock( self.mutex );
+         if( task.cost == 0 ) {
+            self.tasks.push_back( std::move( task ));
+         } else {
+            // Ahead of anything cheaper, which is everything from the first
+            //  task without a cost on.
+            auto it = std::find_if( self.tasks.begin(), self.tasks.end(),
+                                    [&task]( const Task &queued ) {
+               return queued.cost < task.cost;
+            });
+            self.tasks.insert( it, std::move( task ));
+         }
+      }
+      m_queued++;
+      if( m_sleepers > 0 ) {
+         std::lock_guard<std::mutex> lock( m_idle_mutex );
+         m_idle_cv.notify_one();
+      }
+   }
+
+   //--------------------------------------------------------------------------
+   // Pushes `task` for the subdirectory at `path`, or puts it off if it's a
+   //  link and --symlinks once is on.
+   void PushSubdirectory( Worker &self, Task &&task,
+                          const std::string &path ) noexcept {
+      if( task.follow && opt_symlinks == Symlinks::ONCE ) {
+         size_t root = task.dir->root;
+         // Its root isn't finished until it's been gone into.
+         if( opt_deadline_ms > 0 ) m_root_pending[root]++;
+         std::lock_guard<std::mutex> lock( m_deferred_mutex );
+         m_deferred[root].emplace( path, std::move( task ));
+         return;
+      }
+      if( m_history ) task.cost = m_history->Nanoseconds( path );
+      Push( self, std::move( task ));
+   }
+
+   //--------------------------------------------------------------------------
+   // Deals out the first link that each root put off. Returns false if there
+   //  weren't any.
+   bool PushDeferred() noexcept {
+      std::lock_guard<std::mutex> lock( m_deferred_mutex );
+      size_t count = 0;
+      for( size_t i = 0; i < m_deferred.size(); i++ ) {
+         if( m_deferred[i].empty() ) continue;
+         auto next = m_deferred[i].extract( m_deferred[i].begin() );
+         Push( *m_workers[count++ % m_workers.size()],
+               std::move( next.mapped() ));
+         if( opt_deadline_ms > 0 ) m_root_pending[i]--;
+      }
+      return count > 0;
+   }
+
+   //--------------------------------------------------------------------------
+   bool Pop( Worker &self, Task &task ) noexcept {
+      std::lock_guard<std::mutex> lock( self.mutex );
+      if( self.tasks.empty() ) return false;
+      task = std::move( self.tasks.back() );
+      self.tasks.pop_back();
+      m_queued--;
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   bool Steal( Worker &self, Task &task ) noexcept {
+      size_t count = m_workers.size();
+      size_t start = &self - m_workers[0].get();
+      for( size_t i = 1; i < count; i++ ) {
+         Worker &victim = *m_workers[(start + i) % count];
+         std::lock_guard<std::mutex> lock( victim.mutex );
+         if( victim.tasks.empty() ) continue;
+         task = std::move( victim.tasks.front() );
+         victim.tasks.pop_front();
+         m_queued--;
+         return true;
+      }
+      return false;
+   }
+
+   //--------------------------------------------------------------------------
+   // Blocks until there is a task for `self` to run. Returns false when the
+   //  scan is finished.
+   bool TakeTask( Worker &self, Task &task ) noexcept {
+      for(;;) {
+         if( Pop( self, task )) return true;
+         if( Steal( self, task )) return true;
+
+         std::unique_lock<std::mutex> lock( m_idle_mutex );
+         m_sleepers++;
+         m_idle_cv.wait( lock, [this] {
+            return m_queued > 0 || m_pending == 0;
+         });
+         m_sleepers--;
+         if( m_pending == 0 ) return false;
+      }
+   }
+
+   //--------------------------------------------------------------------------
+   // Checks a file in the open directory `fd` against the filter expression,
+   //  only statting it if its name and type don't settle it. `link` is set
+   //  if the entry is a symlink.
+   bool MatchExpression( Worker &self, int fd, const LinuxDir::Dirent64 *entry,
+                         std::string_view name, bool link ) noexcept {
+      int match = m_expr->MatchName( name, link );
+      if( match >= 0 ) return match > 0;
+      self.stats.stats++;
+      FileMeta meta;
+      if( !LinuxDir::StatFile( fd, entry->d_name, m_expr->Needs(), meta ))
+         return false;
+      return m_expr->Match( name, link, meta );
+   }
+
+   //--------------------------------------------------------------------------
+   // True if the subdirectories of `dir` are scanned.
+   bool Descends( const Directory &dir ) const noexcept {
+      return (*m_roots)[dir.root].recursive && WithinMaxDepth( dir.level );
+   }
+
+   //--------------------------------------------------------------------------
+   // Walks a batch of getdents64 records from `dir`. Files are hashed
+   //  together at the end, and subdirectories are pushed as new tasks.
+   //  RECURSIVE is Descends( *dir ). Called through ScanBatch, which picks
+   //  the right version.
+   template< bool RECURSIVE, bool EXTS, bool IGNORES >
+   void ScanEntries( Worker &self, const std::shared_ptr<Directory> &dir,
+                     const char *buffer, long size ) noexcept {
+      using namespace LinuxDir;
+      std::string &path = self.path;
+      size_t path_start = dir->path.size();
+      path.assign( dir->path );
+      Hash &hash = self.hashes[dir->root];
+      // File names for the manifest are gathered here first, so the
+      //  directory is only locked once per batch.
+      std::string &names = self.names;
+      names.clear();
+      NameBatch &batch = self.batch;
+      auto hash_batch = [&]() {
+         if( batch.count == 0 ) return;
+         Hash files = HashBatch( batch, dir->path, dir->seed );
+         hash ^= files;
+         if( dir->record ) dir->files ^= files;
+      };
+
+      for( long bpos = 0; bpos < size; ) {
+         auto *entry = reinterpret_cast<const Dirent64*>( buffer + bpos );
+         bpos += entry->d_reclen;
+
+         // This also takes care of "." and "..".
+         if( entry->d_name[0] == '.' ) continue;
+
+         path.resize( path_start );
+         path.append( entry->d_name );
+         self.stats.entries++;
+
+         char type = EntryType( entry );
+         bool link = false;
+         if( type == '?' ) {
+            if( entry->d_type == DT_LNK && opt_symlinks == Symlinks::SKIP )
+               continue;
+            if constexpr( !VERBOSE ) {
+               if( m_filter.IsExcludedByName<EXTS, IGNORES>(
+                              path, path_start, RECURSIVE, dir->ignore ))
+                  continue;
+            }
+            self.stats.stats++;
+            type = StatType( dir->fd, entry,
+                             opt_symlinks != Symlinks::SKIP, link );
+         }
+
+         std::string_view name = std::string_view( path ).substr( path_start );
+         if( type == 'd' && RECURSIVE ) {
+            if( m_filter.IsExcluded<false, IGNORES>( path, path_start, true,
+                                                    dir->ignore ))
+               continue;
+            const GlobState *glob = GlobMatcher::Child( dir->glob, name );
+            if( GlobMatcher::Skip( glob )) continue;
+            if( dir->git && GitIgnore::IsIgnored( dir->git.get(), path,
+                                                  path_start, true ))
+               continue;
+            bool follow = link;
+            // Marked ones stay in the cache, so that taking the marker out
+            //  is noticed. Cache hits check them again.
+            if( dir->record ) {
+               std::lock_guard<std::mutex> lock( dir->record_mutex );
+               dir->subdirs.push_back({ entry->d_name, follow });
+            }
+            path.push_back( '/' );
+            // Before the marker is looked for, which would go past it.
+            if( ChecksMounts() && SkipsMount( self, dir->dev, dir->fd,
+                                              path_start, follow ))
+               continue;
+            if( opt_skip_marked && IsMarked( dir->fd, path, path_start )) {
+               if constexpr( VERBOSE ) {
+                  std::lock_guard<std::mutex> lock( m_output_mutex );
+                  std::cout << " - " << path << " (marked)\n";
+               }
+               continue;
+            }
+            PushSubdirectory( self, Task{ dir, entry->d_name, follow, glob,
+                                          {}, 0 }, path );
+         } else if( type == 'f' ) {
+            if( m_filter.IsExcluded<EXTS, IGNORES>( path, path_start, false,
+                                                   dir->ignore )
+                        || !GlobMatcher::MatchFile( dir->glob, name )
+                        || (dir->git && GitIgnore::IsIgnored( dir->git.get(),
+                                          path, path_start, false ))
+                        || (m_expr && !MatchExpression( self, dir->fd, entry,
+                                                        name, link ))) {
+               if constexpr( VERBOSE ) {
+                  std::lock_guard<std::mutex> lock( m_output_mutex );
+                  std::cout << "   " << path << "\n";
+               }
+               continue;
+            }
+
+            if( batch.Full() ) hash_batch();
+            batch.Add({ entry->d_name, name.size() });
+            if( dir->record && m_manifest ) {
+               names.append( entry->d_name, name.size() + 1 );
+            }
+
+            if constexpr( VERBOSE ) {
+               std::lock_guard<std::mutex> lock( m_output_mutex );
+               std::cout << " * " << path << "\n";
+            }
+         }
+      }
+      hash_batch();
+
+      if( !names.empty() ) {
+         std::lock_guard<std::mutex> lock( dir->record_mutex );
+         dir->names.append( names );
+      }
+   }
+
+   //--------------------------------------------------------------------------
+   // Runs the version of ScanEntries that fits `dir`.
+   void ScanBatch( Worker &self, const std::shared_ptr<Directory> &dir,
+                   const char *buffer, long size ) noexcept {
+      ScanFunction scan = Descends( *dir ) ? m_scan_recursive : m_scan_flat;
+      (this->*scan)( self, dir, buffer, size );
+   }
+
+   //--------------------------------------------------------------------------
+   template< bool RECURSIVE >
+   ScanFunction PickScan() const noexcept {
+      if( m_filter.HasExts() ) {
+         if( m_filter.HasIgnores() )
+            return &ParallelScanner::ScanEntries<RECURSIVE, true, true>;
+         return &ParallelScanner::ScanEntries<RECURSIVE, true, false>;
+      }
+      if( m_filter.HasIgnores() )
+         return &ParallelScanner::ScanEntries<RECURSIVE, false, true>;
+      return &ParallelScanner::ScanEntries<RECURSIVE, false, false>;
+   }
+
+   //--------------------------------------------------------------------------
+   // Called from the constructor. The filter is set from the options once
+   //  and doesn't change after that.
+   void SelectScan() noexcept {
+      m_scan_recursive = PickScan<true>();
+      m_scan_flat = PickScan<false>();
+   }
+
+   //--------------------------------------------------------------------------
+   // Reads a whole directory. The first batch of records is walked here.
+   //  If there is more than that, it's a large directory, and the remaining
+   //  batches are pushed as separate tasks for other workers to pick up.
+   void ScanDirectory( Worker &self,
+                       const std::shared_ptr<Directory> &dir ) noexcept {
+      char *buffer = self.buffer.get();
+      bool first = true;
+      auto start = std::chrono::steady_clock::now();
+      size_t entries = self.stats.entries;
+
+      for(;;) {
+         long nread = LinuxDir::ReadEntries( dir->fd, buffer,
+                                             LinuxDir::DIRBUFSIZE );
+         if( nread < 0 ) LinuxDir::CheckReadError( dir->path, errno );
+         if( nread <= 0 ) break;
+
+         // Directories that aren't held are closed right after, so only
+         //  this worker reads them.
+         if( first || m_jobs == 1 || !dir->held ) {
+            ScanBatch( self, dir, buffer, nread );
+            first = false;
+         } else {
+            Task chunk;
+            chunk.dir = dir;
+            chunk.entries.assign( buffer, buffer + nread );
+            if( dir->record || m_history ) dir->readers++;
+            Push( self, std::move( chunk ));
+         }
+      }
+      Charge( self, *dir, start, entries );
+      if( !dir->held ) {
+         // Its subdirectories are opened from its anchor.
+         close( dir->fd );
+         dir->fd = -1;
+      }
+      FinishReading( self, *dir );
+   }
+
+   //--------------------------------------------------------------------------
+   // With a history, adds the time since `start` and the entries counted
+   //  since `entries` to what `dir` cost.
+   void Charge( Worker &self, Directory &dir,
+                std::chrono::steady_clock::time_point start,
+                size_t entries ) noexcept {
+      if( !m_history ) return;
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      dir.ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   elapsed ).count();
+      dir.entries += self.stats.entries - entries;
+   }
+
+   //--------------------------------------------------------------------------
+   // Called when a worker is done with its part of a directory. The last one
+   //  records the directory in the cache and the manifest.
+   void FinishReading( Worker &self, Directory &dir ) noexcept {
+      if( !(dir.record || m_history) || --dir.readers > 0 ) return;
+      if( m_history ) m_history->Add( dir.path, { dir.ns, dir.entries });
+      if( !dir.record ) return;
+
+      DirCacheEntry entry;
+      entry.stamp     = dir.stamp;
+      entry.files     = dir.files;
+      entry.recursive = Descends( dir );
+      entry.subdirs   = std::move( dir.subdirs );
+      entry.filter    = FilterKey( dir.glob, dir.git.get() );
+      entry.named     = m_manifest != nullptr;
+      entry.names     = std::move( dir.names );
+      auto ptr = std::make_shared<const DirCacheEntry>( std::move( entry ));
+      if( m_manifest ) m_manifest->Add( dir.path, ptr );
+      if( m_cache ) {
+         self.stats.cache_misses++;
+         m_cache->Store( dir.path, std::move( ptr ));
+      }
+   }
+
+   //--------------------------------------------------------------------------
+   // Uses what the cache knows about `dir` instead of reading it.
+   void ScanCached( Worker &self, const std::shared_ptr<Directory> &dir,
+                    const DirEntryPtr &cached ) noexcept {
+      const DirCacheEntry &entry = *cached;
+      self.stats.cache_hits++;
+      if constexpr( VERBOSE ) {
+         std::lock_guard<std::mutex> lock( m_output_mutex );
+         std::cout << " = " << dir->path << " (cached)\n";
+      }
+      if( m_manifest ) m_manifest->Add( dir->path, cached );
+
+      self.hashes[dir->root] ^= entry.files;
+      if( !Descends( *dir )) return;
+      // Markers are looked for relative to the nearest open directory.
+      const Directory &anchor = dir->held ? *dir : *dir->anchor;
+      std::string &path = self.path;
+      for( auto &sub : entry.subdirs ) {
+         path.assign( dir->path );
+         path.append( sub.name );
+         path.push_back( '/' );
+         if( ChecksMounts() && SkipsMount( self, dir->dev, anchor.fd,
+                                           anchor.path.size(), sub.follow ))
+            continue;
+         if( opt_skip_marked
+               && LinuxDir::IsMarked( anchor.fd, path, anchor.path.size() ))
+            continue;
+         PushSubdirectory( self, Task{ dir, sub.name, sub.follow,
+                                       GlobMatcher::Child( dir->glob,
+                                                           sub.name ),
+                                       {}, 0 }, path );
+      }
+   }
+
+   //--------------------------------------------------------------------------
+   // True if the subdirectory at the end of `self.path`, which ends with a
+   //  slash, is a mount point that's left out. It's looked up relative to
+   //  `at`, from `at_start` on. `dev` is the device of the directory it's
+   //  in, and `follow` is set if it's a symlink.
+   bool SkipsMount( Worker &self, uint64_t dev, int at, size_t at_start,
+                    bool follow ) noexcept {
+      std::string &path = self.path;
+      path.back() = 0;
+      const char *reason = LinuxDir::SkipsMount( at, path.c_str() + at_start,
+                                                 follow, dev );
+      path.back() = '/';
+      if( !reason ) return false;
+      if constexpr( VERBOSE ) {
+         std::lock_guard<std::mutex> lock( m_output_mutex );
+         std::cout << " - " << path << " (" << reason << ")\n";
+      }
+      self.mounts.push_back( path + " (" + reason + ")" );
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   // Checks the directory `id`, the subdirectory of `parent` at `name`
+   //  relative to `at`, when symlinks are followed. It's left out if it's
+   //  read somewhere else. `follow` is set if it's a link. Returns why it's
+   //  left out, or null if it isn't.
+   const char *Revisits( const Directory &parent, bool follow, const DirId &id,
+                         int at, const char *name ) noexcept {
+      if( follow ) {
+         for( const Lineage *up = parent.lineage.get(); up;
+              up = up->up.get() ) {
+            if( up->id == id ) return "symlink loop";
+         }
+      }
+      if( opt_symlinks != Symlinks::ONCE || !(follow || parent.linked) )
+         return nullptr;
+      if( follow ) {
+         // A link into the root, or into a directory that a link on the way
+         //  down goes to, is left for the directory's own path, which is the
+         //  same whichever worker gets there first.
+         std::vector<DirId> tops{ m_root_ids[parent.root] };
+         for( const Lineage *up = parent.lineage.get(); up;
+              up = up->up.get() ) {
+            if( up->link ) tops.push_back( up->id );
+         }
+         int fd = openat( at, name, O_PATH | O_DIRECTORY | O_CLOEXEC );
+         bool inside = fd >= 0 && LinuxDir::IsInside( fd, tops );
+         if( fd >= 0 ) close( fd );
+         if( inside ) return "read where it is";
+      }
+      if( !m_visited[parent.root]->Insert( id )) return "read already";
+      return nullptr;
+   }
+
+   //--------------------------------------------------------------------------
+   // True if one more directory can be held open for its subdirectories.
+   bool TakeHold() noexcept {
+      if( m_holds++ < m_hold_limit ) return true;
+      m_holds--;
+      return false;
+   }
+
+   //--------------------------------------------------------------------------
+   // LinuxDir::OpenDirectory for the subdirectory at `path`. Running out of
+   //  descriptors is waited out for a while, since other workers close
+   //  theirs as they go. Other errors are checked with CheckOpenError.
+   int OpenDirectory( int at, const char *name, bool follow,
+                      std::string_view path ) noexcept {
+      for( int tries = 0;; tries++ ) {
+         int fd = LinuxDir::OpenDirectory( at, name, follow );
+         if( fd >= 0 ) return fd;
+         if( (errno != EMFILE && errno != ENFILE) || tries == OPEN_TRIES )
+            break;
+         std::this_thread::sleep_for( std::chrono::milliseconds( 10 ));
+      }
+      LinuxDir::CheckOpenError( path, errno );
+      return -1;
+   }
+
+   //--------------------------------------------------------------------------
+   // Opens or looks up the subdirectory named in `task`.
+   void VisitSubdirectory( Worker &self, Task &task ) noexcept {
+      Directory &parent = *task.dir;
+      int anchor = parent.fd;
+      std::string relative;
+      const char *name = task.name.c_str();
+      if( !parent.held ) {
+         anchor = parent.anchor->fd;
+         relative = parent.path.substr( parent.anchor->path.size() );
+         relative += task.name;
+         name = relative.c_str();
+      }
+
+      std::string path = parent.path + task.name + '/';
+      size_t root = parent.root;
+      Hash seed = SubdirectorySeed( parent.seed, task.name );
+      const IgnoreNode *ignore = m_filter.IgnoreChild( parent.ignore,
+                                                       task.name );
+      // The ignore files are read first, since the cache entry depends on
+      //  them too.
+      GitFramePtr git;
+      if( m_gitignore ) {
+         std::string file;
+         git = GitIgnore::Enter( parent.git, path.size(),
+                                 [&]( const char *file_name,
+                                      std::string &text ) {
+            file.assign( name );
+            file.push_back( '/' );
+            file.append( file_name );
+            return LinuxDir::ReadFile( anchor, file.c_str(), text );
+         });
+      }
+
+      bool symlinks = opt_symlinks != Symlinks::SKIP;
+      DirId id;
+      const char *skip = nullptr;
+      auto skipped = [&]() {
+         if constexpr( VERBOSE ) {
+            std::lock_guard<std::mutex> lock( m_output_mutex );
+            std::cout << " - " << path << " (" << skip << ")\n";
+         }
+      };
+      auto lineage = [&]() {
+         if( !symlinks ) return std::shared_ptr<const Lineage>();
+         return std::make_shared<const Lineage>( Lineage{ id, task.follow,
+                                                          parent.lineage });
+      };
+
+      DirStamp stamp;
+      if( m_cache ) {
+         if( !LinuxDir::StatDirectory( anchor, name, task.follow, stamp ))
+            return;
+         id = { stamp.dev, stamp.ino };
+         if( symlinks && (skip = Revisits( parent, task.follow, id, anchor,
+                                           name ))) {
+            skipped();
+            return;
+         }
+         bool recursive = (*m_roots)[root].recursive
+                          && WithinMaxDepth( parent.level + 1 );
+         DirEntryPtr entry = m_cache->Find( path, stamp, recursive,
+                                            FilterKey( task.glob, git.get() ));
+         if( entry ) {
+            // Its subdirectories are looked up relative to the same open
+            //  directory as it was. If that's too far up, it's opened, like
+            //  the Linux scanner does, so the paths stay inside of PATH_MAX.
+            int fd = -1;
+            if( recursive && !entry->subdirs.empty()
+                  && relative.size() >= LinuxDir::REACH ) {
+               fd = OpenDirectory( anchor, name, task.follow, path );
+               if( fd < 0 ) return;
+               m_holds++;
+            }
+            auto dir = std::make_shared<Directory>( fd, std::move( path ),
+                                                    root, seed );
+            dir->level = parent.level + 1;
+            dir->ignore = ignore;
+            dir->glob = task.glob;
+            dir->git = std::move( git );
+            if( fd >= 0 ) {
+               dir->holds = &m_holds;
+            } else {
+               dir->held = false;
+               dir->anchor = parent.held ? task.dir : parent.anchor;
+            }
+            dir->lineage = lineage();
+            dir->linked = task.follow || parent.linked;
+            dir->dev = stamp.dev;
+            task.dir.reset();
+            ScanCached( self, dir, entry );
+            return;
+         }
+      }
+
+      int fd = OpenDirectory( anchor, name, task.follow, path );
+      if( fd < 0 ) return;
+      if( symlinks && !m_cache ) {
+         skip = LinuxDir::DirectoryId( fd, "", id )
+                ? Revisits( parent, task.follow, id, anchor, name )
+                : "can't stat";
+         if( skip ) {
+            close( fd );
+            skipped();
+            return;
+         }
+      }
+      auto dir = std::make_shared<Directory>( fd, std::move( path ), root,
+                                              seed );
+      dir->level = parent.level + 1;
+      dir->ignore = ignore;
+      dir->glob = task.glob;
+      dir->git = std::move( git );
+      dir->record = m_cache || m_manifest;
+      dir->stamp = stamp;
+      dir->lineage = lineage();
+      dir->linked = task.follow || parent.linked;
+      // It's held open for its subdirectories while there's room, and when
+      //  it's too far below its anchor for them to be opened from there.
+      if( Descends( *dir ) && (relative.size() >= LinuxDir::REACH
+                               || TakeHold()) ) {
+         dir->holds = &m_holds;
+      } else {
+         dir->held = false;
+         dir->anchor = parent.held ? task.dir : parent.anchor;
+      }
+      if( ChecksMounts() ) {
+         // The cache or the symlink check may have looked it up already.
+         if( !m_cache && !symlinks ) LinuxDir::DirectoryId( fd, "", id );
+         dir->dev = id.dev;
+      }
+      // Let go of the parent so it can be closed sooner.
+      task.dir.reset();
+      ScanDirectory( self, dir );
+   }
+
+   //--------------------------------------------------------------------------
+   void RunTask( Worker &self, Task &task ) noexcept {
+      if( !task.name.empty() ) {
+         VisitSubdirectory( self, task );
+      } else if( !task.entries.empty() ) {
+         auto start = std::chrono::steady_clock::now();
+         size_t entries = self.stats.entries;
+         ScanBatch( self, task.dir, task.entries.data(),
+                    static_cast<long>(task.entries.size()) );
+         Charge( self, *task.dir, start, entries );
+         FinishReading( self, *task.dir );
+      } else {
+         ScanDirectory( self, task.dir );
+      }
+   }
+
+   //--------------------------------------------------------------------------
+   // The path of the subtree that `task` is part of.
+   static std::string TaskPath( const Task &task ) noexcept {
+      if( task.name.empty() ) return task.dir->path;
+      return task.dir->path + task.name + '/';
+   }
+
+   //--------------------------------------------------------------------------
+   void Work( Worker &self ) noexcept {
+      Task task;
+      while( TakeTask( self, task )) {
+         if( opt_deadline_ms == 0 ) {
+            RunTask( self, task );
+         } else {
+            size_t root = task.dir->root;
+            {
+               std::string path = TaskPath( task );
+               std::lock_guard<std::mutex> lock( self.mutex );
+               self.running = std::move( path );
+            }
+            RunTask( self, task );
+            {
+               std::lock_guard<std::mutex> lock( self.mutex );
+               self.running.clear();
+            }
+            m_root_pending[root]--;
+         }
+         task = Task();
+         if( --m_pending == 0 ) {
+            std::lock_guard<std::mutex> lock( m_idle_mutex );
+            m_idle_cv.notify_all();
+         }
+      }
+   }
+
+   //--------------------------------------------------------------------------
+   // Runs the workers until all pushed tasks are finished, and fills in the
+   //  roots' hashes. The calling thread works as the first worker.
+   void RunWorkers() noexcept {
+      std::vector<std::thread> threads;
+      for( size_t i = 1; i < m_workers.size(); i++ ) {
+         threads.emplace_back( [this, i] { Work( *m_workers[i] ); });
+      }
+      Work( *m_workers[0] );
+      for( auto &t : threads ) t.join();
+
+      for( auto &w : m_workers ) {
+         for( size_t i = 0; i < m_roots->size(); i++ ) {
+            (*m_roots)[i].hash ^= w->hashes[i];
+            w->hashes[i] = 0;
+         }
+         m_stats.entries      += w->stats.entries;
+         m_stats.stats        += w->stats.stats;
+         m_stats.cache_hits   += w->stats.cache_hits;
+         m_stats.cache_misses += w->stats.cache_misses;
+         w->stats = ScanStats();
+         m_mounts.insert( m_mounts.end(), w->mounts.begin(),
+                          w->mounts.end() );
+         w->mounts.clear();
+      }
+   }
+
+   //--------------------------------------------------------------------------
+   // Opens the root at index `i` and hands it to `worker`, or takes it from
+   //  the cache.
+   void DealRoot( size_t i, Worker &worker ) noexcept {
+      ScanRoot &root = (*m_roots)[i];
+      root.hash = 0;
+      if( root.path.empty() ) {
+         std::cout << "Invalid path given.\n";
+         return;
+      }
+      if( GlobMatcher::Skip( root.glob )) return;
+
+      std::string path = BasePrefix( root.path ) + root.path;
+      int fd = open( path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+      if( fd < 0 ) {
+         LinuxDir::CheckOpenError( path, errno );
+         return;
+      }
+      // Roots are always held.
+      m_holds++;
+
+      path = root.path;
+      // Same joining rule as std::filesystem::path::operator/.
+      if( path.back() != '/' ) path.push_back( '/' );
+
+      Hash seed = DirectorySeed( path );
+      auto dir = std::make_shared<Directory>( fd, std::move( path ), i,
+                                              seed );
+      dir->holds = &m_holds;
+      dir->ignore = m_filter.IgnoreRoot( dir->path );
+      dir->glob = root.glob;
+      if( m_gitignore ) {
+         dir->git = m_gitignore->Root( BasePrefix( root.path ) + root.path,
+                                       dir->path.size() );
+      }
+      if( opt_symlinks != Symlinks::SKIP ) {
+         std::vector<DirId> ids;
+         LinuxDir::PathIds( BasePrefix( root.path ) + root.path, ids );
+         for( auto &id : ids ) {
+            dir->lineage = std::make_shared<const Lineage>(
+                              Lineage{ id, false,
+                                       std::move( dir->lineage )});
+         }
+         LinuxDir::DirectoryId( fd, "", m_root_ids[i] );
+      }
+      if( ChecksMounts() ) {
+         DirId id;
+         LinuxDir::DirectoryId( fd, "", id );
+         dir->dev = id.dev;
+      }
+      if( opt_symlinks == Symlinks::ONCE ) {
+         m_visited.resize( m_roots->size() );
+         m_visited[i] = std::make_unique<VisitedSet>();
+         m_visited[i]->Insert( m_root_ids[i] );
+      }
+      if( m_cache ) {
+         if( !LinuxDir::StatDirectory( fd, "", true, dir->stamp ))
+            return;
+         DirEntryPtr entry = m_cache->Find( dir->path, dir->stamp,
+                                 root.recursive && WithinMaxDepth( 0 ),
+                                 FilterKey( root.glob, dir->git.get() ));
+         if( entry ) {
+            ScanCached( worker, dir, entry );
+            return;
+         }
+      }
+      dir->record = m_cache || m_manifest;
+      Task task;
+      if( m_history ) task.cost = m_history->Nanoseconds( dir->path );
+      task.dir = std::move( dir );
+      Push( worker, std::move( task ));
+   }
+
+public:
+   //--------------------------------------------------------------------------
+   ScanStats GetStats() const noexcept override {
+      return m_stats;
+   }
+
+   //--------------------------------------------------------------------------
+   bool SetCache( DirCache *cache ) noexcept override {
+      m_cache = cache;
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   bool SetManifest( Manifest *manifest ) noexcept override {
+      m_manifest = manifest;
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   bool SetGitIgnore( GitIgnore *gitignore ) noexcept override {
+      m_gitignore = gitignore;
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   bool SetFilter( const FilterExpression *filter ) noexcept override {
+      m_expr = filter;
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   bool SetHistory( ScanHistory *history ) noexcept override {
+      m_history = history;
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   bool CanSkipMounts() const noexcept override {
+      return true;
+   }
+
+   //--------------------------------------------------------------------------
+   std::vector<std::string> GetSkippedMounts() const noexcept override {
+      return m_mounts;
+   }
+
+   //--------------------------------------------------------------------------
+   void GetUnfinished( const std::vector<ScanRoot> &roots,
+                       std::vector<std::string> &paths )
+                       const noexcept override {
+      // Until the roots are being dealt out, none of them are finished.
+      if( !m_tracking ) {
+         Scanner::GetUnfinished( roots, paths );
+         return;
+      }
+      for( size_t i = 0; i < roots.size(); i++ ) {
+         if( m_root_pending[i] > 0 ) AddRootPath( roots[i], paths );
+      }
+      for( auto &w : m_workers ) {
+         std::lock_guard<std::mutex> lock( w->mutex );
+         if( !w->running.empty() ) paths.push_back( w->running );
+         for( auto &task : w->tasks ) paths.push_back( TaskPath( task ));
+      }
+      std::lock_guard<std::mutex> lock( m_deferred_mutex );
+      for( auto &links : m_deferred ) {
+         for( auto &link : links ) paths.push_back( link.first );
+      }
+   }
+
+   //--------------------------------------------------------------------------
+   void ScanRoots( std::vector<ScanRoot> &roots ) noexcept override {
+      m_roots = &roots;
+      for( auto &w : m_workers ) {
+         w->hashes.assign( roots.size(), 0 );
+      }
+      if( opt_deadline_ms > 0 ) {
+         auto pending = std::make_unique<std::atomic<size_t>[]>(
+                           roots.size() );
+         for( size_t i = 0; i < roots.size(); i++ ) pending[i] = 1;
+         m_root_pending = std::move( pending );
+         m_tracking = true;
+      }
+      m_visited.clear();
+      m_root_ids.assign( roots.size(), DirId() );
+      m_deferred.clear();
+      m_deferred.resize( roots.size() );
+      // Leave some descriptors for each worker's own use and for the rest of
+      //  the program.
+      m_hold_limit = opt_max_open;
+      struct rlimit limit;
+      if( getrlimit( RLIMIT_NOFILE, &limit ) == 0
+                                       && limit.rlim_cur != RLIM_INFINITY ) {
+         m_hold_limit = (int)std::min<rlim_t>( m_hold_limit,
+                           std::max<rlim_t>( limit.rlim_cur,
+                                             16 + 2 * m_jobs )
+                           - 16 - 2 * m_jobs );
+      }
+
+      // Deal the roots out so that every worker has something to start
+      //  with, the ones that took longest last time first.
+      std::vector<size_t> order( roots.size() );
+      std::vector<uint64_t> costs( roots.size() );
+      for( size_t i = 0; i < roots.size(); i++ ) {
+         order[i] = i;
+         if( m_history ) {
+            std::string path = roots[i].path;
+            if( !path.empty() && path.back() != '/' ) path.push_back( '/' );
+            costs[i] = m_history->Nanoseconds( path );
+         }
+      }
+      std::stable_sort( order.begin(), order.end(),
+                        [&costs]( size_t a, size_t b ) {
+         return costs[a] > costs[b];
+      });
+      for( size_t n = 0; n < order.size(); n++ ) {
+         size_t i = order[n];
+         DealRoot( i, *m_workers[n % m_workers.size()] );
+         if( m_root_pending ) m_root_pending[i]--;
+      }
+
+      RunWorkers();
+      // The links that were put off go one round at a time, so that one is
+      //  done before the next is looked at.
+      while( PushDeferred() ) RunWorkers();
+      m_roots = nullptr;
+   }
+
+   //--------------------------------------------------------------------------
+   Hash Scan( std::string_view path, bool recursive,
+              const GlobState *glob ) noexcept override {
+      std::vector<ScanRoot> roots{ ScanRoot{ std::string( path ), recursive,
+                                             {}, glob }};
+      ScanRoots( roots );
+      return roots[0].hash;
+   }
+
+   //--------------------------------------------------------------------------
+   ParallelScanner( int jobs ) : m_jobs( jobs < 1 ? 1 : jobs ) {
+      for( int i = 0; i < m_jobs; i++ ) {
+         m_workers.emplace_back( new Worker );
+      }
+      SelectScan();
+
+      // Pending subdirectories keep their parent open, so a wide tree can
+      //  have a lot of descriptors open at once. Take whatever we're allowed.
+      struct rlimit limit;
+      if( getrlimit( RLIMIT_NOFILE, &limit ) == 0
+                                         && limit.rlim_cur < limit.rlim_max ) {
+         limit.rlim_cur = limit.rlim_max;
+         setrlimit( RLIMIT_NOFILE, &limit );
+      }
+   }
+};
+
+} /////////////////////////////////////////////////////////////////////////////
+
+#endif // TARGET_LINUX
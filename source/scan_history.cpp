@@ -0,0 +1,140 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#include "scan_history.h"
+#include "manifest.h"
+#include "options.h"
+#include "scanner.h"
+
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <unordered_set>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+static const char *const HISTORY_HEADER = "treehash-history 1";
+
+//-----------------------------------------------------------------------------
+void ScanHistory::Load( const std::string &filename ) noexcept {
+   m_loaded.clear();
+   std::ifstream file( filename, std::ios::binary );
+   if( !file ) {
+      if( opt_verbose )
+         std::cout << "No history file yet at " << filename << ".\n";
+      return;
+   }
+   std::string data( std::istreambuf_iterator<char>( file ), {} );
+
+   std::string_view rest = data;
+   auto take_line = [&rest]() {
+      size_t newline = rest.find( '\n' );
+      std::string_view line = rest.substr( 0, newline );
+      rest.remove_prefix( newline == rest.npos ? rest.size() : newline + 1 );
+      return line;
+   };
+   if( take_line() != HISTORY_HEADER ) {
+      if( opt_verbose )
+         std::cout << "History file is from a different version. Starting"
+                      " over.\n";
+      return;
+   }
+
+   // "<nanoseconds> <entries> <path>"
+   std::string path;
+   while( !rest.empty() ) {
+      std::string_view line = take_line();
+      const char *end = line.data() + line.size();
+      Cost cost;
+      auto ns = std::from_chars( line.data(), end, cost.ns );
+      if( ns.ec != std::errc() || ns.ptr == end || *ns.ptr != ' ' ) break;
+      auto entries = std::from_chars( ns.ptr + 1, end, cost.entries );
+      if( entries.ec != std::errc() || entries.ptr == end
+                                    || *entries.ptr != ' ' ) break;
+      ManifestReader::Unescape( std::string_view( entries.ptr + 1,
+                                   end - entries.ptr - 1 ), path );
+      m_loaded[path] = cost;
+   }
+
+   if( opt_verbose ) {
+      std::cout << "Loaded the history of " << m_loaded.size()
+                << " subtrees.\n";
+   }
+}
+
+//-----------------------------------------------------------------------------
+bool ScanHistory::Save( const std::string &filename,
+                        const std::vector<ScanRoot> &roots ) noexcept {
+   std::unordered_set<std::string> tops;
+   for( auto &root : roots ) {
+      std::string path = root.path;
+      if( !path.empty() && path.back() != '/' ) path.push_back( '/' );
+      tops.insert( std::move( path ));
+   }
+
+   // A subdirectory sorts after its parent, so going backwards, a subtree
+   //  is always summed up before it's added to the one above. Parents that
+   //  weren't read are put in on the way.
+   std::map<std::string, Cost> subtrees;
+   for( auto &[path, cost] : m_read ) {
+      Cost &sum = subtrees[path];
+      sum.ns += cost.ns;
+      sum.entries += cost.entries;
+   }
+   uint64_t total = 0;
+   for( auto it = subtrees.rbegin(); it != subtrees.rend(); ++it ) {
+      if( tops.count( it->first )) {
+         total += it->second.ns;
+         continue;
+      }
+      std::string_view parent = Manifest::ParentPath( it->first );
+      if( parent.empty() ) continue;
+      Cost &sum = subtrees[std::string( parent )];
+      sum.ns += it->second.ns;
+      sum.entries += it->second.entries;
+   }
+
+   // Subtrees that weren't read at all this time, like ones the cache had,
+   //  keep what they cost before, so that the next run without the cache
+   //  still has them.
+   for( auto &[path, cost] : m_loaded ) subtrees.emplace( path, cost );
+
+   std::string out = HISTORY_HEADER;
+   out += '\n';
+   for( auto &[path, cost] : subtrees ) {
+      if( !tops.count( path ) && cost.ns * SHARE < total ) continue;
+      out += std::to_string( cost.ns ) + " " + std::to_string( cost.entries )
+           + " ";
+      Manifest::AppendEscaped( out, path );
+      out += '\n';
+   }
+
+   std::string temp = filename + ".tmp";
+   {
+      std::ofstream file( temp, std::ios::binary | std::ios::trunc );
+      file.write( out.data(), out.size() );
+      if( !file ) {
+         std::cout << "Couldn't write history file " << temp << ".\n";
+         return false;
+      }
+   }
+   std::error_code error_code;
+   std::filesystem::rename( temp, filename, error_code );
+   if( error_code ) {
+      std::cout << "Couldn't write history file " << filename << ".\n";
+      return false;
+   }
+   return true;
+}
+
+//-----------------------------------------------------------------------------
+void ScanHistory::Add( std::string path, Cost cost ) noexcept {
+   std::lock_guard<std::mutex> lock( m_mutex );
+   m_read.emplace_back( std::move( path ), cost );
+}
+
+} /////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,77 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+struct ScanRoot;
+
+//-----------------------------------------------------------------------------
+// What it cost to scan the subtrees of earlier runs, so that a parallel scan
+//  can start on the expensive ones first instead of finding them last.
+//
+// The file is text, one record per line:
+//
+//   treehash-history 1
+//   <nanoseconds> <entries> <path>
+//
+// Each record is a whole subtree: the time spent reading the directories in
+//  it, and how many entries they had. Only subtrees that took at least
+//  1/SHARE of their roots' time are kept, so the file stays small however
+//  big the tree is. Paths are as they're hashed, with a trailing slash,
+//  escaped like in a manifest.
+//
+// Directories can be added from several threads.
+class ScanHistory {
+//-----------------------------------------------------------------------------
+public:
+   struct Cost {
+      uint64_t ns = 0;
+      uint64_t entries = 0;
+   };
+   // Subtrees smaller than the total over this aren't kept.
+   static constexpr uint64_t SHARE = 1024;
+
+private:
+   // From the file.
+   std::unordered_map<std::string, Cost> m_loaded;
+   // What each directory read this run cost, not counting subdirectories.
+   std::vector<std::pair<std::string, Cost>> m_read;
+   std::mutex m_mutex;
+
+public:
+   //--------------------------------------------------------------------------
+   // Loads the file, if there is one.
+   void Load( const std::string &filename ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // Works out the subtrees from what was read this run, and writes the
+   //  expensive ones. Directories that weren't read, like cache hits, only
+   //  count for what's under them, and loaded subtrees that nothing was read
+   //  in are kept as they were.
+   bool Save( const std::string &filename,
+              const std::vector<ScanRoot> &roots ) noexcept;
+
+   //--------------------------------------------------------------------------
+   // Nanoseconds that the subtree at `path` took last time, or 0 if it was
+   //  too small to keep, or wasn't there.
+   uint64_t Nanoseconds( const std::string &path ) const noexcept {
+      if( m_loaded.empty() ) return 0;
+      auto it = m_loaded.find( path );
+      return it == m_loaded.end() ? 0 : it->second.ns;
+   }
+
+   //--------------------------------------------------------------------------
+   // Records a directory that was read. `path` has a trailing slash.
+   void Add( std::string path, Cost cost ) noexcept;
+};
+
+} /////////////////////////////////////////////////////////////////////////////
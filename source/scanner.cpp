@@ -4,12 +4,26 @@
 #include "scanner.h"
 #include "default_scanner.h"
 #include "fastwin_scanner.h"
+#include "linux_scanner.h"
+#include "parallel_scanner.h"
 
 #include <iostream>
 
 ///////////////////////////////////////////////////////////////////////////////
 namespace Treehash {
 
+#ifdef TARGET_LINUX
+//-----------------------------------------------------------------------------
+// Makes the version of a scanner that matches opt_verbose, for the ones that
+//  take VERBOSE as a template argument.
+template< template< bool > class S, typename... Args >
+static std::shared_ptr<Scanner> MakeScanner( Args... args ) noexcept {
+   if( opt_verbose ) return std::make_shared<S<true>>( args... );
+   return std::make_shared<S<false>>( args... );
+}
+#endif
+
+//-----------------------------------------------------------------------------
 std::shared_ptr<Scanner> CreateScanner( std::string_view type ) noexcept {
    if( type == "default" ) {
       if( opt_verbose )
@@ -24,6 +38,20 @@ std::shared_ptr<Scanner> CreateScanner( std::string_view type ) noexcept {
       return std::make_shared<FastwinScanner>();
    }
 #endif
+
+#ifdef TARGET_LINUX
+   if( type == "linux" ) {
+      if( opt_jobs > 1 ) {
+         if( opt_verbose )
+            std::cout << "Creating parallel linux scanner with " << opt_jobs
+                      << " jobs.\n";
+         return MakeScanner<ParallelScanner>( opt_jobs );
+      }
+      if( opt_verbose )
+         std::cout << "Creating linux scanner.\n";
+      return MakeScanner<LinuxScanner>();
+   }
+#endif
    
    if( opt_verbose )
       std::cout << "Scanner of type \"" << type << "\" isn't supported."
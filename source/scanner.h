@@ -3,23 +3,175 @@
 #pragma once
 
 #include "hash.h"
+#include "dir_cache.h"
+#include "manifest.h"
+#include "glob_matcher.h"
+#include "gitignore.h"
+#include "filter_expression.h"
+#include "scan_history.h"
 
+#include <atomic>
+#include <memory>
+#include <string>
 #include <string_view>
+#include <vector>
 
 ///////////////////////////////////////////////////////////////////////////////
 namespace Treehash {
 
+//-----------------------------------------------------------------------------
+// Counters that scanners can fill in for diagnostics.
+struct ScanStats {
+   // Directory entries seen, not counting dotfiles.
+   uint64_t entries = 0;
+   // Entries that needed a stat call to tell what they are. The rest were
+   //  classified from the directory listing alone.
+   uint64_t stats   = 0;
+   // Directories taken from the cache, and directories that had to be read
+   //  because the cache didn't have them or they had changed.
+   uint64_t cache_hits   = 0;
+   uint64_t cache_misses = 0;
+};
+
+//-----------------------------------------------------------------------------
+// A directory to scan.
+struct ScanRoot {
+   // Relative to the base path, unless it's absolute. Files are hashed with
+   //  this as their prefix.
+   std::string path;
+   bool recursive = false;
+   // Globs relative to `path`. If there are any, only files that match one
+   //  of them count.
+   std::vector<std::string> patterns;
+   // Filled in from `patterns` and the exclude patterns before scanning.
+   const GlobState *glob = nullptr;
+   // Filled in by the scanner.
+   Hash hash = 0;
+};
+
+//-----------------------------------------------------------------------------
+// What the cache keeps for a directory to tell whether its entry was made
+//  with the same filters, for the ones that depend on where it is.
+inline Hash FilterKey( const GlobState *glob,
+                       const GitIgnoreFrame *git ) noexcept {
+   return GlobMatcher::Key( glob ) ^ GitIgnore::Key( git ) * 31;
+}
+
+//-----------------------------------------------------------------------------
+// True if a recursive scan goes into the subdirectories of a directory that
+//  is `level` below its root. A directory at --max-depth is treated as if it
+//  were scanned without recursion, which is also how it's cached.
+inline bool WithinMaxDepth( int level ) noexcept {
+   return opt_max_depth < 0 || level < opt_max_depth;
+}
+
+//-----------------------------------------------------------------------------
+// True if subdirectories are checked for being mount points to leave out,
+//  with --one-file-system or --skip-fs.
+inline bool ChecksMounts() noexcept {
+   return opt_one_file_system || !opt_skip_fs.empty();
+}
+
+//-----------------------------------------------------------------------------
+// Adds the path of `root` to `paths` with a trailing slash, like the paths of
+//  the directories under it.
+inline void AddRootPath( const ScanRoot &root,
+                         std::vector<std::string> &paths ) noexcept {
+   std::string &path = paths.emplace_back( root.path );
+   if( !path.empty() && path.back() != '/' ) path.push_back( '/' );
+}
+
 //-----------------------------------------------------------------------------
 class Scanner {
+protected:
+   // How many roots ScanRoots has finished, in order. Read from another
+   //  thread by GetUnfinished.
+   std::atomic<size_t> m_roots_done{ 0 };
 
 public:
    virtual ~Scanner() noexcept = default;
-   virtual void ResetExts() noexcept = 0;
-   virtual void ResetIgnores() noexcept = 0;
-   virtual void AddExt( std::string_view ext ) noexcept = 0;
-   virtual void AddIgnore( std::string_view ignore ) noexcept = 0;
 
-   virtual Hash Scan( std::string_view path, bool recursive ) noexcept = 0;
+   // `glob` is the root's GlobState, from GlobMatcher::Start.
+   virtual Hash Scan( std::string_view path, bool recursive,
+                      const GlobState *glob ) noexcept = 0;
+
+   // Scans several roots, filling in their hashes. Scanners that can work on
+   //  more than one at a time override this; by default they're scanned one
+   //  after another.
+   virtual void ScanRoots( std::vector<ScanRoot> &roots ) noexcept {
+      for( auto &root : roots ) {
+         root.hash = Scan( root.path, root.recursive, root.glob );
+         m_roots_done++;
+      }
+   }
+
+   // Called from another thread when --deadline passes, while the scan, or
+   //  the reads for verify, may still be going. Adds the paths of the roots
+   //  and directories whose subtrees aren't finished to `paths`. Scanners
+   //  that keep track of where they are add the directories they're in;
+   //  otherwise it's just the roots from the one being scanned on.
+   virtual void GetUnfinished( const std::vector<ScanRoot> &roots,
+                               std::vector<std::string> &paths )
+                               const noexcept {
+      for( size_t i = m_roots_done; i < roots.size(); i++ ) {
+         AddRootPath( roots[i], paths );
+      }
+   }
+
+   // Scanners that don't keep counters return all zeroes.
+   virtual ScanStats GetStats() const noexcept { return {}; }
+
+   // Gives the scanner a cache of directory contents to consult and update.
+   //  Returns false if the scanner doesn't support that.
+   virtual bool SetCache( DirCache * /*cache*/ ) noexcept { return false; }
+
+   // Gives the scanner a manifest to add every directory it visits to.
+   //  Returns false if the scanner doesn't support that.
+   virtual bool SetManifest( Manifest * /*manifest*/ ) noexcept {
+      return false;
+   }
+
+   // Makes the scanner honour .gitignore files. Returns false if the scanner
+   //  doesn't support that.
+   virtual bool SetGitIgnore( GitIgnore * /*gitignore*/ ) noexcept {
+      return false;
+   }
+
+   // Gives the scanner a filter expression that files have to match.
+   //  Returns false if the scanner doesn't support that.
+   virtual bool SetFilter( const FilterExpression * /*filter*/ ) noexcept {
+      return false;
+   }
+
+   // Gives the scanner the costs of earlier runs to plan with, and has it
+   //  add what this one cost. Returns false if the scanner doesn't support
+   //  that.
+   virtual bool SetHistory( ScanHistory * /*history*/ ) noexcept {
+      return false;
+   }
+
+   // Reads just the one directory `path` and fills in `entry` the way the
+   //  cache would, without going any deeper. If `recursive`, subdirectories
+   //  are listed as a recursive scan would see them. `glob` is the
+   //  directory's GlobState. Returns false if the directory can't be read.
+   virtual bool ReadDirectory( std::string_view /*path*/,
+                               bool /*recursive*/,
+                               const GlobState * /*glob*/,
+                               DirCacheEntry & /*entry*/ ) noexcept {
+      return false;
+   }
+
+   // True if the scanner implements ReadDirectory.
+   virtual bool CanReadDirectory() const noexcept { return false; }
+
+   // True if the scanner honours --one-file-system and --skip-fs.
+   virtual bool CanSkipMounts() const noexcept { return false; }
+
+   // The mount points that were left out, each with the reason after it.
+   //  A mount point can be in here more than once.
+   virtual std::vector<std::string> GetSkippedMounts() const noexcept {
+      return {};
+   }
 };
 
 //-----------------------------------------------------------------------------
@@ -2,18 +2,122 @@
 ///////////////////////////////////////////////////////////////////////////////
 #include "options.h"
 #include "util.h"
+#include "alloc_counter.h"
 #include "hash.h"
-#include "default_scanner.h"
+#include "scanner.h"
+#include "dir_cache.h"
+#include "manifest.h"
+#include "scan_history.h"
+#include "glob_matcher.h"
+#include "gitignore.h"
+#include "filter_expression.h"
+#include "diff.h"
+#include "verify.h"
 
+#include <algorithm>
 #include <string>
 #include <iostream>
 #include <filesystem>
+#include <iomanip>
 #include <regex>
 #include <chrono>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 ///////////////////////////////////////////////////////////////////////////////
 namespace Treehash {
 
+//-----------------------------------------------------------------------------
+// `allocations` is how many the scan made.
+static void PrintTime( const Scanner &scanner,
+                       std::chrono::steady_clock::time_point start_time,
+                       bool use_cache, uint64_t allocations ) {
+   auto end_time = std::chrono::steady_clock::now();
+   auto time = std::chrono::duration_cast<std::chrono::milliseconds>
+               ( end_time - start_time ).count();
+   
+   std::cout << "Time elapsed: " << time << "ms\n";
+
+   ScanStats stats = scanner.GetStats();
+   if( stats.entries > 0 ) {
+      std::cout << "Entries scanned: " << stats.entries
+                << ", stat calls: " << stats.stats
+                << " (" << (stats.entries - stats.stats) << " avoided)\n";
+   }
+   std::cout << "Allocations while scanning: " << allocations;
+   if( stats.entries > 0 ) {
+      std::cout << " (" << std::fixed << std::setprecision( 3 )
+                << (double)allocations / stats.entries << " per entry)";
+   }
+   std::cout << "\n";
+   if( use_cache ) {
+      std::cout << "Cached directories: " << stats.cache_hits
+                << ", directories read: " << stats.cache_misses << "\n";
+   }
+
+   // The same one can be reached from more than one root.
+   std::vector<std::string> mounts = scanner.GetSkippedMounts();
+   std::sort( mounts.begin(), mounts.end() );
+   mounts.erase( std::unique( mounts.begin(), mounts.end() ), mounts.end() );
+   for( auto &mount : mounts ) {
+      std::cout << "Skipped mount point: " << mount << "\n";
+   }
+}
+
+//-----------------------------------------------------------------------------
+// Exit code for when --deadline passes, apart from the ones that diff and
+//  verify use.
+constexpr int DEADLINE_EXIT = 3;
+
+//-----------------------------------------------------------------------------
+// Runs `work` on a thread of its own and waits for it until --deadline after
+//  `start_time`. If it isn't done by then, the paths that `unfinished` gives
+//  are printed, and we exit with DEADLINE_EXIT. A read from a hung network
+//  mount can't be interrupted, so the thread isn't waited for, and nothing
+//  it might still be using is destroyed.
+static void WithDeadline( std::chrono::steady_clock::time_point start_time,
+      const std::function<void()> &work,
+      const std::function<void( std::vector<std::string>& )> &unfinished ) {
+   if( opt_deadline_ms == 0 ) {
+      work();
+      return;
+   }
+   std::mutex mutex;
+   std::condition_variable done_cv;
+   bool done = false;
+   std::thread thread( [&] {
+      work();
+      std::lock_guard<std::mutex> lock( mutex );
+      done = true;
+      done_cv.notify_one();
+   });
+   {
+      std::unique_lock<std::mutex> lock( mutex );
+      if( done_cv.wait_until( lock, start_time + std::chrono::milliseconds(
+                                       opt_deadline_ms ),
+                              [&] { return done; } )) {
+         lock.unlock();
+         thread.join();
+         return;
+      }
+   }
+
+   std::vector<std::string> paths;
+   unfinished( paths );
+   std::sort( paths.begin(), paths.end() );
+   paths.erase( std::unique( paths.begin(), paths.end() ), paths.end() );
+   std::cout << "Deadline of " << opt_deadline_ms << "ms passed.\n";
+   for( auto &path : paths ) {
+      std::cout << "Unfinished: " << path << "\n";
+   }
+   std::cout.flush();
+   std::_Exit( DEADLINE_EXIT );
+}
+
 //-----------------------------------------------------------------------------
 int Run( int argc, char **argv ) {
    ReadOptions( argc, argv );
@@ -38,35 +142,184 @@ int Run( int argc, char **argv ) {
       std::cout << "Running in verbose mode.\n";
       size_t inputcount = opt_inputs.size();
       std::cout << inputcount << " input" << PluralS(inputcount) << ".\n";
+      std::cout << "Hash version " << opt_hash_version << ".\n";
+      if( opt_hash_version == 3 ) {
+         std::cout << "Long names are hashed with " << Xxh3LongName()
+                   << ".\n";
+      }
 
    }
 
-   std::shared_ptr<Scanner> scanner = CreateScanner( "fastwin" );
+   if( !opt_verify_file.empty() ) {
+      // Verifying goes one directory at a time, in its own order.
+      opt_jobs = 1;
+   }
+
+   std::shared_ptr<Scanner> scanner = CreateScanner( opt_scanner );
+   if( !opt_verify_file.empty() && !scanner->CanReadDirectory() ) {
+      std::cout << "This scanner doesn't support verify.\n";
+      return 2;
+   }
    
    auto start_time = std::chrono::steady_clock::now();
-   Hash hash = 0;
-   for( auto &input : opt_inputs ) {
-      if( opt_verbose )
-         std::cout << "Processing input \"" << input << "\"\n";
-      hash ^= HashInput( input, *scanner );
-      if( opt_verbose )
-         std::cout << "Hash for \"" << input << "\": " << HashToHex(hash) << "\n";
+
+   // Gather every directory up front so the scanner can schedule them all
+   //  together. Input lists and globs are read from disk too, so this counts
+   //  toward --deadline.
+   std::vector<ScanRoot> roots;
+   std::vector<size_t> input_ends;
+   std::atomic<size_t> inputs_done{ 0 };
+   WithDeadline( start_time, [&] {
+      for( auto &input : opt_inputs ) {
+         if( opt_verbose )
+            std::cout << "Processing input \"" << input << "\"\n";
+         CollectRoots( input, roots );
+         input_ends.push_back( roots.size() );
+         inputs_done++;
+      }
+   }, [&]( std::vector<std::string> &paths ) {
+      for( size_t i = inputs_done; i < opt_inputs.size(); i++ ) {
+         paths.push_back( opt_inputs[i] );
+      }
+   });
+
+   // Exclude patterns go for every root, so the roots' globs can only be
+   //  worked out once they're all known.
+   GlobMatcher globs;
+   for( auto &pattern : opt_excludes ) globs.AddExclude( pattern );
+   for( auto &root : roots ) {
+      root.glob = globs.Start( root.path, root.patterns );
+   }
+
+   // Input lists can add filters, so these come after the roots.
+   FilterExpression filter;
+   std::string error;
+   for( auto &expression : opt_filters ) {
+      if( !filter.Add( expression, error )) {
+         std::cout << "Invalid filter \"" << expression << "\": " << error
+                   << ".\n";
+         return opt_diff_file.empty() && opt_verify_file.empty() ? 1 : 2;
+      }
+   }
+   if( !filter.Empty() && !scanner->SetFilter( &filter )) {
+      std::cout << "This scanner doesn't support --filter.\n";
+      return opt_diff_file.empty() && opt_verify_file.empty() ? 1 : 2;
    }
-   auto end_time = std::chrono::steady_clock::now();
 
-   if( opt_verbose ) std::cout << "Final result: ";
-   // In non verbose mode, this should be the only output under normal
-   //  circumstances:
-   std::cout << HashToHex( hash );
-   if( opt_print_time ) std::cout << "\n";
+   // Sizes and times change without touching the directory, so the cache
+   //  can't tell when a filter on them would come out differently.
+   bool cacheable = filter.Needs() == 0;
+   DirCache cache;
+   bool use_cache = !opt_cache_file.empty() && cacheable
+                    && scanner->SetCache( &cache );
+   if( use_cache ) {
+      cache.Load( opt_cache_file, CacheFingerprint() );
+      cache.StartRun( std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::system_clock::now().time_since_epoch() ).count() );
+   } else if( !opt_cache_file.empty() && opt_verbose ) {
+      if( cacheable ) {
+         std::cout << "This scanner doesn't support --cache.\n";
+      } else {
+         std::cout << "Filters on size, age or perm can't use --cache.\n";
+      }
+   }
 
-   if( opt_print_time ) {
-      auto time = std::chrono::duration_cast<std::chrono::milliseconds>
-                  ( end_time - start_time ).count();
-      
-      std::cout << "Time elapsed: " << time << "ms\n";
+   if( ChecksMounts() && !scanner->CanSkipMounts() ) {
+      std::cout << "This scanner doesn't support --one-file-system or"
+                   " --skip-fs.\n";
+      return opt_diff_file.empty() && opt_verify_file.empty() ? 1 : 2;
    }
-   return 0;
+
+   GitIgnore gitignore;
+   if( opt_gitignore && !scanner->SetGitIgnore( &gitignore )) {
+      std::cout << "This scanner doesn't support --gitignore.\n";
+      return opt_diff_file.empty() && opt_verify_file.empty() ? 1 : 2;
+   }
+
+   Manifest manifest;
+   bool want_manifest = !opt_manifest_file.empty() || !opt_diff_file.empty();
+   bool use_manifest = want_manifest && scanner->SetManifest( &manifest );
+   if( use_manifest ) {
+      // Cached directories need their file names for the manifest.
+      cache.NeedNames();
+   } else if( want_manifest ) {
+      std::cout << "This scanner doesn't support manifests.\n";
+      return opt_diff_file.empty() ? 1 : 2;
+   }
+
+   if( !opt_verify_file.empty() ) {
+      // The answer is the exit code. Since this stops early, there's no
+      //  hash to print, and the cache isn't saved.
+      uint64_t allocations = AllocationCount();
+      int result = 0;
+      WithDeadline( start_time, [&] {
+         result = VerifyManifest( opt_verify_file, *scanner, roots );
+      }, [&]( std::vector<std::string> &paths ) {
+         scanner->GetUnfinished( roots, paths );
+      });
+      allocations = AllocationCount() - allocations;
+      if( opt_print_time )
+         PrintTime( *scanner, start_time, use_cache, allocations );
+      return result;
+   }
+
+   // Only helps the parallel scanner, so anything else just goes without.
+   ScanHistory history;
+   bool use_history = !opt_history_file.empty()
+                      && scanner->SetHistory( &history );
+   if( use_history ) {
+      history.Load( opt_history_file );
+   } else if( !opt_history_file.empty() && opt_verbose ) {
+      std::cout << "This scanner doesn't support --history.\n";
+   }
+
+   uint64_t allocations = AllocationCount();
+   WithDeadline( start_time, [&] {
+      scanner->ScanRoots( roots );
+   }, [&]( std::vector<std::string> &paths ) {
+      scanner->GetUnfinished( roots, paths );
+   });
+   allocations = AllocationCount() - allocations;
+
+   if( use_cache ) cache.Save( opt_cache_file, CacheFingerprint() );
+   if( use_history ) history.Save( opt_history_file, roots );
+
+   Hash hash = 0;
+   size_t root_index = 0;
+   for( size_t i = 0; i < opt_inputs.size(); i++ ) {
+      Hash input_hash = 0;
+      for( ; root_index < input_ends[i]; root_index++ ) {
+         input_hash ^= roots[root_index].hash;
+      }
+      hash ^= input_hash;
+      if( opt_verbose ) {
+         std::cout << "Hash for \"" << opt_inputs[i] << "\": "
+                   << ResultToString( input_hash ) << "\n";
+      }
+   }
+   int result = 0;
+   if( !opt_diff_file.empty() ) {
+      // Only the differences are printed, not the hash.
+      result = DiffManifest( opt_diff_file, manifest );
+   }
+   // After the diff, so the old manifest can be replaced with the new one.
+   if( !opt_manifest_file.empty() ) {
+      manifest.Save( opt_manifest_file, roots, hash,
+            std::chrono::duration_cast<std::chrono::seconds>(
+               std::chrono::system_clock::now().time_since_epoch() ).count() );
+   }
+
+   if( opt_diff_file.empty() ) {
+      if( opt_verbose ) std::cout << "Final result: ";
+      // In non verbose mode, this should be the only output under normal
+      //  circumstances:
+      std::cout << ResultToString( hash );
+      if( opt_print_time ) std::cout << "\n";
+   }
+
+   if( opt_print_time )
+      PrintTime( *scanner, start_time, use_cache, allocations );
+   return result;
 }
 
 } /////////////////////////////////////////////////////////////////////////////
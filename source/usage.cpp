@@ -17,8 +17,37 @@ const std::string USAGE {R"==(
 -------------------------------------------------------------------------------
 Usage:
  $ treehash [OPTIONS] inputs...
+ $ treehash diff <manifest> [OPTIONS] inputs...
+ $ treehash verify <manifest> [OPTIONS] inputs...
 
-Inputs can be either folders or input list files (see manual).
+Inputs can be folders, input list files (see manual), or globs. A folder
+with "*" on the end is scanned with its subfolders.
+
+A glob like "src/**/*.cpp" only counts the files that match it. It's scanned
+from the folder in front of its first wildcard, and subfolders that it can't
+match anything in are skipped, so nothing else is read. An input that starts
+with "!", like "!**/generated/**", excludes what it matches from every input
+instead. Those match paths as they're hashed, relative to the base folder,
+and a folder that one matches is skipped entirely. Quote globs so that the
+shell leaves them alone.
+   *       Any run of characters in a name.
+   ?       Any one character.
+   [abc]   One of the characters listed. [a-z] is a range, and [!a] is any
+           character but those.
+   **      As a whole piece of the path, any number of folders, even none.
+A single "*" on the end still means "with subfolders", so "dev/*" is all of
+dev, like "dev/**".
+
+The diff form scans the inputs and compares them to a manifest saved earlier
+with --manifest, printing "+ path" for each file that was added and "- path"
+for each file that was removed. Directories whose hash didn't change are
+skipped. Exits with 0 if nothing changed, 1 if something did, and 2 on
+error. Use the same options that the manifest was made with.
+
+The verify form gives the same exit codes without printing anything, and
+stops at the first difference. It reads one directory at a time, starting
+with the ones that changed most recently according to the manifest, so a
+dirty tree is usually caught right away. Works well with --cache.
 
 Options arguments are passed as --option <arg> / -o <arg>.
 
@@ -31,6 +60,37 @@ OPTIONS:
                                  # dev folder, where for example the main
                                  # source tree might lie.
 
+ -c --cache      Keeps a cache of directory listings in the given file. A
+                 directory that hasn't changed since the last run isn't read
+                 again, which makes checking an unchanged tree much faster.
+                 Use a separate cache file for each set of inputs. Only the
+                 linux scanner supports this.
+                   -c build/treehash.cache
+
+ -o --manifest   Writes a manifest to the given file, with a hash for every
+                 directory that was scanned and a list of its files. When the
+                 result changes, comparing two manifests from the top down
+                 shows where without listing the whole tree. The linux and
+                 default scanners support this.
+                   -o build/tree.manifest
+
+ -p --history    Keeps what each large subtree cost to scan in the given
+                 file, and uses it the next time to start on the most
+                 expensive ones first, so that no worker is left with a big
+                 subtree at the end. Only the parallel linux scanner (-j)
+                 uses this. The hash doesn't depend on it.
+                   -p build/treehash.history
+
+ -H --hash       Selects how file paths are hashed. Hashes from different
+                 versions never match, so manifests and caches are tied to
+                 the version they were made with.
+                   1    # The default. Each file's full path is hashed.
+                   2    # Each directory's path is hashed once, and each file
+                        # only adds its name. Much faster on big trees. The
+                        # result is printed as "v2:<hash>".
+                   3    # The same as 2, but with XXH3, which is faster
+                        # again. Uses AVX2 when the CPU has it.
+
  -h --help       Prints this help.
 
  -e --exts       Any extensions that aren't given will be excluded from the
@@ -39,6 +99,10 @@ OPTIONS:
                    -e .txt -e .cpp    # Only look for .txt or .cpp files
                    -e .txt|.cpp       # Same thing, shorthand.
 
+ -E --exts-nocase
+                 Extensions given with -e match regardless of case, so .cpp
+                 also matches .CPP and .Cpp. Only ASCII letters are folded.
+
  -i --ignore     Any filenames listed here will be ignored from the scan. Any
                  files beginning with a dot "." will always be ignored.
                  Examples:
@@ -47,27 +111,141 @@ OPTIONS:
                                         # won't affect the tree hash.
                    -i dev/core/genie    # Ignore this folder specifically.
 
+ -f --filter     Only counts files that match an expression. Give it more
+                 than once, or use [filter] in an input list, and files have
+                 to match all of them. The linux and default scanners
+                 support this.
+                   name <glob>       # The name matches the glob.
+                   type f | l        # A file, or a symlink to one.
+                   size <op> <n>     # Size, with k, M, G or T on the end.
+                   age <op> <n>      # Time since it was modified, with s,
+                                     # m, h, d or w on the end.
+                   perm <octal>      # All of those permission bits are set.
+                 <op> is <, <=, >, >=, = or !=. Combine them with and, or,
+                 not and parentheses. Files are only statted when their name
+                 doesn't settle it. Filters on size, age or perm turn off
+                 --cache, since those change without the folder changing.
+                   -f "size <= 50M and age < 90d"
+                   -f "not (name *.log or name *.tmp)"
+
+ -g --gitignore  Skips whatever .gitignore files say git ignores, so build
+                 output and the like isn't hashed or even read. Files named
+                 .treehashignore work the same way and win over .gitignore
+                 in the same folder, and .git/info/exclude is read at the
+                 top of the repository. Outside of a repository, the ones
+                 from the base folder down count. An input is always
+                 scanned, even if a .gitignore above it ignores it; only
+                 what's inside of it is checked. The linux and default
+                 scanners support this.
+
+ -d --max-depth  Only goes this many folders below each input that's scanned
+                 with its subfolders. Deeper folders aren't opened, and a
+                 folder at the limit only counts its own files.
+                   -d 0       # The same as leaving off the "*".
+                   -d 2       # The input, its subfolders, and theirs.
+
+ -O --max-open   How many folders are kept open at once on the way down,
+                 256 by default. In deeper trees, the ones furthest up are
+                 closed and opened again when the scan gets back to them, so
+                 memory and handles stay the same however deep it goes. The
+                 smallest it can be is 3. With -j, it's how many folders
+                 are kept open for the subfolders still waiting to be read;
+                 past that, subfolders are opened from a folder further up.
+                 A folder that can't be opened for a reason other than it
+                 being gone or off limits, like running out of handles,
+                 stops the scan with an error instead of leaving it out.
+
+ -D --deadline   Gives up if reading the inputs and scanning them takes
+                 longer than this many milliseconds. Instead of a hash, it
+                 prints "Unfinished: <path>" for each input or folder that
+                 wasn't done, and exits with 3. A folder on a hung network
+                 mount can't stop a build this way. The linux scanner lists
+                 the folders it was in; the others list whole inputs.
+                   -D 2000
+
+ -x --skip-marked
+                 Skips folders that have a .treehash-stop file in them, or a
+                 CACHEDIR.TAG file from the Cache Directory Tagging spec,
+                 along with everything under them. Those are never read, so
+                 build caches that tag themselves cost nothing. The inputs
+                 themselves are always scanned.
+
+ -X --one-file-system
+                 Stays on the filesystem that each input is on. Folders that
+                 are mount points for another one, like bind mounts, FUSE
+                 mounts or network shares, are skipped without being opened,
+                 and automount points aren't set off. The linux scanner
+                 supports this, and -t lists what was skipped.
+
+ -S --skip-fs    Skips mount points for the filesystem types given, and
+                 stays on the rest. Takes names like nfs, cifs, smb2, fuse,
+                 9p, ceph, autofs or tmpfs, or a statfs type number in hex.
+                 An automount point that isn't mounted yet counts as autofs.
+                   -S fuse|nfs|autofs
+
  -v --verbose    Using this option causes a lot of extra information to be spit
                  out, to allow you to diagnose what is going on when the trees
                  are hashed.
 
- -t --time       Measure time elapsed for all hashes and print that.
+ -t --time       Measure time elapsed for all hashes and print that. Scanners
+                 that keep counters also print how many entries were seen and
+                 how many of them needed a stat call. The number of memory
+                 allocations made while scanning is printed too; the linux
+                 scanner makes none for each entry once it's warmed up.
+                 Mount points skipped with -X or -S are listed last.
+
+ -m --symlinks   Follow symlinks, the same as --symlinks=follow. That's the
+                 default.
+ --symlinks=MODE What to do with symlinks.
+                   ignore     # Leave them out, files and folders.
+                   follow     # Follow them, except to a folder that the
+                              # link is already inside of, which would go
+                              # around forever.
+                   once       # Follow them, but read each folder only once
+                              # for each input. A link to a folder inside of
+                              # the same input is left out, since the folder
+                              # is read where it is. Other folder links are
+                              # read after the rest of the input, one at a
+                              # time in order of their paths, so the one
+                              # that gets the folder doesn't depend on -j
+                              # or on the order entries are listed in.
+                              # verify doesn't notice a folder link that's
+                              # added.
+
+ -s --scanner    Selects the directory scanner. All scanners on a platform
+                 produce the same hashes.
+                   default    # Portable, based on std::filesystem. It
+                              # opens folders by their full path, so it
+                              # stops with an error on any path longer
+                              # than the system's limit (PATH_MAX, 4096
+                              # on Linux).
+                   fastwin    # Windows only, the default there.
+                   linux      # Linux only, uses getdents64. The default
+                              # there.
 
- -m --symlinks   Using this options causes any symlinks to be followed, which
-                 are otherwise ignored.
+ -j --jobs       Number of threads to scan with. Defaults to 1. Pass 0 to use
+                 one per CPU. Only the linux scanner supports this; the
+                 others always use one thread. All inputs and input list
+                 folders are shared out across the same threads.
+                   -j 8       # Good for cold caches or network filesystems.
        
 -------------------------------------------------------------------------------
 Example input list file (thingy.txt):
 
 # Only include .txt files or .cpp file paths in the hash.
-[exts] .txt .cpp
+[filter] name *.txt or name *.cpp
 # Ignore any files named this
-[exts] CMakeLists.txt
+!**/CMakeLists.txt
 # Folder listing follows
 dev/apps/fiddle
 dev/core
 dev/proto
 dev/tests
+# Skip anything over 50 MB.
+[filter] size <= 50M
+# Globs and excludes work here too.
+dev/tools/**/*.py
+!**/generated/**
 
 -------------------------------------------------------------------------------
 If for example we're in the "build" folder with thingy.txt nearby, we'd run
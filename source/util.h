@@ -31,7 +31,7 @@ inline void InplaceTrim( std::string *s ) {
 }
 
 //-----------------------------------------------------------------------------
-inline bool IsDelim( char c, char *delims ) {
+inline bool IsDelim( char c, const char *delims ) {
    for( int i = 0; delims[i]; i++ ) {
       if( delims[i] == ' ' && std::isspace(c) ) return true;
       else if( delims[i] == c ) return true;
@@ -41,7 +41,7 @@ inline bool IsDelim( char c, char *delims ) {
 
 //-----------------------------------------------------------------------------
 inline void SplitForeach( const std::string &string_to_parse,
-                   char *null_terminated_delimiters,
+                   const char *null_terminated_delimiters,
                    std::function<void( std::string &piece )> func ) {
 
    auto &delims = null_terminated_delimiters;
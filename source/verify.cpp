@@ -0,0 +1,148 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#include "verify.h"
+#include "options.h"
+
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+#include <string_view>
+#include <unordered_map>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+// A directory from the manifest.
+struct VerifyDirectory {
+   // Still escaped.
+   std::string_view path;
+   Hash files;
+   int64_t changed;
+   bool recursive;
+   // How many directories in the manifest are directly under this one.
+   size_t subdirs = 0;
+};
+
+//-----------------------------------------------------------------------------
+static int Differs( std::string_view path, const char *reason ) noexcept {
+   if( opt_verbose ) std::cout << "Differs at " << path << ": " << reason
+                               << "\n";
+   return 1;
+}
+
+//-----------------------------------------------------------------------------
+// The GlobState of the directory `path`, from the deepest root that it's
+//  under.
+static const GlobState *DirectoryGlob( std::string_view path,
+                          const std::vector<ScanRoot> &roots ) noexcept {
+   const ScanRoot *best = nullptr;
+   size_t best_length = 0;
+   std::string root_path;
+   for( auto &root : roots ) {
+      root_path = root.path;
+      if( !root_path.empty() && root_path.back() != '/' )
+         root_path.push_back( '/' );
+      if( path.compare( 0, root_path.size(), root_path ) != 0 ) continue;
+      if( !best || root_path.size() > best_length ) {
+         best = &root;
+         best_length = root_path.size();
+      }
+   }
+   if( !best ) return nullptr;
+   return GlobMatcher::Find( best->glob, path.substr( best_length ));
+}
+
+//-----------------------------------------------------------------------------
+int VerifyManifest( const std::string &filename, Scanner &scanner,
+                    const std::vector<ScanRoot> &roots ) noexcept {
+   ManifestReader manifest;
+   if( !manifest.Open( filename ) || !manifest.CheckVersion() ) return 2;
+
+   std::vector<VerifyDirectory> dirs;
+   ManifestReader::Directory dir;
+   while( manifest.Next( dir )) {
+      dirs.push_back({ dir.path, dir.files, dir.changed, dir.recursive });
+   }
+
+   // Subdirectories that come or go show up as a difference in their
+   //  parent's listing, so we need to know what each one had.
+   std::unordered_map<std::string_view, size_t> index;
+   for( size_t i = 0; i < dirs.size(); i++ ) {
+      index.emplace( dirs[i].path, i );
+   }
+   for( auto &d : dirs ) {
+      auto parent = index.find( Manifest::ParentPath( d.path ));
+      if( parent != index.end() && dirs[parent->second].recursive ) {
+         dirs[parent->second].subdirs++;
+      }
+   }
+
+   // The inputs have to be the same ones the manifest was made from.
+   std::string path;
+   const auto &saved_roots = manifest.Roots();
+   if( saved_roots.size() != roots.size() ) {
+      return Differs( filename, "the inputs are different" );
+   }
+   for( size_t i = 0; i < roots.size(); i++ ) {
+      path.clear();
+      Manifest::AppendEscaped( path, roots[i].path );
+      if( !path.empty() && path.back() != '/' ) path.push_back( '/' );
+      auto it = index.find( path );
+      if( path != saved_roots[i].path || it == index.end()
+                   || saved_roots[i].recursive != roots[i].recursive ) {
+         return Differs( roots[i].path, "the inputs are different" );
+      }
+   }
+
+   // Where things changed before is where they're most likely to change
+   //  again.
+   std::vector<size_t> order( dirs.size() );
+   std::iota( order.begin(), order.end(), 0 );
+   std::stable_sort( order.begin(), order.end(), [&]( size_t a, size_t b ) {
+      return dirs[a].changed > dirs[b].changed;
+   });
+
+   bool globs = std::any_of( roots.begin(), roots.end(),
+                             []( const ScanRoot &root ) {
+      return root.glob != nullptr;
+   });
+
+   DirCacheEntry entry;
+   std::string child;
+   for( size_t i : order ) {
+      const VerifyDirectory &d = dirs[i];
+      ManifestReader::Unescape( d.path, path );
+      entry = DirCacheEntry();
+      const GlobState *glob = globs ? DirectoryGlob( path, roots ) : nullptr;
+      if( !scanner.ReadDirectory( path, d.recursive, glob, entry )) {
+         return Differs( path, "can't be read" );
+      }
+      if( entry.files != d.files ) return Differs( path, "files changed" );
+      if( !d.recursive ) continue;
+
+      size_t found = 0;
+      for( auto &sub : entry.subdirs ) {
+         child.assign( d.path );
+         Manifest::AppendEscaped( child, sub.name );
+         child.push_back( '/' );
+         if( index.find( child ) != index.end() ) {
+            found++;
+         } else if( !sub.follow || opt_symlinks != Symlinks::ONCE ) {
+            // With --symlinks once, a link to a folder that's read
+            //  somewhere else isn't in the manifest, and there's no telling
+            //  that from here.
+            return Differs( path, "subdirectories changed" );
+         }
+      }
+      if( found != d.subdirs ) {
+         return Differs( path, "subdirectories changed" );
+      }
+   }
+
+   if( opt_verbose ) std::cout << "Verified " << dirs.size()
+                               << " directories.\n";
+   return 0;
+}
+
+} /////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,23 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "scanner.h"
+
+#include <string>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+// Checks whether the tree still matches the manifest in `filename`. The
+//  directories in the manifest are read one at a time, the ones that changed
+//  most recently first, and we stop at the first one that differs. `roots`
+//  are what the inputs expand to, and have to match the manifest's. Returns
+//  the exit code: 0 if nothing changed, 1 if something did, or 2 if the
+//  manifest couldn't be read.
+int VerifyManifest( const std::string &filename, Scanner &scanner,
+                    const std::vector<ScanRoot> &roots ) noexcept;
+
+} /////////////////////////////////////////////////////////////////////////////
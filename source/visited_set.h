@@ -0,0 +1,56 @@
+// treehash (C) 2019 Mukunda Johnson (mukunda@mukunda.com)
+///////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_set>
+
+///////////////////////////////////////////////////////////////////////////////
+namespace Treehash {
+
+//-----------------------------------------------------------------------------
+// Identifies a directory whatever path it's reached by: its device and inode
+//  number, or on Windows, its volume serial number and file index.
+struct DirId {
+   uint64_t dev = 0;
+   uint64_t ino = 0;
+
+   bool operator==( const DirId &other ) const noexcept {
+      return dev == other.dev && ino == other.ino;
+   }
+};
+
+//-----------------------------------------------------------------------------
+// The directories that have been read under one root with --symlinks once.
+//  Workers check in every directory they reach through a symlink, so the
+//  set is split into shards, each with its own lock, to keep them from
+//  waiting on each other.
+class VisitedSet {
+//-----------------------------------------------------------------------------
+   struct IdHash {
+      size_t operator()( const DirId &id ) const noexcept {
+         // Inode numbers are already spread out. The device mostly isn't
+         //  different.
+         return (size_t)(id.ino * 0x9E3779B97F4A7C15ULL ^ id.dev);
+      }
+   };
+   struct Shard {
+      std::mutex mutex;
+      std::unordered_set<DirId, IdHash> ids;
+   };
+   static constexpr int SHARDS = 16;
+   Shard m_shards[SHARDS];
+
+public:
+   //--------------------------------------------------------------------------
+   // Adds `id`. Returns false if it was already there, so the directory has
+   //  been read before.
+   bool Insert( const DirId &id ) noexcept {
+      Shard &shard = m_shards[IdHash()( id ) % SHARDS];
+      std::lock_guard<std::mutex> lock( shard.mutex );
+      return shard.ids.insert( id ).second;
+   }
+};
+
+} /////////////////////////////////////////////////////////////////////////////
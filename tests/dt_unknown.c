@@ -0,0 +1,40 @@
+// LD_PRELOAD shim that makes getdents64 report every entry as DT_UNKNOWN,
+//  the way filesystems without d_type do (ext2 without filetype, some network
+//  and FUSE filesystems). The scanners call it through syscall().
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <dlfcn.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <sys/syscall.h>
+
+struct dirent64_record {
+   unsigned long long d_ino;
+   long long          d_off;
+   unsigned short     d_reclen;
+   unsigned char      d_type;
+   char               d_name[];
+};
+
+long syscall( long number, ... ) {
+   static long (*real)( long, ... );
+   if( !real ) real = (long (*)( long, ... ))dlsym( RTLD_NEXT, "syscall" );
+
+   va_list args;
+   va_start( args, number );
+   long a = va_arg( args, long ), b = va_arg( args, long ),
+        c = va_arg( args, long ), d = va_arg( args, long ),
+        e = va_arg( args, long ), f = va_arg( args, long );
+   va_end( args );
+
+   long result = real( number, a, b, c, d, e, f );
+   if( number == SYS_getdents64 && result > 0 ) {
+      char *buffer = (char*)b;
+      for( long pos = 0; pos < result; ) {
+         struct dirent64_record *entry = (void*)(buffer + pos);
+         entry->d_type = DT_UNKNOWN;
+         pos += entry->d_reclen;
+      }
+   }
+   return result;
+}
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Hashes a tree with symlinks in every --symlinks mode, with getdents64
+#  reporting DT_UNKNOWN for everything, and checks that the linux scanner,
+#  the parallel one and the default one agree with each other and with a
+#  normal run.
+#
+#  usage: tests/dt_unknown.sh path/to/treehash
+treehash=$(realpath "${1:?usage: $0 path/to/treehash}")
+here=$(dirname "$(realpath "$0")")
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+cc -shared -fPIC -O2 -o "$work/dt_unknown.so" "$here/dt_unknown.c" -ldl \
+   || exit 1
+
+tree="$work/tree"
+mkdir -p "$tree/a/b/c" "$tree/d" "$work/outside/e"
+echo one > "$tree/a/one.txt"
+echo two > "$tree/a/b/two.txt"
+echo three > "$tree/a/b/c/three.txt"
+echo four > "$tree/d/four.txt"
+echo five > "$work/outside/e/five.txt"
+ln -s ../a/b "$tree/d/inside"
+ln -s ../../outside "$tree/d/outside"
+ln -s ../one.txt "$tree/a/b/link.txt"
+ln -s .. "$tree/a/b/c/up"
+
+failed=0
+for mode in ignore follow once; do
+   expected=$("$treehash" --symlinks=$mode -s linux "$tree/*") || exit 1
+   for scanner in "-s linux" "-s linux -j 3" "-s default"; do
+      got=$(LD_PRELOAD="$work/dt_unknown.so" \
+            "$treehash" --symlinks=$mode $scanner "$tree/*")
+      if [ "$got" != "$expected" ]; then
+         echo "FAIL --symlinks=$mode $scanner: $got, expected $expected"
+         failed=1
+      fi
+   done
+done
+[ $failed = 0 ] && echo "ok"
+exit $failed